@@ -0,0 +1,96 @@
+#include <iostream>
+#include <cilantro/core/kd_tree.hpp>
+#include <cilantro/correspondence_search/common_transformable_feature_adaptors.hpp>
+#include <cilantro/correspondence_search/correspondence_search_kd_tree.hpp>
+#include <cilantro/utilities/point_cloud.hpp>
+#include <cilantro/utilities/timer.hpp>
+
+// Fraction of exact neighbors that are also found by the approximate search
+float computeRecall(const cilantro::NeighborhoodSet<float> &exact, const cilantro::NeighborhoodSet<float> &approx) {
+    size_t total = 0, found = 0;
+    for (size_t i = 0; i < exact.size(); i++) {
+        total += exact[i].size();
+        for (size_t j = 0; j < exact[i].size(); j++) {
+            for (size_t l = 0; l < approx[i].size(); l++) {
+                if (approx[i][l].index == exact[i][j].index) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    return (total == 0) ? 1.0f : (float)found/total;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        std::cout << "Please provide paths to two PLY files (e.g. examples/test_clouds/frame_1.ply and frame_2.ply)." << std::endl;
+        return 0;
+    }
+
+    cilantro::PointCloud3f dst(argv[1]), src(argv[2]);
+    dst.removeInvalidData();
+    src.removeInvalidData();
+
+    if (dst.isEmpty() || src.isEmpty()) {
+        std::cout << "Input cloud is empty!" << std::endl;
+        return 0;
+    }
+
+    const size_t k = 10;
+    const float eps_values[] = {0.0f, 0.5f, 1.0f, 2.0f, 0.0f, 0.0f, 0.0f, 0.5f};
+    const size_t max_leaf_visit_values[] = {0, 0, 0, 0, 64, 32, 16, 32};
+    const size_t num_settings = sizeof(eps_values)/sizeof(eps_values[0]);
+
+    cilantro::Timer timer;
+    cilantro::KDTree3f<> tree(dst.points);
+
+    // kNN search of src points in dst
+    cilantro::NeighborhoodSet<float> exact_nn, approx_nn;
+    tree.kNNSearch(src.points, k, exact_nn);
+    timer.start();
+    tree.kNNSearch(src.points, k, exact_nn);
+    const double exact_knn_time = timer.stopAndGetElapsedTime();
+
+    std::cout << "kNN search (k = " << k << ", " << src.size() << " queries, exact: " << exact_knn_time << "ms)" << std::endl;
+    for (size_t s = 1; s < num_settings; s++) {
+        tree.setSearchEpsilon(eps_values[s]).setMaxLeafVisits(max_leaf_visit_values[s]);
+        timer.start();
+        tree.kNNSearch(src.points, k, approx_nn);
+        const double time = timer.stopAndGetElapsedTime();
+        std::cout << "  eps: " << eps_values[s] << ", max leaf visits: " << max_leaf_visit_values[s]
+                  << ", recall: " << computeRecall(exact_nn, approx_nn) << ", speedup: " << exact_knn_time/time << "x" << std::endl;
+    }
+
+    // ICP-style correspondence search (tree construction excluded)
+    cilantro::PointFeaturesAdaptor3f dst_feat(dst.points);
+    cilantro::PointFeaturesAdaptor3f src_feat(src.points);
+    cilantro::DistanceEvaluator<float> evaluator;
+    cilantro::CorrespondenceSearchKDTree<cilantro::PointFeaturesAdaptor3f> corr_search(dst_feat, src_feat, evaluator);
+    corr_search.setMaxDistance(0.05f*0.05f).findCorrespondences();
+
+    timer.start();
+    corr_search.findCorrespondences();
+    const double exact_corr_time = timer.stopAndGetElapsedTime();
+    const cilantro::CorrespondenceSet<float> exact_corr(corr_search.getCorrespondences());
+
+    std::cout << "Correspondence search (" << exact_corr.size() << " correspondences, exact: " << exact_corr_time << "ms)" << std::endl;
+    for (size_t s = 1; s < num_settings; s++) {
+        corr_search.setSearchEpsilon(eps_values[s]).setMaxLeafVisits(max_leaf_visit_values[s]);
+        timer.start();
+        corr_search.findCorrespondences();
+        const double time = timer.stopAndGetElapsedTime();
+        const cilantro::CorrespondenceSet<float>& corr(corr_search.getCorrespondences());
+
+        // Correspondences are reported in query order; count those matching the exact ones
+        size_t matching = 0;
+        for (size_t i = 0, j = 0; i < exact_corr.size(); i++) {
+            while (j < corr.size() && corr[j].indexInSecond < exact_corr[i].indexInSecond) j++;
+            if (j < corr.size() && corr[j].indexInSecond == exact_corr[i].indexInSecond && corr[j].indexInFirst == exact_corr[i].indexInFirst) matching++;
+        }
+        std::cout << "  eps: " << eps_values[s] << ", max leaf visits: " << max_leaf_visit_values[s]
+                  << ", recall: " << (float)matching/std::max<size_t>(exact_corr.size(), 1) << ", speedup: " << exact_corr_time/time << "x" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <cstring>
+#include <iostream>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <cilantro/core/kd_tree.hpp>
+#include <cilantro/clustering/connected_component_extraction.hpp>
+#include <cilantro/utilities/nearest_neighbor_graph_utilities.hpp>
+#include <cilantro/utilities/point_cloud.hpp>
+#include <cilantro/utilities/timer.hpp>
+
+// Last-level cache misses of this process (all threads), via Linux perf events; reports -1 where hardware
+// counters are not available (non-Linux, virtual machines without a PMU, or perf_event_paranoid > 2)
+class CacheMissCounter {
+public:
+    CacheMissCounter() : fd_(-1) {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~CacheMissCounter() {
+#ifdef __linux__
+        if (fd_ >= 0) close(fd_);
+#endif
+    }
+
+    inline bool isAvailable() const { return fd_ >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    long long stopAndGetCount() {
+        long long count = -1;
+#ifdef __linux__
+        if (fd_ < 0) return count;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd_, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+        return count;
+    }
+
+private:
+    int fd_;
+};
+
+int main(int argc, char ** argv) {
+    // Opened before any OpenMP worker is spawned, so that all threads inherit the counter
+    CacheMissCounter misses;
+
+    if (argc < 2) {
+        std::cout << "Please provide path to PLY file." << std::endl;
+        return 0;
+    }
+
+    cilantro::PointCloud3f cloud(argv[1]);
+    cloud.removeInvalidData();
+
+    if (cloud.isEmpty()) {
+        std::cout << "Input cloud is empty!" << std::endl;
+        return 0;
+    }
+
+    const size_t k = 16;
+    cilantro::KDTree3f<> tree(cloud.points);
+
+    cilantro::Timer timer;
+
+    // Nested vectors: one heap buffer per query point
+    misses.start();
+    timer.start();
+    cilantro::NeighborhoodSet<float> nested;
+    tree.kNNSearch(cloud.points, k, nested);
+    const double nested_search_time = timer.stopAndGetElapsedTime();
+    const long long nested_search_misses = misses.stopAndGetCount();
+
+    // CSR layout: one neighbor buffer per block of queries, concatenated into a single array
+    misses.start();
+    timer.start();
+    cilantro::FlatNeighborhoodSet<float> flat;
+    tree.kNNSearch(cloud.points, k, flat);
+    const double flat_search_time = timer.stopAndGetElapsedTime();
+    const long long flat_search_misses = misses.stopAndGetCount();
+
+    // Full sweep over all neighborhoods, as done by graph builders and resampling
+    misses.start();
+    timer.start();
+    double nested_sum = 0.0;
+    for (size_t i = 0; i < nested.size(); i++) {
+        for (size_t j = 0; j < nested[i].size(); j++) nested_sum += nested[i][j].value;
+    }
+    const double nested_sweep_time = timer.stopAndGetElapsedTime();
+    const long long nested_sweep_misses = misses.stopAndGetCount();
+
+    misses.start();
+    timer.start();
+    double flat_sum = 0.0;
+    for (size_t i = 0; i < flat.getNumberOfNeighbors(); i++) {
+        flat_sum += flat.neighbors[i].value;
+    }
+    const double flat_sweep_time = timer.stopAndGetElapsedTime();
+    const long long flat_sweep_misses = misses.stopAndGetCount();
+
+    misses.start();
+    timer.start();
+    auto nested_graph = cilantro::getNNGraphSparseDistanceMatrix(nested);
+    const double nested_graph_time = timer.stopAndGetElapsedTime();
+    const long long nested_graph_misses = misses.stopAndGetCount();
+
+    misses.start();
+    timer.start();
+    auto flat_graph = cilantro::getNNGraphSparseDistanceMatrix(flat);
+    const double flat_graph_time = timer.stopAndGetElapsedTime();
+    const long long flat_graph_misses = misses.stopAndGetCount();
+
+    const size_t num_blocks = (cloud.size() + 1023)/1024;
+
+    std::cout << "Points: " << cloud.size() << ", k: " << k << std::endl;
+    std::cout << "Heap buffers during search: " << nested.size() + 1 << " (nested) vs " << num_blocks + 3 << " (flat)" << std::endl;
+    std::cout << "Batch kNN search time: " << nested_search_time << "ms (nested) vs " << flat_search_time << "ms (flat)" << std::endl;
+    std::cout << "Neighbor sweep time: " << nested_sweep_time << "ms (nested) vs " << flat_sweep_time << "ms (flat)" << std::endl;
+    std::cout << "Sparse graph build time: " << nested_graph_time << "ms (nested) vs " << flat_graph_time << "ms (flat)" << std::endl;
+    if (misses.isAvailable()) {
+        std::cout << "Cache misses (search): " << nested_search_misses << " (nested) vs " << flat_search_misses << " (flat)" << std::endl;
+        std::cout << "Cache misses (sweep): " << nested_sweep_misses << " (nested) vs " << flat_sweep_misses << " (flat)" << std::endl;
+        std::cout << "Cache misses (graph build): " << nested_graph_misses << " (nested) vs " << flat_graph_misses << " (flat)" << std::endl;
+    } else {
+        std::cout << "Cache miss counters not available on this system" << std::endl;
+    }
+    std::cout << "Checksums: " << nested_sum << " " << flat_sum << ", " << nested_graph.nonZeros() << " " << flat_graph.nonZeros() << ", " << (nested_graph - flat_graph).norm() << std::endl;
+
+    auto components = cilantro::extractConnectedComponents(flat);
+    std::cout << components.size() << " connected components in the kNN graph" << std::endl;
+
+    return 0;
+}
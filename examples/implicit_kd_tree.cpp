@@ -0,0 +1,89 @@
+#include <iostream>
+#include <cilantro/core/implicit_kd_tree.hpp>
+#include <cilantro/core/normal_estimation.hpp>
+#include <cilantro/correspondence_search/common_transformable_feature_adaptors.hpp>
+#include <cilantro/correspondence_search/correspondence_search_kd_tree.hpp>
+#include <cilantro/utilities/point_cloud.hpp>
+#include <cilantro/utilities/timer.hpp>
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        std::cout << "Please provide path to PLY file." << std::endl;
+        return 0;
+    }
+
+    cilantro::PointCloud3f cloud(argv[1]);
+    cloud.removeInvalidData();
+
+    if (cloud.isEmpty()) {
+        std::cout << "Input cloud is empty!" << std::endl;
+        return 0;
+    }
+
+    const size_t k = 10;
+    cilantro::Timer timer;
+
+    // Tree construction
+    timer.start();
+    cilantro::KDTree3f<> kd_tree(cloud.points);
+    const double kd_build_time = timer.stopAndGetElapsedTime();
+
+    timer.start();
+    cilantro::ImplicitKDTree3f<> implicit_tree(cloud.points);
+    const double implicit_build_time = timer.stopAndGetElapsedTime();
+
+    // Batch kNN
+    timer.start();
+    cilantro::NeighborhoodSet<float> kd_nn;
+    kd_tree.kNNSearch(cloud.points, k, kd_nn);
+    const double kd_knn_time = timer.stopAndGetElapsedTime();
+
+    timer.start();
+    cilantro::NeighborhoodSet<float> implicit_nn;
+    implicit_tree.kNNSearch(cloud.points, k, implicit_nn);
+    const double implicit_knn_time = timer.stopAndGetElapsedTime();
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < kd_nn.size(); i++) {
+        for (size_t j = 0; j < kd_nn[i].size(); j++) {
+            // Leaf distances are summed in a different order, so allow for rounding
+            if (std::abs(kd_nn[i][j].value - implicit_nn[i][j].value) > 1e-5f*kd_nn[i][j].value) mismatches++;
+        }
+    }
+
+    // Normal estimation (tree given)
+    cilantro::VectorSet3f normals(3, cloud.size());
+
+    timer.start();
+    cilantro::NormalEstimation3f<>(kd_tree).estimateNormalsKNN(normals, k);
+    const double kd_normals_time = timer.stopAndGetElapsedTime();
+
+    timer.start();
+    cilantro::NormalEstimation<float,3,cilantro::Covariance<float,3>,size_t,cilantro::ImplicitKDTree3f<>>(implicit_tree).estimateNormalsKNN(normals, k);
+    const double implicit_normals_time = timer.stopAndGetElapsedTime();
+
+    // Correspondence search against a slightly displaced copy (includes tree construction)
+    cilantro::PointCloud3f moved(cloud.transformed(cilantro::RigidTransform3f(Eigen::AngleAxisf(0.05f, Eigen::Vector3f::UnitY()))));
+    cilantro::PointFeaturesAdaptor3f dst_feat(cloud.points);
+    cilantro::PointFeaturesAdaptor3f src_feat(moved.points);
+    cilantro::DistanceEvaluator<float> evaluator;
+
+    timer.start();
+    cilantro::CorrespondenceSearchKDTree<cilantro::PointFeaturesAdaptor3f> kd_corr(dst_feat, src_feat, evaluator);
+    kd_corr.setMaxDistance(0.05f*0.05f).findCorrespondences();
+    const double kd_corr_time = timer.stopAndGetElapsedTime();
+
+    timer.start();
+    cilantro::CorrespondenceSearchKDTree<cilantro::PointFeaturesAdaptor3f,cilantro::KDTreeDistanceAdaptors::L2,cilantro::PointFeaturesAdaptor3f,cilantro::DistanceEvaluator<float>,size_t,cilantro::ImplicitKDTree3f<>> implicit_corr(dst_feat, src_feat, evaluator);
+    implicit_corr.setMaxDistance(0.05f*0.05f).findCorrespondences();
+    const double implicit_corr_time = timer.stopAndGetElapsedTime();
+
+    std::cout << "Points: " << cloud.size() << ", k: " << k << std::endl;
+    std::cout << "Build time: " << kd_build_time << "ms (KDTree) vs " << implicit_build_time << "ms (ImplicitKDTree)" << std::endl;
+    std::cout << "Batch kNN time: " << kd_knn_time << "ms (KDTree) vs " << implicit_knn_time << "ms (ImplicitKDTree), " << mismatches << " mismatched distances" << std::endl;
+    std::cout << "Normal estimation time: " << kd_normals_time << "ms (KDTree) vs " << implicit_normals_time << "ms (ImplicitKDTree)" << std::endl;
+    std::cout << "Correspondence search time: " << kd_corr_time << "ms (KDTree, " << kd_corr.getCorrespondences().size() << " correspondences) vs "
+              << implicit_corr_time << "ms (ImplicitKDTree, " << implicit_corr.getCorrespondences().size() << " correspondences)" << std::endl;
+
+    return 0;
+}
@@ -16,101 +16,114 @@ namespace cilantro {
         inline bool operator()(const T& obj1, const T& obj2) const { return obj1.size() > obj2.size(); }
     };
 
-    // Given neighbors and seeds
-    template <typename ScalarT, typename IndexT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
-    void extractConnectedComponents(const NeighborhoodSet<ScalarT,IndexT> &neighbors,
-                                    const std::vector<IndexT> &seeds_ind,
-                                    std::vector<std::vector<IndexT>> &segment_to_point_map,
-                                    const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
-                                    size_t min_segment_size = 1,
-                                    size_t max_segment_size = std::numeric_limits<size_t>::max())
-    {
-        const size_t unassigned = std::numeric_limits<size_t>::max();
-        std::vector<size_t> current_label(neighbors.size(), unassigned);
+    namespace internal {
+        template <class NeighborhoodSetT, typename IndexT, class PointSimilarityEvaluator>
+        void extractConnectedComponentsFromNeighborhoods(const NeighborhoodSetT &neighbors,
+                                                         const std::vector<IndexT> &seeds_ind,
+                                                         std::vector<std::vector<IndexT>> &segment_to_point_map,
+                                                         const PointSimilarityEvaluator &evaluator,
+                                                         size_t min_segment_size,
+                                                         size_t max_segment_size)
+        {
+            const size_t unassigned = std::numeric_limits<size_t>::max();
+            std::vector<size_t> current_label(neighbors.size(), unassigned);
 
-        std::vector<size_t> frontier_set;
-        frontier_set.reserve(neighbors.size());
+            std::vector<size_t> frontier_set;
+            frontier_set.reserve(neighbors.size());
 
-        std::vector<std::set<size_t>> seeds_to_merge_with(seeds_ind.size());
-        std::vector<char> seed_active(seeds_ind.size(), 0);
+            std::vector<std::set<size_t>> seeds_to_merge_with(seeds_ind.size());
+            std::vector<char> seed_active(seeds_ind.size(), 0);
 
 #pragma omp parallel for shared (seeds_ind, current_label, seed_active, seeds_to_merge_with) private (frontier_set)
-        for (size_t i = 0; i < seeds_ind.size(); i++) {
-            if (current_label[seeds_ind[i]] != unassigned) continue;
-
-            seeds_to_merge_with[i].insert(i);
-
-            frontier_set.clear();
-            frontier_set.emplace_back(seeds_ind[i]);
-
-            current_label[seeds_ind[i]] = i;
-            seed_active[i] = 1;
-
-            while (!frontier_set.empty()) {
-                const size_t curr_seed = frontier_set.back();
-                frontier_set.pop_back();
-
-                const Neighborhood<ScalarT,IndexT>& nn(neighbors[curr_seed]);
-                for (size_t j = 1; j < nn.size(); j++) {
-                    const size_t curr_lbl = current_label[nn[j].index];
-                    if (curr_lbl == i || evaluator(curr_seed, nn[j].index, nn[j].value)) {
-                        if (curr_lbl == unassigned) {
-                            frontier_set.emplace_back(nn[j].index);
-                            current_label[nn[j].index] = i;
-                        } else {
-                            if (curr_lbl != i) seeds_to_merge_with[i].insert(curr_lbl);
+            for (size_t i = 0; i < seeds_ind.size(); i++) {
+                if (current_label[seeds_ind[i]] != unassigned) continue;
+
+                seeds_to_merge_with[i].insert(i);
+
+                frontier_set.clear();
+                frontier_set.emplace_back(seeds_ind[i]);
+
+                current_label[seeds_ind[i]] = i;
+                seed_active[i] = 1;
+
+                while (!frontier_set.empty()) {
+                    const size_t curr_seed = frontier_set.back();
+                    frontier_set.pop_back();
+
+                    const auto& nn(neighbors[curr_seed]);
+                    for (size_t j = 1; j < nn.size(); j++) {
+                        const size_t curr_lbl = current_label[nn[j].index];
+                        if (curr_lbl == i || evaluator(curr_seed, nn[j].index, nn[j].value)) {
+                            if (curr_lbl == unassigned) {
+                                frontier_set.emplace_back(nn[j].index);
+                                current_label[nn[j].index] = i;
+                            } else {
+                                if (curr_lbl != i) seeds_to_merge_with[i].insert(curr_lbl);
+                            }
                         }
                     }
                 }
             }
-        }
 
-        for (size_t i = 0; i < seeds_to_merge_with.size(); i++) {
-            for (auto it = seeds_to_merge_with[i].begin(); it != seeds_to_merge_with[i].end(); ++it) {
-                seeds_to_merge_with[*it].insert(i);
+            for (size_t i = 0; i < seeds_to_merge_with.size(); i++) {
+                for (auto it = seeds_to_merge_with[i].begin(); it != seeds_to_merge_with[i].end(); ++it) {
+                    seeds_to_merge_with[*it].insert(i);
+                }
             }
-        }
 
-        std::vector<size_t> seed_repr(seeds_ind.size(), unassigned);
-        size_t seed_cluster_num = 0;
-        for (size_t i = 0; i < seeds_to_merge_with.size(); i++) {
-            if (seed_active[i] == 0 || seed_repr[i] != unassigned) continue;
-
-            frontier_set.clear();
-            frontier_set.emplace_back(i);
-            seed_repr[i] = seed_cluster_num;
-
-            while (!frontier_set.empty()) {
-                const size_t curr_seed = frontier_set.back();
-                frontier_set.pop_back();
-                for (auto it = seeds_to_merge_with[curr_seed].begin(); it != seeds_to_merge_with[curr_seed].end(); ++it) {
-                    if (seed_active[i] == 1 && seed_repr[*it] == unassigned) {
-                        frontier_set.emplace_back(*it);
-                        seed_repr[*it] = seed_cluster_num;
+            std::vector<size_t> seed_repr(seeds_ind.size(), unassigned);
+            size_t seed_cluster_num = 0;
+            for (size_t i = 0; i < seeds_to_merge_with.size(); i++) {
+                if (seed_active[i] == 0 || seed_repr[i] != unassigned) continue;
+
+                frontier_set.clear();
+                frontier_set.emplace_back(i);
+                seed_repr[i] = seed_cluster_num;
+
+                while (!frontier_set.empty()) {
+                    const size_t curr_seed = frontier_set.back();
+                    frontier_set.pop_back();
+                    for (auto it = seeds_to_merge_with[curr_seed].begin(); it != seeds_to_merge_with[curr_seed].end(); ++it) {
+                        if (seed_active[i] == 1 && seed_repr[*it] == unassigned) {
+                            frontier_set.emplace_back(*it);
+                            seed_repr[*it] = seed_cluster_num;
+                        }
                     }
                 }
-            }
 
-            seed_cluster_num++;
-        }
+                seed_cluster_num++;
+            }
 
-        std::vector<std::vector<IndexT>> segment_to_point_map_tmp(seed_cluster_num);
-        for (size_t i = 0; i < current_label.size(); i++) {
-            if (current_label[i] == unassigned) continue;
-            const auto ind = seed_repr[current_label[i]];
-            if (segment_to_point_map_tmp[ind].size() <= max_segment_size) {
-                segment_to_point_map_tmp[ind].emplace_back(i);
+            std::vector<std::vector<IndexT>> segment_to_point_map_tmp(seed_cluster_num);
+            for (size_t i = 0; i < current_label.size(); i++) {
+                if (current_label[i] == unassigned) continue;
+                const auto ind = seed_repr[current_label[i]];
+                if (segment_to_point_map_tmp[ind].size() <= max_segment_size) {
+                    segment_to_point_map_tmp[ind].emplace_back(i);
+                }
             }
-        }
 
-        segment_to_point_map.clear();
-        for (size_t i = 0; i < segment_to_point_map_tmp.size(); i++) {
-            if (segment_to_point_map_tmp[i].size() >= min_segment_size && segment_to_point_map_tmp[i].size() <= max_segment_size) {
-                segment_to_point_map.emplace_back(std::move(segment_to_point_map_tmp[i]));
+            segment_to_point_map.clear();
+            for (size_t i = 0; i < segment_to_point_map_tmp.size(); i++) {
+                if (segment_to_point_map_tmp[i].size() >= min_segment_size && segment_to_point_map_tmp[i].size() <= max_segment_size) {
+                    segment_to_point_map.emplace_back(std::move(segment_to_point_map_tmp[i]));
+                }
             }
+
+            std::sort(segment_to_point_map.begin(), segment_to_point_map.end(), SizeGreaterComparator<std::vector<IndexT>>());
         }
+    } // namespace internal
 
-        std::sort(segment_to_point_map.begin(), segment_to_point_map.end(), SizeGreaterComparator<std::vector<IndexT>>());
+    // Given neighbors and seeds
+    template <typename ScalarT, typename IndexT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+    inline void extractConnectedComponents(const NeighborhoodSet<ScalarT,IndexT> &neighbors,
+                                           const std::vector<IndexT> &seeds_ind,
+                                           std::vector<std::vector<IndexT>> &segment_to_point_map,
+                                           const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                           size_t min_segment_size = 1,
+                                           size_t max_segment_size = std::numeric_limits<size_t>::max())
+    {
+        internal::extractConnectedComponentsFromNeighborhoods(neighbors, seeds_ind, segment_to_point_map, evaluator, min_segment_size, max_segment_size);
     }
 
     // Given neighbors and seeds
@@ -153,6 +166,58 @@ namespace cilantro {
         return segment_to_point_map;
     }
 
+    // Given flat neighbors and seeds
+    template <typename ScalarT, typename IndexT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+    inline void extractConnectedComponents(const FlatNeighborhoodSet<ScalarT,IndexT> &neighbors,
+                                           const std::vector<IndexT> &seeds_ind,
+                                           std::vector<std::vector<IndexT>> &segment_to_point_map,
+                                           const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                           size_t min_segment_size = 1,
+                                           size_t max_segment_size = std::numeric_limits<size_t>::max())
+    {
+        internal::extractConnectedComponentsFromNeighborhoods(neighbors, seeds_ind, segment_to_point_map, evaluator, min_segment_size, max_segment_size);
+    }
+
+    // Given flat neighbors and seeds
+    template <typename ScalarT, typename IndexT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+    inline std::vector<std::vector<IndexT>> extractConnectedComponents(const FlatNeighborhoodSet<ScalarT,IndexT> &neighbors,
+                                                                       const std::vector<IndexT> &seeds_ind,
+                                                                       const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                                                       size_t min_segment_size = 1,
+                                                                       size_t max_segment_size = std::numeric_limits<size_t>::max())
+    {
+        std::vector<std::vector<IndexT>> segment_to_point_map;
+        extractConnectedComponents<ScalarT,IndexT,PointSimilarityEvaluator>(neighbors, seeds_ind, segment_to_point_map, evaluator, min_segment_size, max_segment_size);
+        return segment_to_point_map;
+    }
+
+    // Given flat neighbors, all seeds
+    template <typename ScalarT, typename IndexT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+    void extractConnectedComponents(const FlatNeighborhoodSet<ScalarT,IndexT> &neighbors,
+                                    std::vector<std::vector<IndexT>> &segment_to_point_map,
+                                    const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                    size_t min_segment_size = 1,
+                                    size_t max_segment_size = std::numeric_limits<size_t>::max())
+    {
+        std::vector<IndexT> seeds_ind(neighbors.size());
+        for (size_t i = 0; i < seeds_ind.size(); i++) seeds_ind[i] = static_cast<IndexT>(i);
+        extractConnectedComponents<ScalarT,IndexT,PointSimilarityEvaluator>(neighbors, seeds_ind, segment_to_point_map, evaluator, min_segment_size, max_segment_size);
+    }
+
+    // Given flat neighbors, all seeds
+    template <typename ScalarT, typename IndexT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+    std::vector<std::vector<IndexT>> extractConnectedComponents(const FlatNeighborhoodSet<ScalarT,IndexT> &neighbors,
+                                                                const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                                                size_t min_segment_size = 1,
+                                                                size_t max_segment_size = std::numeric_limits<size_t>::max())
+    {
+        std::vector<IndexT> seeds_ind(neighbors.size());
+        for (size_t i = 0; i < seeds_ind.size(); i++) seeds_ind[i] = static_cast<IndexT>(i);
+        std::vector<std::vector<IndexT>> segment_to_point_map;
+        extractConnectedComponents<ScalarT,IndexT,PointSimilarityEvaluator>(neighbors, seeds_ind, segment_to_point_map, evaluator, min_segment_size, max_segment_size);
+        return segment_to_point_map;
+    }
+
     // Given search tree and seeds
     template <typename ScalarT, ptrdiff_t EigenDim, template <class> class DistAdaptor, typename IndexT, class NeighborhoodSpecT, class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
     void extractConnectedComponents(const KDTree<ScalarT,EigenDim,DistAdaptor,IndexT> &tree,
@@ -396,6 +461,31 @@ namespace cilantro {
             return *this;
         }
 
+        // Precomputed neighborhoods (e.g. from a batch search into a FlatNeighborhoodSet)
+        template <class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+        inline ConnectedComponentExtraction& segment(const FlatNeighborhoodSet<ScalarT,PointIndexT> &neighbors,
+                                                     const std::vector<PointIndexT> &seeds_ind,
+                                                     const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                                     size_t min_segment_size = 1,
+                                                     size_t max_segment_size = std::numeric_limits<size_t>::max())
+        {
+            extractConnectedComponents<ScalarT,PointIndexT,PointSimilarityEvaluator>(neighbors, seeds_ind, this->cluster_to_point_indices_map_, evaluator, min_segment_size, max_segment_size);
+            this->point_to_cluster_index_map_ = cilantro::getPointToClusterIndexMap<ClusterIndexT,PointIndexT>(this->cluster_to_point_indices_map_, points_.cols());
+            return *this;
+        }
+
+        // Precomputed neighborhoods (e.g. from a batch search into a FlatNeighborhoodSet)
+        template <class PointSimilarityEvaluator = AlwaysTrueEvaluator<ScalarT>>
+        inline ConnectedComponentExtraction& segment(const FlatNeighborhoodSet<ScalarT,PointIndexT> &neighbors,
+                                                     const PointSimilarityEvaluator &evaluator = PointSimilarityEvaluator(),
+                                                     size_t min_segment_size = 1,
+                                                     size_t max_segment_size = std::numeric_limits<size_t>::max())
+        {
+            extractConnectedComponents<ScalarT,PointIndexT,PointSimilarityEvaluator>(neighbors, this->cluster_to_point_indices_map_, evaluator, min_segment_size, max_segment_size);
+            this->point_to_cluster_index_map_ = cilantro::getPointToClusterIndexMap<ClusterIndexT,PointIndexT>(this->cluster_to_point_indices_map_, points_.cols());
+            return *this;
+        }
+
     protected:
         ConstVectorSetMatrixMap<ScalarT,EigenDim> points_;
         const SearchTree *kd_tree_ptr_;
@@ -52,22 +52,21 @@ namespace cilantro {
 
             std::vector<char> has_converged(shifted_seeds_.cols(), 0);
             bool all_converged;
-            Neighborhood<ScalarT,PointIndexT> nn;
             Vector<ScalarT,EigenDim> point_tmp;
 
             while (iteration_count_ < max_iter) {
                 all_converged = true;
-#pragma omp parallel for shared (has_converged, all_converged) private (nn, point_tmp)
+#pragma omp parallel for shared (has_converged, all_converged) private (point_tmp)
                 for (size_t i = 0; i < shifted_seeds_.cols(); i++) {
                     if (has_converged[i]) continue;
-                    kd_tree_ptr_->radiusSearch(shifted_seeds_.col(i), radius_sq, nn);
                     point_tmp.setZero(shifted_seeds_.rows(), 1);
                     ScalarT total_weight = ScalarT(0.0);
-                    for (size_t j = 0; j < nn.size(); j++) {
-                        const ScalarT weight = evaluator.template operator()<Eigen::Ref<const Vector<ScalarT,EigenDim>>>(shifted_seeds_.col(i), data_map_.col(nn[j].index), nn[j].value);
-                        point_tmp.noalias() += weight*data_map_.col(nn[j].index);
+                    // Weighted mean accumulated during traversal; neighborhoods are never stored
+                    kd_tree_ptr_->radiusVisit(shifted_seeds_.col(i), radius_sq, [&](PointIndexT index, ScalarT dist) {
+                        const ScalarT weight = evaluator.template operator()<Eigen::Ref<const Vector<ScalarT,EigenDim>>>(shifted_seeds_.col(i), data_map_.col(index), dist);
+                        point_tmp.noalias() += weight*data_map_.col(index);
                         total_weight += weight;
-                    }
+                    });
                     point_tmp *= ScalarT(1.0)/total_weight;
                     if ((shifted_seeds_.col(i) - point_tmp).squaredNorm() < conv_tol_sq) {
                         has_converged[i] = 1;
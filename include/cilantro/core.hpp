@@ -1,18 +1,32 @@
 #pragma once
 
+#include <cilantro/core/adaptive_search_tree.hpp>
+#include <cilantro/core/brute_force_search.hpp>
 #include <cilantro/core/common_accumulators.hpp>
 #include <cilantro/core/common_pair_evaluators.hpp>
 #include <cilantro/core/correspondence.hpp>
 #include <cilantro/core/covariance.hpp>
 #include <cilantro/core/data_containers.hpp>
+#include <cilantro/core/dynamic_kd_tree.hpp>
 #include <cilantro/core/grid_accumulator.hpp>
 #include <cilantro/core/grid_downsampler.hpp>
 #include <cilantro/core/image_point_cloud_conversions.hpp>
+#include <cilantro/core/implicit_kd_tree.hpp>
+#include <cilantro/core/integral_image_normal_estimation.hpp>
 #include <cilantro/core/kd_tree.hpp>
+#include <cilantro/core/memory_mapped_file.hpp>
+#include <cilantro/core/morton_order.hpp>
 #include <cilantro/core/nearest_neighbors.hpp>
+#include <cilantro/core/nn_descent.hpp>
 #include <cilantro/core/normal_estimation.hpp>
+#include <cilantro/core/normal_orientation.hpp>
+#include <cilantro/core/octree.hpp>
 #include <cilantro/core/openmp_reductions.hpp>
+#include <cilantro/core/parallel_sort.hpp>
 #include <cilantro/core/principal_component_analysis.hpp>
+#include <cilantro/core/quantized_kd_tree.hpp>
 #include <cilantro/core/random.hpp>
+#include <cilantro/core/search_tree_base.hpp>
 #include <cilantro/core/space_transformations.hpp>
 #include <cilantro/core/spectral_embedding_base.hpp>
+#include <cilantro/core/voxel_hash_grid.hpp>
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cilantro/core/brute_force_search.hpp>
+#include <cilantro/core/kd_tree.hpp>
+
+namespace cilantro {
+    // Nearest neighbor search under the squared L2 metric that indexes the data with a KDTree in low dimensions
+    // and switches to BruteForceSearch when the dimension is at least brute_force_min_dim, where tree pruning
+    // no longer pays for the traversal overhead. Has the same search interface as KDTree, so it can be used as
+    // the SearchTree of CorrespondenceSearchKDTree, NormalEstimation, etc.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t, size_t BruteForceMinDimension = 16>
+    class AdaptiveSearchTree : public SearchTreeBase<AdaptiveSearchTree<ScalarT,EigenDim,IndexT,BruteForceMinDimension>,ScalarT,EigenDim,IndexT> {
+        typedef SearchTreeBase<AdaptiveSearchTree<ScalarT,EigenDim,IndexT,BruteForceMinDimension>,ScalarT,EigenDim,IndexT> Base;
+        friend Base;
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        typedef KDTree<ScalarT,EigenDim,KDTreeDistanceAdaptors::L2,IndexT> Tree;
+        typedef BruteForceSearch<ScalarT,EigenDim,IndexT> BruteForce;
+
+        AdaptiveSearchTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data,
+                           size_t max_leaf_size = 10,
+                           size_t brute_force_min_dim = BruteForceMinDimension)
+        {
+            if ((size_t)data.rows() >= brute_force_min_dim) {
+                brute_force_.reset(new BruteForce(data));
+            } else {
+                kd_tree_.reset(new Tree(data, max_leaf_size));
+            }
+        }
+
+        // Subsets are always indexed by a KDTree (see KDTree's view constructor), whatever their dimension
+        AdaptiveSearchTree(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &view,
+                           size_t max_leaf_size = 10,
+                           size_t brute_force_min_dim = BruteForceMinDimension)
+        {
+            if (!view.isSubset() && (size_t)view.rows() >= brute_force_min_dim) {
+                brute_force_.reset(new BruteForce(view.getBaseMatrixMap()));
+            } else {
+                kd_tree_.reset(new Tree(view, max_leaf_size));
+            }
+        }
+
+        ~AdaptiveSearchTree() {}
+
+        inline bool usesBruteForce() const { return !!brute_force_; }
+
+        inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getPointsMatrixMap() const {
+            return (brute_force_) ? brute_force_->getPointsMatrixMap() : kd_tree_->getPointsMatrixMap();
+        }
+
+        inline bool isEmpty() const { return (brute_force_) ? brute_force_->isEmpty() : kd_tree_->isEmpty(); }
+
+        // True if the tree was built over a subset view of getPointsMatrixMap()
+        inline bool indexesSubset() const { return kd_tree_ && kd_tree_->indexesSubset(); }
+
+        // Column indices of the indexed points, in view order, if the tree indexes a subset (empty otherwise)
+        inline const std::vector<IndexT>& getSubsetIndices() const {
+            static const std::vector<IndexT> empty;
+            return (kd_tree_) ? kd_tree_->getSubsetIndices() : empty;
+        }
+
+        // The SearchTreeBase settings also apply to the wrapped search structure, whose own batch and self-join
+        // searches may be used
+        inline AdaptiveSearchTree& setSpatialQueryOrdering(bool enabled) {
+            Base::setSpatialQueryOrdering(enabled);
+            if (brute_force_) {
+                brute_force_->setSpatialQueryOrdering(enabled);
+            } else {
+                kd_tree_->setSpatialQueryOrdering(enabled);
+            }
+            return *this;
+        }
+
+        inline AdaptiveSearchTree& setKNNHeapThreshold(size_t k) {
+            Base::setKNNHeapThreshold(k);
+            if (brute_force_) {
+                brute_force_->setKNNHeapThreshold(k);
+            } else {
+                kd_tree_->setKNNHeapThreshold(k);
+            }
+            return *this;
+        }
+
+        inline AdaptiveSearchTree& setKNNResultSorting(bool enabled) {
+            Base::setKNNResultSorting(enabled);
+            if (brute_force_) {
+                brute_force_->setKNNResultSorting(enabled);
+            } else {
+                kd_tree_->setKNNResultSorting(enabled);
+            }
+            return *this;
+        }
+
+        // Approximate search parameters (see KDTree); brute force search is always exact
+        inline AdaptiveSearchTree& setSearchEpsilon(float eps) {
+            if (kd_tree_) kd_tree_->setSearchEpsilon(eps);
+            return *this;
+        }
+
+        inline float getSearchEpsilon() const { return (kd_tree_) ? kd_tree_->getSearchEpsilon() : 0.0f; }
+
+        inline AdaptiveSearchTree& setMaxLeafVisits(size_t max_leaf_visits) {
+            if (kd_tree_) kd_tree_->setMaxLeafVisits(max_leaf_visits);
+            return *this;
+        }
+
+        inline size_t getMaxLeafVisits() const { return (kd_tree_) ? kd_tree_->getMaxLeafVisits() : 0; }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            if (brute_force_) {
+                brute_force_->findNeighbors(result_set, query_pt);
+            } else {
+                kd_tree_->findNeighbors(result_set, query_pt);
+            }
+        }
+
+    private:
+        std::unique_ptr<Tree> kd_tree_;
+        std::unique_ptr<BruteForce> brute_force_;
+
+        template <typename CountT, class ResultT>
+        inline void knn_batch_search_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                      CountT k,
+                                      ScalarT max_radius,
+                                      ResultT &results) const
+        {
+            if (brute_force_) {
+                brute_force_->kNNInRadiusSearch(query_pts, k, max_radius, results);
+            } else {
+                kd_tree_->kNNInRadiusSearch(query_pts, k, max_radius, results);
+            }
+        }
+    };
+
+    template <typename IndexT = size_t, size_t BruteForceMinDimension = 16>
+    using AdaptiveSearchTreeXf = AdaptiveSearchTree<float,Eigen::Dynamic,IndexT,BruteForceMinDimension>;
+
+    template <typename IndexT = size_t, size_t BruteForceMinDimension = 16>
+    using AdaptiveSearchTreeXd = AdaptiveSearchTree<double,Eigen::Dynamic,IndexT,BruteForceMinDimension>;
+}
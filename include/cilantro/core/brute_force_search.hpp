@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cilantro/core/search_tree_base.hpp>
+
+namespace cilantro {
+    // Exhaustive nearest neighbor search under the squared L2 metric, with the same search interface as KDTree.
+    // Meant for high-dimensional data (e.g. feature descriptors), where tree pruning is ineffective.
+    // Batch kNN (and kNN-in-radius) searches process blocks of queries against blocks of points: each tile of
+    // squared distances is evaluated as ||q||^2 + ||p||^2 - 2*q^T*p, with a single matrix product (Eigen GEMM),
+    // and every query keeps its k best candidates in a max-heap. The distances of the selected neighbors are
+    // then recomputed directly, so reported values are not affected by the cancellation in the expansion.
+    // Single-query and radius searches scan all points.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t>
+    class BruteForceSearch : public SearchTreeBase<BruteForceSearch<ScalarT,EigenDim,IndexT>,ScalarT,EigenDim,IndexT> {
+        friend class SearchTreeBase<BruteForceSearch<ScalarT,EigenDim,IndexT>,ScalarT,EigenDim,IndexT>;
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        // Number of queries and points per distance tile
+        enum { QueryBlockSize = 128, PointBlockSize = 512 };
+
+        // max_leaf_size is ignored; it is accepted for constructor compatibility with KDTree
+        BruteForceSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t /*max_leaf_size*/ = 10)
+                : data_map_(data),
+                  point_norms_(data.colwise().squaredNorm().transpose())
+        {}
+
+        ~BruteForceSearch() {}
+
+        inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getPointsMatrixMap() const { return data_map_; }
+
+        inline bool isEmpty() const { return data_map_.cols() == 0; }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            const Eigen::Map<const Vector<ScalarT,EigenDim>> query(query_pt, data_map_.rows());
+            Eigen::Matrix<ScalarT,1,Eigen::Dynamic> dists;
+            for (size_t start = 0; start < data_map_.cols(); start += PointBlockSize) {
+                const size_t len = std::min<size_t>(PointBlockSize, data_map_.cols() - start);
+                dists = (data_map_.middleCols(start, len).colwise() - query).colwise().squaredNorm();
+                ScalarT worst_dist = result_set.worstDist();
+                for (size_t i = 0; i < len; i++) {
+                    if (dists[i] < worst_dist) {
+                        if (!result_set.addPoint(dists[i], static_cast<IndexT>(start + i))) return;
+                        worst_dist = result_set.worstDist();
+                    }
+                }
+            }
+        }
+
+    private:
+        ConstVectorSetMatrixMap<ScalarT,EigenDim> data_map_;
+        Eigen::Matrix<ScalarT,Eigen::Dynamic,1> point_norms_;
+
+        template <typename CountT>
+        void knn_batch_search_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                               CountT k,
+                               ScalarT max_radius,
+                               NeighborhoodSetResult &results) const
+        {
+            results.resize(query_pts.cols());
+            if (k == 0 || data_map_.cols() == 0) {
+                for (size_t i = 0; i < results.size(); i++) results[i].clear();
+                return;
+            }
+
+            const size_t num_blocks = (query_pts.cols() + QueryBlockSize - 1)/QueryBlockSize;
+#pragma omp parallel
+            {
+                Eigen::Matrix<ScalarT,Eigen::Dynamic,Eigen::Dynamic> tile;
+                std::vector<NeighborhoodResult> heaps(QueryBlockSize);
+#pragma omp for schedule (dynamic)
+                for (size_t b = 0; b < num_blocks; b++) {
+                    const size_t query_start = b*QueryBlockSize;
+                    const size_t num_queries = std::min<size_t>(QueryBlockSize, query_pts.cols() - query_start);
+                    search_block_(query_pts.middleCols(query_start, num_queries), k, max_radius, tile, heaps);
+                    for (size_t q = 0; q < num_queries; q++) {
+                        results[query_start + q].swap(heaps[q]);
+                    }
+                }
+            }
+        }
+
+        template <typename CountT>
+        inline void knn_batch_search_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                      CountT k,
+                                      ScalarT max_radius,
+                                      FlatNeighborhoodSetResult &results) const
+        {
+            NeighborhoodSetResult nh_set;
+            knn_batch_search_(query_pts, k, max_radius, nh_set);
+            results = FlatNeighborhoodSetResult(nh_set);
+        }
+
+        // Leaves the sorted neighbors of each query of the block in heaps[q]
+        template <class QueryBlockT, typename CountT>
+        void search_block_(const QueryBlockT &queries,
+                           CountT k,
+                           ScalarT max_radius,
+                           Eigen::Matrix<ScalarT,Eigen::Dynamic,Eigen::Dynamic> &tile,
+                           std::vector<NeighborhoodResult> &heaps) const
+        {
+            typename NeighborResult::ValueLessComparator heap_comparator;
+            const size_t num_queries = queries.cols();
+            const Eigen::Matrix<ScalarT,1,Eigen::Dynamic> query_norms(queries.colwise().squaredNorm());
+            for (size_t q = 0; q < num_queries; q++) {
+                heaps[q].clear();
+            }
+
+            for (size_t start = 0; start < data_map_.cols(); start += PointBlockSize) {
+                const size_t num_points = std::min<size_t>(PointBlockSize, data_map_.cols() - start);
+                // Column q holds -2*p^T*q for the points of the block
+                tile.noalias() = (ScalarT)(-2)*data_map_.middleCols(start, num_points).transpose()*queries;
+                for (size_t q = 0; q < num_queries; q++) {
+                    NeighborhoodResult& heap(heaps[q]);
+                    const ScalarT *partial_dists = tile.data() + q*num_points;
+                    const ScalarT *norms = point_norms_.data() + start;
+                    ScalarT worst_dist = (heap.size() == k) ? heap.front().value : max_radius;
+                    for (size_t i = 0; i < num_points; i++) {
+                        const ScalarT dist = std::max(partial_dists[i] + norms[i] + query_norms[q], (ScalarT)0);
+                        if (dist >= worst_dist) continue;
+                        if (heap.size() == k) {
+                            std::pop_heap(heap.begin(), heap.end(), heap_comparator);
+                            heap.back() = NeighborResult(static_cast<IndexT>(start + i), dist);
+                        } else {
+                            heap.emplace_back(static_cast<IndexT>(start + i), dist);
+                        }
+                        std::push_heap(heap.begin(), heap.end(), heap_comparator);
+                        if (heap.size() == k) worst_dist = heap.front().value;
+                    }
+                }
+            }
+
+            for (size_t q = 0; q < num_queries; q++) {
+                NeighborhoodResult& heap(heaps[q]);
+                size_t count = 0;
+                for (size_t j = 0; j < heap.size(); j++) {
+                    heap[j].value = (data_map_.col(heap[j].index) - queries.col(q)).squaredNorm();
+                    if (heap[j].value < max_radius) heap[count++] = heap[j];
+                }
+                heap.resize(count);
+                std::sort(heap.begin(), heap.end(), heap_comparator);
+            }
+        }
+    };
+
+    template <typename IndexT = size_t>
+    using BruteForceSearch2f = BruteForceSearch<float,2,IndexT>;
+
+    template <typename IndexT = size_t>
+    using BruteForceSearch2d = BruteForceSearch<double,2,IndexT>;
+
+    template <typename IndexT = size_t>
+    using BruteForceSearch3f = BruteForceSearch<float,3,IndexT>;
+
+    template <typename IndexT = size_t>
+    using BruteForceSearch3d = BruteForceSearch<double,3,IndexT>;
+
+    template <typename IndexT = size_t>
+    using BruteForceSearchXf = BruteForceSearch<float,Eigen::Dynamic,IndexT>;
+
+    template <typename IndexT = size_t>
+    using BruteForceSearchXd = BruteForceSearch<double,Eigen::Dynamic,IndexT>;
+}
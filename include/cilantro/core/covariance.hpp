@@ -5,6 +5,7 @@
 #include <limits>
 #include <cilantro/config.hpp>
 #include <cilantro/core/data_containers.hpp>
+#include <cilantro/core/fixed_dimension_dispatch.hpp>
 #include <cilantro/core/nearest_neighbors.hpp>
 #include <cilantro/core/random.hpp>
 #include <cilantro/core/openmp_reductions.hpp>
@@ -29,6 +30,9 @@ namespace cilantro {
         }
 
         inline bool operator()(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel = false) const {
+            bool success;
+            if (internal::dispatchFixedDimension<EigenDim>(points.rows(), FixedDimensionEstimator_<const size_t*>(*this, points, nullptr, nullptr, false, mean, cov, parallel, success))) return success;
+
             if (points.cols() < min_sample_size_) {
                 mean.setConstant(points.rows(), 1, std::numeric_limits<ScalarT>::quiet_NaN());
                 cov.setConstant(points.rows(), points.rows(), std::numeric_limits<ScalarT>::quiet_NaN());
@@ -79,6 +83,9 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
         // Conditionally enable parallelization if iterators are random access
         template <typename IteratorT, typename std::enable_if<std::is_same<typename std::iterator_traits<IteratorT>::iterator_category, std::random_access_iterator_tag>::value, int>::type = 0>
         inline bool operator()(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, IteratorT begin, IteratorT end, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel = false) const {
+            bool success;
+            if (internal::dispatchFixedDimension<EigenDim>(points.rows(), FixedDimensionEstimator_<IteratorT>(*this, points, begin, end, true, mean, cov, parallel, success))) return success;
+
             const size_t size = std::distance(begin, end);
             if (size < min_sample_size_) {
                 mean.setConstant(points.rows(), 1, std::numeric_limits<ScalarT>::quiet_NaN());
@@ -130,6 +137,9 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
         // Non-random access iterators: this overload ignores the parallelization flag
         template <typename IteratorT, typename std::enable_if<std::is_same<typename std::iterator_traits<IteratorT>::iterator_category, std::random_access_iterator_tag>::value == false, int>::type = 0>
         inline bool operator()(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, IteratorT begin, IteratorT end, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool) const {
+            bool success;
+            if (internal::dispatchFixedDimension<EigenDim>(points.rows(), FixedDimensionEstimator_<IteratorT>(*this, points, begin, end, true, mean, cov, false, success))) return success;
+
             const size_t size = std::distance(begin, end);
             if (size < min_sample_size_) {
                 mean.setConstant(points.rows(), 1, std::numeric_limits<ScalarT>::quiet_NaN());
@@ -158,8 +168,52 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
             return (*this)(points, subset.begin(), subset.end(), mean, cov, parallel);
         }
 
+        // Points selected by a view, read in place from its base matrix
+        template <typename IndexT>
+        inline bool operator()(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel = false) const {
+            if (!points.isSubset()) return (*this)(points.getBaseMatrixMap(), mean, cov, parallel);
+            return (*this)(points.getBaseMatrixMap(), points.getIndices(), points.getIndices() + points.cols(), mean, cov, parallel);
+        }
+
     protected:
         size_t min_sample_size_ = 2;
+
+    private:
+        // Eigen::Dynamic points of dimension 2, 3, 4 or 6 are handed to the fixed-size estimator, which avoids
+        // heap-allocated temporaries and unrolls the per-point updates (see internal::dispatchFixedDimension)
+        template <typename IteratorT>
+        struct FixedDimensionEstimator_ {
+            const Covariance &estimator;
+            const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points;
+            IteratorT begin;
+            IteratorT end;
+            bool use_range;
+            Vector<ScalarT,EigenDim> &mean;
+            Eigen::Matrix<ScalarT,EigenDim,EigenDim> &cov;
+            bool parallel;
+            bool &success;
+
+            FixedDimensionEstimator_(const Covariance &estimator, const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points,
+                                     IteratorT begin, IteratorT end, bool use_range,
+                                     Vector<ScalarT,EigenDim> &mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim> &cov,
+                                     bool parallel, bool &success)
+                    : estimator(estimator), points(points), begin(begin), end(end), use_range(use_range),
+                      mean(mean), cov(cov), parallel(parallel), success(success)
+            {}
+
+            template <ptrdiff_t D>
+            void run() const {
+                cilantro::Covariance<ScalarT,D> fixed_estimator;
+                fixed_estimator.setMinValidSampleSize(estimator.min_sample_size_);
+                const ConstVectorSetMatrixMap<ScalarT,D> fixed_points(points.data(), D, points.cols());
+                Vector<ScalarT,D> fixed_mean;
+                Eigen::Matrix<ScalarT,D,D> fixed_cov;
+                success = (use_range) ? fixed_estimator(fixed_points, begin, end, fixed_mean, fixed_cov, parallel)
+                                      : fixed_estimator(fixed_points, fixed_mean, fixed_cov, parallel);
+                mean = fixed_mean;
+                cov = fixed_cov;
+            }
+        };
     };
 
     template <typename ScalarT, ptrdiff_t EigenDim, typename CovarianceT = Covariance<ScalarT, EigenDim>, typename RandomGeneratorT = std::default_random_engine>
@@ -180,7 +234,8 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
         inline bool operator()(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel = false) const {
             if (points.cols() <= compute_mean_and_covariance_.getMinValidSampleSize()) return compute_mean_and_covariance_(points, mean, cov, false);
 
-            Neighborhood<ScalarT> range_copy(points.cols());
+            Neighborhood<ScalarT> &range_copy = scratch_().range;
+            range_copy.resize(points.cols());
             for (size_t i = 0; i < points.cols(); i++) {
                 range_copy[i].index = i;
             }
@@ -193,7 +248,8 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
             const size_t size = std::distance(begin, end);
             if (size <= compute_mean_and_covariance_.getMinValidSampleSize()) return compute_mean_and_covariance_(points, begin, end, mean, cov, false);
 
-            Neighborhood<ScalarT> range_copy(size);
+            Neighborhood<ScalarT> &range_copy = scratch_().range;
+            range_copy.resize(size);
             size_t k = 0;
             for (auto it = begin; it != end; ++it) {
                 range_copy[k++].index = *it;
@@ -207,6 +263,13 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
             return (*this)(points, subset.begin(), subset.end(), mean, cov, parallel);
         }
 
+        // Points selected by a view, read in place from its base matrix
+        template <typename IndexT>
+        inline bool operator()(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel = false) const {
+            if (!points.isSubset()) return (*this)(points.getBaseMatrixMap(), mean, cov, parallel);
+            return (*this)(points.getBaseMatrixMap(), points.getIndices(), points.getIndices() + points.cols(), mean, cov, parallel);
+        }
+
         inline const Covariance& evaluator() const { return compute_mean_and_covariance_; }
 
         inline Covariance& evaluator() { return compute_mean_and_covariance_; }
@@ -247,6 +310,15 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
             return *this;
         }
 
+        // Concentration steps of a trial stop once the determinant decreases by less than this fraction (at 0,
+        // only when it stops decreasing, i.e. at a fixed point, which does not change the result)
+        inline ScalarT getDeterminantConvergenceTolerance() const { return determinant_convergence_tolerance_; }
+
+        inline MinimumCovarianceDeterminant& setDeterminantConvergenceTolerance(ScalarT tolerance) {
+            determinant_convergence_tolerance_ = tolerance;
+            return *this;
+        }
+
     protected:
         template <typename NeighborhoodIteratorT>
         inline void mahalanobisDistance(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, NeighborhoodIteratorT begin, NeighborhoodIteratorT end, const Vector<ScalarT,EigenDim> &mean, const Eigen::Matrix<ScalarT,EigenDim,EigenDim> &cov_inverse, bool parallel) const {
@@ -264,6 +336,37 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
             }
         }
 
+        // Per-thread buffers, reused across calls (and the random generator, seeded once per thread)
+        struct Scratch_ {
+            Neighborhood<ScalarT> range;
+            Neighborhood<ScalarT> trial_range;
+            std::vector<size_t> subsets;
+            RandomElementSelector<RandomGeneratorT> random;
+        };
+
+        static inline Scratch_& scratch_() {
+            static thread_local Scratch_ scratch;
+            return scratch;
+        }
+
+        // One trial: concentration steps from the given initial subset; returns the final determinant
+        template <typename NeighborhoodIteratorT>
+        inline ScalarT run_trial_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, NeighborhoodIteratorT begin, NeighborhoodIteratorT end, size_t h, const size_t *subset, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel) const {
+            compute_mean_and_covariance_(points, subset, subset + compute_mean_and_covariance_.getMinValidSampleSize(), mean, cov, false);
+            ScalarT determinant = cov.determinant();
+            ScalarT previous = std::numeric_limits<ScalarT>::max();
+            for (int l = 0; l < num_refinements_; ++l) {
+                mahalanobisDistance(points, begin, end, mean, cov.inverse(), parallel);
+                // Only the set of the h closest points matters, not their order
+                std::nth_element(begin, begin + h, end, typename Neighbor<ScalarT>::ValueLessComparator());
+                compute_mean_and_covariance_(points, begin, begin + h, mean, cov, parallel);
+                determinant = cov.determinant();
+                if (!(determinant < previous*(ScalarT(1.0) - determinant_convergence_tolerance_))) break;
+                previous = determinant;
+            }
+            return determinant;
+        }
+
         template <typename NeighborhoodIteratorT>
         inline bool computeOnMutableNeighborhood(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, NeighborhoodIteratorT begin, NeighborhoodIteratorT end, Vector<ScalarT,EigenDim>& mean, Eigen::Matrix<ScalarT,EigenDim,EigenDim>& cov, bool parallel) const {
             const size_t size = std::distance(begin, end);
@@ -273,27 +376,61 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
             // if (h > size) h = size - 1;
             const size_t h = std::min(std::max(compute_mean_and_covariance_.getMinValidSampleSize(), static_cast<size_t>(std::llround(inlier_ratio_*size))), size);
 
-            if (h < size) {
-                RandomElementSelector<RandomGeneratorT> random{};
-                std::vector<size_t> subset(compute_mean_and_covariance_.getMinValidSampleSize());
+            if (h < size && num_trials_ > 0) {
+                // Initial subsets of all trials, drawn in trial order
+                Scratch_ &scratch = scratch_();
+                const size_t subset_size = compute_mean_and_covariance_.getMinValidSampleSize();
+                scratch.subsets.resize(num_trials_*subset_size);
+                for (size_t i = 0; i < scratch.subsets.size(); i++) {
+                    scratch.subsets[i] = *scratch.random(begin, end);
+                }
+                const size_t *subsets = scratch.subsets.data();
 
                 Vector<ScalarT,EigenDim> best_mean;
                 Eigen::Matrix<ScalarT,EigenDim,EigenDim> best_cov;
                 ScalarT best_determinant = std::numeric_limits<ScalarT>::max();
-
-                for (int j = 0; j < num_trials_; ++j) {
-                    std::generate(subset.begin(), subset.end(), [&begin, &end, &random]() { return *random(begin, end); });
-                    compute_mean_and_covariance_(points, subset.begin(), subset.end(), mean, cov, false);
-                    for (int l = 0; l < num_refinements_; ++l) {
-                        mahalanobisDistance(points, begin, end, mean, cov.inverse(), parallel);
-                        std::partial_sort(begin, begin + h, end, typename Neighbor<ScalarT>::ValueLessComparator());
-                        compute_mean_and_covariance_(points, begin, begin + h, mean, cov, parallel);
+                int best_trial = -1;
+
+                if (parallel && num_trials_ > 1) {
+                    // Trials in parallel, on per-thread copies of the neighborhood; ties go to the earliest trial,
+                    // as in the serial loop
+#pragma omp parallel
+                    {
+                        Neighborhood<ScalarT> &trial_range = scratch_().trial_range;
+                        trial_range.assign(begin, end);
+                        Vector<ScalarT,EigenDim> trial_mean, thread_best_mean;
+                        Eigen::Matrix<ScalarT,EigenDim,EigenDim> trial_cov, thread_best_cov;
+                        ScalarT thread_best_determinant = std::numeric_limits<ScalarT>::max();
+                        int thread_best_trial = -1;
+#pragma omp for schedule (dynamic)
+                        for (int j = 0; j < num_trials_; ++j) {
+                            const ScalarT determinant = run_trial_(points, trial_range.begin(), trial_range.end(), h, subsets + j*subset_size, trial_mean, trial_cov, false);
+                            if (thread_best_trial < 0 || determinant < thread_best_determinant) {
+                                thread_best_mean = trial_mean;
+                                thread_best_cov = trial_cov;
+                                thread_best_determinant = determinant;
+                                thread_best_trial = j;
+                            }
+                        }
+#pragma omp critical
+                        {
+                            if (thread_best_trial >= 0 && (best_trial < 0 || thread_best_determinant < best_determinant || (thread_best_determinant == best_determinant && thread_best_trial < best_trial))) {
+                                best_mean = thread_best_mean;
+                                best_cov = thread_best_cov;
+                                best_determinant = thread_best_determinant;
+                                best_trial = thread_best_trial;
+                            }
+                        }
                     }
-                    ScalarT determinant = cov.determinant();
-                    if (determinant < best_determinant) {
-                        best_mean = mean;
-                        best_cov = cov;
-                        best_determinant = determinant;
+                } else {
+                    for (int j = 0; j < num_trials_; ++j) {
+                        const ScalarT determinant = run_trial_(points, begin, end, h, subsets + j*subset_size, mean, cov, parallel);
+                        if (best_trial < 0 || determinant < best_determinant) {
+                            best_mean = mean;
+                            best_cov = cov;
+                            best_determinant = determinant;
+                            best_trial = j;
+                        }
                     }
                 }
 
@@ -319,6 +456,51 @@ DECLARE_MATRIX_SUM_REDUCTION(ScalarT,EigenDim,EigenDim)
         ScalarT inlier_ratio_ = ScalarT(0.75);
         // If > 0, the covariance ellipse will be used to label the point as in/outlier.
         ScalarT chi_square_threshold_ = ScalarT(-1);
+        ScalarT determinant_convergence_tolerance_ = ScalarT(0);
         CovarianceT compute_mean_and_covariance_;
     };
+
+    // Smallest eigenvalue of a symmetric positive semidefinite 3x3 matrix (e.g. a 3D covariance), with a unit
+    // eigenvector for it in eigenvector (e.g. the surface normal). Newton's method on the characteristic
+    // polynomial, started at 0, increases monotonically to its smallest root (typically in 2-4 steps); the
+    // eigenvector is then the largest cross product of two rows of mat - lambda*I. Much cheaper than
+    // SelfAdjointEigenSolver (even computeDirect) when the rest of the spectrum is not needed.
+    template <typename ScalarT>
+    inline ScalarT computeSmallestEigenPair3(const Eigen::Matrix<ScalarT,3,3> &mat, Eigen::Matrix<ScalarT,3,1> &eigenvector) {
+        // det(lambda*I - mat) = lambda^3 - c2*lambda^2 + c1*lambda - c0
+        const ScalarT c2 = mat.trace();
+        const ScalarT c1 = mat(0,0)*mat(1,1) - mat(0,1)*mat(1,0) + mat(0,0)*mat(2,2) - mat(0,2)*mat(2,0) + mat(1,1)*mat(2,2) - mat(1,2)*mat(2,1);
+        const ScalarT c0 = mat.determinant();
+        const ScalarT tol = std::numeric_limits<ScalarT>::epsilon()*std::abs(c2);
+
+        ScalarT lambda = (ScalarT)0.0;
+        for (int i = 0; i < 64; i++) {
+            const ScalarT f = ((lambda - c2)*lambda + c1)*lambda - c0;
+            const ScalarT df = ((ScalarT)3.0*lambda - (ScalarT)2.0*c2)*lambda + c1;
+            if (!(df > (ScalarT)0.0)) break;
+            const ScalarT step = f/df;
+            lambda -= step;
+            if (!(std::abs(step) > tol)) break;
+        }
+
+        Eigen::Matrix<ScalarT,3,3> shifted(mat);
+        shifted.diagonal().array() -= lambda;
+        const Eigen::Matrix<ScalarT,3,1> c01 = shifted.row(0).cross(shifted.row(1));
+        const Eigen::Matrix<ScalarT,3,1> c02 = shifted.row(0).cross(shifted.row(2));
+        const Eigen::Matrix<ScalarT,3,1> c12 = shifted.row(1).cross(shifted.row(2));
+        const ScalarT n01 = c01.squaredNorm(), n02 = c02.squaredNorm(), n12 = c12.squaredNorm();
+        if (n01 >= n02 && n01 >= n12 && n01 > (ScalarT)0.0) {
+            eigenvector = c01/std::sqrt(n01);
+        } else if (n02 >= n12 && n02 > (ScalarT)0.0) {
+            eigenvector = c02/std::sqrt(n02);
+        } else if (n12 > (ScalarT)0.0) {
+            eigenvector = c12/std::sqrt(n12);
+        } else {
+            // Repeated smallest eigenvalue: any unit vector orthogonal to the (parallel) nonzero rows
+            Eigen::Index row;
+            const ScalarT max_norm = shifted.rowwise().squaredNorm().maxCoeff(&row);
+            eigenvector = (max_norm > (ScalarT)0.0) ? Eigen::Matrix<ScalarT,3,1>(shifted.row(row).transpose().unitOrthogonal()) : Eigen::Matrix<ScalarT,3,1>::UnitX();
+        }
+        return lambda;
+    }
 }
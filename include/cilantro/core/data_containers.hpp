@@ -169,6 +169,110 @@ namespace cilantro {
     typedef ConstHomogeneousVectorSetMatrixMap<float,Eigen::Dynamic> ConstHomogeneousVectorSetMatrixMapXf;
     typedef ConstHomogeneousVectorSetMatrixMap<double,Eigen::Dynamic> ConstHomogeneousVectorSetMatrixMapXd;
 
+    // Read-only Eigen Map over points that are not densely packed: consecutive points start outer_stride scalars
+    // apart, as in interleaved records such as {x,y,z,intensity,ring,time}. Accepted only where noted (e.g. by
+    // KDTree, which keeps a dense copy); assigning it to a VectorSet packs the points.
+    template <typename ScalarT, ptrdiff_t EigenDim>
+    class ConstStridedDataMatrixMap : public Eigen::Map<const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>,Eigen::Unaligned,Eigen::OuterStride<>> {
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef Eigen::Map<const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>,Eigen::Unaligned,Eigen::OuterStride<>> Base;
+
+        typedef ScalarT Scalar;
+
+        enum { Dimension = EigenDim };
+
+        ConstStridedDataMatrixMap(Eigen::Map<const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>,Eigen::Unaligned,Eigen::OuterStride<>> data)
+                : Base(data.data(), data.rows(), data.cols(), Eigen::OuterStride<>(data.outerStride()))
+        {}
+
+        ConstStridedDataMatrixMap(Eigen::Map<Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>,Eigen::Unaligned,Eigen::OuterStride<>> data)
+                : Base(data.data(), data.rows(), data.cols(), Eigen::OuterStride<>(data.outerStride()))
+        {}
+
+        ConstStridedDataMatrixMap(const ScalarT * data, size_t dim, size_t num_points, size_t outer_stride)
+                : Base(data, dim, num_points, Eigen::OuterStride<>(outer_stride))
+        {}
+
+        inline const Base& base() {
+            return *static_cast<Base *>(this);
+        }
+    };
+
+    typedef ConstStridedDataMatrixMap<float,2> ConstStridedDataMatrixMap2f;
+    typedef ConstStridedDataMatrixMap<double,2> ConstStridedDataMatrixMap2d;
+    typedef ConstStridedDataMatrixMap<float,3> ConstStridedDataMatrixMap3f;
+    typedef ConstStridedDataMatrixMap<double,3> ConstStridedDataMatrixMap3d;
+    typedef ConstStridedDataMatrixMap<float,Eigen::Dynamic> ConstStridedDataMatrixMapXf;
+    typedef ConstStridedDataMatrixMap<double,Eigen::Dynamic> ConstStridedDataMatrixMapXd;
+
+    template <typename ScalarT, ptrdiff_t EigenDim>
+    using ConstStridedVectorSetMatrixMap = ConstStridedDataMatrixMap<ScalarT,EigenDim>;
+
+    typedef ConstStridedVectorSetMatrixMap<float,2> ConstStridedVectorSetMatrixMap2f;
+    typedef ConstStridedVectorSetMatrixMap<double,2> ConstStridedVectorSetMatrixMap2d;
+    typedef ConstStridedVectorSetMatrixMap<float,3> ConstStridedVectorSetMatrixMap3f;
+    typedef ConstStridedVectorSetMatrixMap<double,3> ConstStridedVectorSetMatrixMap3d;
+    typedef ConstStridedVectorSetMatrixMap<float,Eigen::Dynamic> ConstStridedVectorSetMatrixMapXf;
+    typedef ConstStridedVectorSetMatrixMap<double,Eigen::Dynamic> ConstStridedVectorSetMatrixMapXd;
+
+    // Read-only view of the columns of a point set selected by index: col(i) is column indices[i] of the base
+    // matrix, and nothing is copied (the base points and the index array must outlive the view).
+    // A view constructed from the base matrix alone selects all of its columns, in order.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t>
+    class ConstVectorSetIndexView {
+    public:
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        enum { Dimension = EigenDim };
+
+        explicit ConstVectorSetIndexView(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &base)
+                : base_(base), indices_(NULL), num_indices_(base.cols())
+        {}
+
+        ConstVectorSetIndexView(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &base, const std::vector<IndexT> &indices)
+                : base_(base), indices_(indices.data()), num_indices_(indices.size())
+        {}
+
+        ConstVectorSetIndexView(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &base, const IndexT * indices, size_t num_indices)
+                : base_(base), indices_(indices), num_indices_(num_indices)
+        {}
+
+        inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getBaseMatrixMap() const { return base_; }
+
+        // NULL if the view selects all base columns
+        inline const IndexT* getIndices() const { return indices_; }
+
+        inline bool isSubset() const { return indices_ != NULL; }
+
+        inline size_t rows() const { return base_.rows(); }
+
+        inline size_t cols() const { return num_indices_; }
+
+        inline size_t size() const { return num_indices_; }
+
+        // Base matrix column of the i-th view column
+        inline size_t index(size_t i) const { return (indices_ != NULL) ? static_cast<size_t>(indices_[i]) : i; }
+
+        inline typename ConstVectorSetMatrixMap<ScalarT,EigenDim>::ConstColXpr col(size_t i) const { return base_.col(index(i)); }
+
+        inline ScalarT operator()(size_t row, size_t i) const { return base_(row, index(i)); }
+
+    private:
+        ConstVectorSetMatrixMap<ScalarT,EigenDim> base_;
+        const IndexT * indices_;
+        size_t num_indices_;
+    };
+
+    typedef ConstVectorSetIndexView<float,2> ConstVectorSetIndexView2f;
+    typedef ConstVectorSetIndexView<double,2> ConstVectorSetIndexView2d;
+    typedef ConstVectorSetIndexView<float,3> ConstVectorSetIndexView3f;
+    typedef ConstVectorSetIndexView<double,3> ConstVectorSetIndexView3d;
+    typedef ConstVectorSetIndexView<float,Eigen::Dynamic> ConstVectorSetIndexViewXf;
+    typedef ConstVectorSetIndexView<double,Eigen::Dynamic> ConstVectorSetIndexViewXd;
+
     template <typename ScalarT, ptrdiff_t EigenDim>
     using Vector = Eigen::Matrix<ScalarT,EigenDim,1>;
 
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <memory>
+#include <cilantro/core/kd_tree.hpp>
+
+namespace cilantro {
+    namespace KDTreeDataAdaptors {
+        // Eigen Matrix to nanoflann adaptor class; the referenced matrix may be resized (reallocated)
+        template <class ScalarT, ptrdiff_t EigenDim>
+        struct EigenMatrix {
+            typedef ScalarT coord_t;
+
+            // A const ref to the data set origin
+            const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>& obj;
+
+            // The constructor that sets the data set source
+            EigenMatrix(const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic> &obj_) : obj(obj_) {}
+
+            // CRTP helper method
+            inline const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>& derived() const { return obj; }
+
+            // Must return the number of data points
+            inline size_t kdtree_get_point_count() const { return obj.cols(); }
+
+            // Returns the dim'th component of the idx'th point in the class
+            inline coord_t kdtree_get_pt(const size_t idx, int dim) const { return obj(dim,idx); }
+
+            // Optional bounding-box computation: return false to default to a standard bbox computation loop.
+            template <class BBOX>
+            bool kdtree_get_bbox(BBOX& /*bb*/) const { return false; }
+        };
+    } // namespace KDTreeDataAdaptors
+
+    // KD-tree supporting point insertions and removals, with the same search interface as KDTree.
+    // Points are indexed by a logarithmic forest (Bentley-Saxe): the sub-tree at level l holds at most
+    // max_leaf_size*2^l points, and an insertion merges the occupied levels below the first one that can hold
+    // the carried points into a single new sub-tree, so every point is re-indexed O(log n) times overall.
+    // Removals are lazy: removed points are skipped during searches, and a sub-tree is rebuilt from its
+    // remaining points once more than half of them have been removed. Neither operation rebuilds the whole index.
+    // Point indices are assigned in insertion order and never reused; the coordinates of removed points are kept.
+    // Searches may run concurrently, but not concurrently with insert/remove.
+    template <typename ScalarT, ptrdiff_t EigenDim, template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    class DynamicKDTree : public SearchTreeBase<DynamicKDTree<ScalarT,EigenDim,DistAdaptor,IndexT>,ScalarT,EigenDim,IndexT> {
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        typedef nanoflann::KDTreeSingleIndexDynamicAdaptor_<internal::FixedDimensionDistanceIfDynamic<DistAdaptor<KDTreeDataAdaptors::EigenMatrix<ScalarT,EigenDim>>,EigenDim>,KDTreeDataAdaptors::EigenMatrix<ScalarT,EigenDim>,EigenDim,IndexT> InternalTree;
+
+        // For EigenDim == Eigen::Dynamic, the dimension is set by the first insertion
+        DynamicKDTree(size_t max_leaf_size = 10)
+                : points_((EigenDim == Eigen::Dynamic) ? 0 : EigenDim, 0),
+                  num_points_(0),
+                  num_active_points_(0),
+                  data_adaptor_(points_),
+                  max_leaf_size_(std::max<size_t>(max_leaf_size, 1))
+        {
+            params_.sorted = true;
+        }
+
+        DynamicKDTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t max_leaf_size = 10)
+                : points_(data.rows(), 0),
+                  num_points_(0),
+                  num_active_points_(0),
+                  data_adaptor_(points_),
+                  max_leaf_size_(std::max<size_t>(max_leaf_size, 1))
+        {
+            params_.sorted = true;
+            insert(data);
+        }
+
+        DynamicKDTree(const DynamicKDTree&) = delete;
+
+        DynamicKDTree& operator=(const DynamicKDTree&) = delete;
+
+        ~DynamicKDTree() {}
+
+        // New points are assigned consecutive indices, starting at getPointsMatrixMap().cols()
+        DynamicKDTree& insert(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points) {
+            if (points.cols() == 0) return *this;
+            if (num_points_ == 0 && points_.rows() != points.rows()) points_.resize(points.rows(), 0);
+
+            const size_t first = num_points_;
+            reserve_(num_points_ + points.cols());
+            points_.middleCols(first, points.cols()) = points;
+            num_points_ += points.cols();
+            num_active_points_ += points.cols();
+            point_to_tree_.resize(num_points_, -1);
+
+            std::vector<IndexT> carry(points.cols());
+            for (size_t i = 0; i < carry.size(); i++) {
+                carry[i] = static_cast<IndexT>(first + i);
+            }
+
+            // Binary counter carry: merge occupied levels until one is free and large enough
+            size_t level = 0;
+            while (true) {
+                if (level == trees_.size()) {
+                    trees_.emplace_back(new InternalTree(points_.rows(), data_adaptor_, point_to_tree_, nanoflann::KDTreeSingleIndexAdaptorParams(max_leaf_size_)));
+                    tree_sizes_.emplace_back(0);
+                }
+                if (trees_[level]->vind.empty() && carry.size() <= (max_leaf_size_ << level)) break;
+                collect_active_points_(level, carry);
+                clear_tree_(level);
+                level++;
+            }
+            build_tree_(level, carry);
+
+            return *this;
+        }
+
+        // Lazy removal; removing an invalid or already removed index has no effect
+        DynamicKDTree& remove(IndexT index) {
+            if (isRemoved(index)) return *this;
+
+            const size_t level = point_to_tree_[index];
+            point_to_tree_[index] = -1;
+            num_active_points_--;
+            tree_sizes_[level]--;
+            if (2*tree_sizes_[level] < trees_[level]->vind.size()) {
+                std::vector<IndexT> active;
+                collect_active_points_(level, active);
+                clear_tree_(level);
+                build_tree_(level, active);
+            }
+
+            return *this;
+        }
+
+        DynamicKDTree& remove(const std::vector<IndexT> &indices) {
+            for (size_t i = 0; i < indices.size(); i++) {
+                remove(indices[i]);
+            }
+            return *this;
+        }
+
+        inline bool isRemoved(IndexT index) const { return index >= num_points_ || point_to_tree_[index] < 0; }
+
+        // All points ever inserted (including removed ones), so that neighbor indices can be resolved
+        inline ConstVectorSetMatrixMap<ScalarT,EigenDim> getPointsMatrixMap() const {
+            return Eigen::Map<const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>>(points_.data(), points_.rows(), num_points_);
+        }
+
+        // Number of points that have not been removed
+        inline size_t getNumberOfPoints() const { return num_active_points_; }
+
+        inline size_t getNumberOfSubtrees() const {
+            size_t count = 0;
+            for (size_t i = 0; i < trees_.size(); i++) {
+                if (trees_[i]->root_node != NULL) count++;
+            }
+            return count;
+        }
+
+        inline bool isEmpty() const { return num_active_points_ == 0; }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            for (size_t i = 0; i < trees_.size(); i++) {
+                if (internal::resultSetDone(result_set, 0)) break;
+                if (trees_[i]->root_node != NULL) trees_[i]->findNeighbors(result_set, query_pt, params_);
+            }
+        }
+
+    private:
+        VectorSet<ScalarT,EigenDim> points_;
+        size_t num_points_;
+        size_t num_active_points_;
+        // Level of the sub-tree that holds each point, -1 if removed (shared with the sub-trees)
+        std::vector<int> point_to_tree_;
+        const KDTreeDataAdaptors::EigenMatrix<ScalarT,EigenDim> data_adaptor_;
+        std::vector<std::unique_ptr<InternalTree>> trees_;
+        // Number of active points per sub-tree
+        std::vector<size_t> tree_sizes_;
+        size_t max_leaf_size_;
+        nanoflann::SearchParams params_;
+
+        inline void reserve_(size_t num_points) {
+            if (num_points <= (size_t)points_.cols()) return;
+            points_.conservativeResize(Eigen::NoChange, std::max<size_t>(num_points, 2*points_.cols()));
+        }
+
+        inline void collect_active_points_(size_t level, std::vector<IndexT> &indices) const {
+            const std::vector<IndexT>& vind(trees_[level]->vind);
+            for (size_t i = 0; i < vind.size(); i++) {
+                if (point_to_tree_[vind[i]] >= 0) indices.emplace_back(vind[i]);
+            }
+        }
+
+        inline void clear_tree_(size_t level) {
+            InternalTree& tree(*trees_[level]);
+            tree.freeIndex(tree);
+            tree.vind.clear();
+            tree.m_size = 0;
+            tree_sizes_[level] = 0;
+        }
+
+        inline void build_tree_(size_t level, std::vector<IndexT> &indices) {
+            InternalTree& tree(*trees_[level]);
+            for (size_t i = 0; i < indices.size(); i++) {
+                point_to_tree_[indices[i]] = static_cast<int>(level);
+            }
+            tree.vind.swap(indices);
+            tree_sizes_[level] = tree.vind.size();
+            tree.buildIndex();
+        }
+    };
+
+    template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    using DynamicKDTree2f = DynamicKDTree<float,2,DistAdaptor,IndexT>;
+
+    template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    using DynamicKDTree2d = DynamicKDTree<double,2,DistAdaptor,IndexT>;
+
+    template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    using DynamicKDTree3f = DynamicKDTree<float,3,DistAdaptor,IndexT>;
+
+    template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    using DynamicKDTree3d = DynamicKDTree<double,3,DistAdaptor,IndexT>;
+
+    template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    using DynamicKDTreeXf = DynamicKDTree<float,Eigen::Dynamic,DistAdaptor,IndexT>;
+
+    template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
+    using DynamicKDTreeXd = DynamicKDTree<double,Eigen::Dynamic,DistAdaptor,IndexT>;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <Eigen/Core>
+
+namespace cilantro {
+    namespace internal {
+        // Runtime dispatch of Eigen::Dynamic data to fixed-size code paths: points whose dimension is 2, 3, 4 or 6
+        // are processed by functor.template run<D>(), which would typically re-map them as D x N data.
+        // Returns false (without calling the functor) for any other dimension, or if EigenDim is fixed, so that
+        // the caller falls through to its generic path; run<D>() is only instantiated for Eigen::Dynamic callers.
+        template <class FunctorT>
+        inline bool dispatch_fixed_dimension_(ptrdiff_t dim, FunctorT &functor, std::true_type) {
+            switch (dim) {
+                case 2: functor.template run<2>(); return true;
+                case 3: functor.template run<3>(); return true;
+                case 4: functor.template run<4>(); return true;
+                case 6: functor.template run<6>(); return true;
+                default: return false;
+            }
+        }
+
+        template <class FunctorT>
+        inline bool dispatch_fixed_dimension_(ptrdiff_t, FunctorT &, std::false_type) { return false; }
+
+        template <ptrdiff_t EigenDim, class FunctorT>
+        inline bool dispatchFixedDimension(ptrdiff_t dim, FunctorT &&functor) {
+            return dispatch_fixed_dimension_(dim, functor, std::integral_constant<bool,EigenDim == Eigen::Dynamic>());
+        }
+
+        // Wraps a nanoflann distance functor so that the point dimension reaches its evalMetric as a compile time
+        // constant for the dimensions above; the per-component loops then unroll as they do for fixed-size trees.
+        // Results are identical to those of the wrapped functor.
+        template <class DistanceT>
+        struct FixedDimensionDistance : public DistanceT {
+            typedef typename DistanceT::ElementType ElementType;
+            typedef typename DistanceT::DistanceType DistanceType;
+
+            template <class DataSourceT>
+            FixedDimensionDistance(const DataSourceT &data_source) : DistanceT(data_source) {}
+
+            inline DistanceType evalMetric(const ElementType *a, const size_t b_idx, size_t size) const {
+                switch (size) {
+                    case 2: return DistanceT::evalMetric(a, b_idx, 2);
+                    case 3: return DistanceT::evalMetric(a, b_idx, 3);
+                    case 4: return DistanceT::evalMetric(a, b_idx, 4);
+                    case 6: return DistanceT::evalMetric(a, b_idx, 6);
+                    default: return DistanceT::evalMetric(a, b_idx, size);
+                }
+            }
+        };
+
+        // Distance functor used by nanoflann-based trees: wrapped only when EigenDim is Eigen::Dynamic
+        template <class DistanceT, ptrdiff_t EigenDim>
+        using FixedDimensionDistanceIfDynamic = typename std::conditional<EigenDim == Eigen::Dynamic, FixedDimensionDistance<DistanceT>, DistanceT>::type;
+    } // namespace internal
+}
@@ -81,7 +81,7 @@ namespace cilantro {
                   bin_size_(bin_size),
                   bin_size_inv_(bin_size_.cwiseInverse())
         {
-            build_index_(accum_proxy, parallel);
+            build_index_(ConstVectorSetIndexView<ScalarT,EigenDim>(data_map_), accum_proxy, parallel);
         }
 
         GridAccumulator(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data,
@@ -92,7 +92,33 @@ namespace cilantro {
                   bin_size_(Vector<ScalarT,EigenDim>::Constant(data_map_.rows(), 1, bin_size)),
                   bin_size_inv_(bin_size_.cwiseInverse())
         {
-            build_index_(accum_proxy, parallel);
+            build_index_(ConstVectorSetIndexView<ScalarT,EigenDim>(data_map_), accum_proxy, parallel);
+        }
+
+        // Bins only the points selected by view; accumulators are built from (and point indices refer to) the
+        // columns of the view's base matrix
+        template <typename IndexT>
+        GridAccumulator(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &view,
+                        const Eigen::Ref<const Vector<ScalarT,EigenDim>> &bin_size,
+                        const AccumulatorProxy &accum_proxy,
+                        bool parallel = true)
+                : data_map_(view.getBaseMatrixMap()),
+                  bin_size_(bin_size),
+                  bin_size_inv_(bin_size_.cwiseInverse())
+        {
+            build_index_(view, accum_proxy, parallel);
+        }
+
+        template <typename IndexT>
+        GridAccumulator(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &view,
+                        ScalarT bin_size,
+                        const AccumulatorProxy &accum_proxy,
+                        bool parallel = true)
+                : data_map_(view.getBaseMatrixMap()),
+                  bin_size_(Vector<ScalarT,EigenDim>::Constant(data_map_.rows(), 1, bin_size)),
+                  bin_size_inv_(bin_size_.cwiseInverse())
+        {
+            build_index_(view, accum_proxy, parallel);
         }
 
         ~GridAccumulator() {}
@@ -142,8 +168,9 @@ namespace cilantro {
         GridBinMap grid_lookup_table_;
         std::vector<GridBinMapIterator> bin_iterators_;
 
-        inline void build_index_(const AccumulatorProxy &accum_proxy, bool parallel) {
-            if (data_map_.cols() == 0) return;
+        template <typename IndexT>
+        inline void build_index_(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points, const AccumulatorProxy &accum_proxy, bool parallel) {
+            if (points.cols() == 0) return;
 
             if (parallel) {
 #pragma omp parallel
@@ -151,14 +178,15 @@ namespace cilantro {
                     GridBinMap lookup_priv;
 
 #pragma omp for nowait
-                    for (size_t i = 0; i < data_map_.cols(); i++) {
-                        GridPoint grid_coords = getPointGridCoordinates(data_map_.col(i));
+                    for (size_t i = 0; i < points.cols(); i++) {
+                        const size_t ind = points.index(i);
+                        GridPoint grid_coords = getPointGridCoordinates(data_map_.col(ind));
 
                         auto lb = lookup_priv.lower_bound(grid_coords);
                         if (lb != lookup_priv.end() && !(lookup_priv.key_comp()(grid_coords, lb->first))) {
-                            accum_proxy.addToAccumulator(lb->second, i);
+                            accum_proxy.addToAccumulator(lb->second, ind);
                         } else {
-                            lookup_priv.emplace_hint(lb, std::move(grid_coords), accum_proxy.buildAccumulator(i));
+                            lookup_priv.emplace_hint(lb, std::move(grid_coords), accum_proxy.buildAccumulator(ind));
                         }
                     }
 
@@ -181,14 +209,15 @@ namespace cilantro {
                     bin_iterators_[i] = it++;
                 }
             } else {
-                for (size_t i = 0; i < data_map_.cols(); i++) {
-                    GridPoint grid_coords = getPointGridCoordinates(data_map_.col(i));
+                for (size_t i = 0; i < points.cols(); i++) {
+                    const size_t ind = points.index(i);
+                    GridPoint grid_coords = getPointGridCoordinates(data_map_.col(ind));
 
                     auto lb = grid_lookup_table_.lower_bound(grid_coords);
                     if (lb != grid_lookup_table_.end() && !(grid_lookup_table_.key_comp()(grid_coords, lb->first))) {
-                        accum_proxy.addToAccumulator(lb->second, i);
+                        accum_proxy.addToAccumulator(lb->second, ind);
                     } else {
-                        bin_iterators_.emplace_back(grid_lookup_table_.emplace_hint(lb, std::move(grid_coords), accum_proxy.buildAccumulator(i)));
+                        bin_iterators_.emplace_back(grid_lookup_table_.emplace_hint(lb, std::move(grid_coords), accum_proxy.buildAccumulator(ind)));
                     }
                 }
             }
@@ -15,6 +15,12 @@ namespace cilantro {
                 : Base(points, bin_size, PointSumAccumulatorProxy<ScalarT,EigenDim>(points), parallel)
         {}
 
+        // Downsamples only the points selected by view
+        template <typename IndexT>
+        PointsGridDownsampler(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points, ScalarT bin_size, bool parallel = true)
+                : Base(points, bin_size, PointSumAccumulatorProxy<ScalarT,EigenDim>(points.getBaseMatrixMap()), parallel)
+        {}
+
         const PointsGridDownsampler& getDownsampledPoints(VectorSet<ScalarT,EigenDim> &ds_points, size_t min_points_in_bin = 1) const {
             ds_points.resize(this->data_map_.rows(), this->grid_lookup_table_.size());
 
@@ -53,6 +59,14 @@ namespace cilantro {
                 : Base(points, bin_size, PointNormalSumAccumulatorProxy<ScalarT,EigenDim>(points, normals), parallel)
         {}
 
+        // Downsamples only the points selected by view; normals are indexed like the view's base points
+        template <typename IndexT>
+        PointsNormalsGridDownsampler(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points,
+                                     const ConstVectorSetMatrixMap<ScalarT,EigenDim> &normals,
+                                     ScalarT bin_size, bool parallel = true)
+                : Base(points, bin_size, PointNormalSumAccumulatorProxy<ScalarT,EigenDim>(points.getBaseMatrixMap(), normals), parallel)
+        {}
+
         const PointsNormalsGridDownsampler& getDownsampledPoints(VectorSet<ScalarT,EigenDim> &ds_points, size_t min_points_in_bin = 1) const {
             ds_points.resize(this->data_map_.rows(), this->grid_lookup_table_.size());
 
@@ -139,6 +153,14 @@ namespace cilantro {
                 : Base(points, bin_size, PointColorSumAccumulatorProxy<ScalarT,EigenDim>(points, colors), parallel)
         {}
 
+        // Downsamples only the points selected by view; colors are indexed like the view's base points
+        template <typename IndexT>
+        PointsColorsGridDownsampler(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points,
+                                    const ConstVectorSetMatrixMap<float,3> &colors,
+                                    ScalarT bin_size, bool parallel = true)
+                : Base(points, bin_size, PointColorSumAccumulatorProxy<ScalarT,EigenDim>(points.getBaseMatrixMap(), colors), parallel)
+        {}
+
         const PointsColorsGridDownsampler& getDownsampledPoints(VectorSet<ScalarT,EigenDim> &ds_points, size_t min_points_in_bin = 1) const {
             ds_points.resize(this->data_map_.rows(), this->grid_lookup_table_.size());
 
@@ -226,6 +248,15 @@ namespace cilantro {
                 : Base(points, bin_size, PointNormalColorSumAccumulatorProxy<ScalarT,EigenDim>(points, normals, colors), parallel)
         {}
 
+        // Downsamples only the points selected by view; normals and colors are indexed like the view's base points
+        template <typename IndexT>
+        PointsNormalsColorsGridDownsampler(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &points,
+                                           const ConstVectorSetMatrixMap<ScalarT,EigenDim> &normals,
+                                           const ConstVectorSetMatrixMap<float,3> &colors,
+                                           ScalarT bin_size, bool parallel = true)
+                : Base(points, bin_size, PointNormalColorSumAccumulatorProxy<ScalarT,EigenDim>(points.getBaseMatrixMap(), normals, colors), parallel)
+        {}
+
         const PointsNormalsColorsGridDownsampler& getDownsampledPoints(VectorSet<ScalarT,EigenDim> &ds_points, size_t min_points_in_bin = 1) const {
             ds_points.resize(this->data_map_.rows(), this->grid_lookup_table_.size());
 
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <cilantro/core/search_tree_base.hpp>
+
+namespace cilantro {
+    // Pointer-free KD-tree for low-dimensional (2D/3D) points under the squared L2 metric; it uses the same
+    // splitting rule as KDTree (nanoflann's sliding midpoint) and returns the same neighbors as KDTree with
+    // KDTreeDistanceAdaptors::L2.
+    // Nodes live in a single array in depth-first order: the left child of a node is the next node, and only
+    // the offset of the right child is stored. Points are copied in tree order into structure-of-arrays storage,
+    // so each leaf is a contiguous block per coordinate that is scanned without index indirection; leaf
+    // distances are evaluated with Eigen array expressions, which vectorize to SSE/AVX/NEON as enabled by the
+    // compiler flags. Node fields are 32-bit, so at most 2^31 points (and no more than IndexT can represent)
+    // can be indexed; the tree is left empty for larger inputs.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t>
+    class ImplicitKDTree : public SearchTreeBase<ImplicitKDTree<ScalarT,EigenDim,IndexT>,ScalarT,EigenDim,IndexT> {
+        static_assert(EigenDim != Eigen::Dynamic, "ImplicitKDTree requires a compile-time dimension");
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        // Upper bound for max_leaf_size (leaf distance buffers live on the stack)
+        enum { MaxLeafSize = 64 };
+
+        // Leaf scans are vectorized, so larger leaves than KDTree's pay off
+        ImplicitKDTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t max_leaf_size = 32)
+                : data_map_(data),
+                  max_leaf_size_(std::min<size_t>(std::max<size_t>(max_leaf_size, 1), MaxLeafSize)),
+                  search_eps_(0),
+                  max_leaf_visits_(0)
+        {
+            const size_t num_points = data_map_.cols();
+            if (num_points == 0 || num_points > max_num_points_()) return;
+
+            point_indices_.resize(num_points);
+            for (size_t i = 0; i < num_points; i++) {
+                point_indices_[i] = static_cast<IndexT>(i);
+            }
+
+            bbox_min_ = data_map_.rowwise().minCoeff();
+            bbox_max_ = data_map_.rowwise().maxCoeff();
+
+            Vector<ScalarT,EigenDim> bbox_min(bbox_min_);
+            Vector<ScalarT,EigenDim> bbox_max(bbox_max_);
+#pragma omp parallel if (num_points >= 2*parallel_build_min_subtree_size_)
+#pragma omp single
+            build_subtree_(0, num_points, bbox_min, bbox_max, nodes_);
+
+            points_.resize(num_points, EigenDim);
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                points_.row(i) = data_map_.col(point_indices_[i]).transpose();
+            }
+        }
+
+        ~ImplicitKDTree() {}
+
+        inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getPointsMatrixMap() const { return data_map_; }
+
+        inline bool isEmpty() const { return nodes_.empty(); }
+
+        // Always indexes all of getPointsMatrixMap()
+        inline bool indexesSubset() const { return false; }
+
+        // Original index of each point, in tree order (the points of each leaf are contiguous)
+        inline const std::vector<IndexT>& getPointIndicesInTreeOrder() const { return point_indices_; }
+
+        // Approximate search parameters, with the same meaning as in KDTree (0 means exact search)
+        inline ImplicitKDTree& setSearchEpsilon(float eps) {
+            search_eps_ = eps;
+            return *this;
+        }
+
+        inline float getSearchEpsilon() const { return search_eps_; }
+
+        inline ImplicitKDTree& setMaxLeafVisits(size_t max_leaf_visits) {
+            max_leaf_visits_ = max_leaf_visits;
+            return *this;
+        }
+
+        inline size_t getMaxLeafVisits() const { return max_leaf_visits_; }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            if (nodes_.empty()) return;
+            ScalarT offsets[EigenDim];
+            ScalarT min_dist = (ScalarT)0;
+            for (size_t d = 0; d < EigenDim; d++) {
+                const ScalarT diff = std::max(bbox_min_[d] - query_pt[d], std::max(query_pt[d] - bbox_max_[d], (ScalarT)0));
+                offsets[d] = diff*diff;
+                min_dist += offsets[d];
+            }
+            size_t leaves_left = (max_leaf_visits_ == 0) ? std::numeric_limits<size_t>::max() : max_leaf_visits_;
+            search_subtree_(result_set, query_pt, 0, 0, point_indices_.size(), min_dist, offsets, 1 + (ScalarT)search_eps_, leaves_left);
+        }
+
+    private:
+        struct Node {
+            // Largest coordinate of the left subtree and smallest coordinate of the right subtree along splitDimension
+            ScalarT leftMax;
+            ScalarT rightMin;
+            // Offset from this node to its right child; 0 for leaves
+            uint32_t rightChildOffset;
+            // Position (in tree order) of the first point of the right subtree
+            uint32_t splitIndex;
+            int splitDimension;
+        };
+
+        // Subtrees with at least this many points are split into two parallel tasks
+        static const size_t parallel_build_min_subtree_size_ = 8192;
+
+        // A tree over n points has fewer than 2n nodes, so right child offsets fit in uint32_t for n <= 2^31
+        static inline size_t max_num_points_() {
+            return static_cast<size_t>(std::min<uint64_t>(uint64_t(1) << 31, static_cast<uint64_t>(std::numeric_limits<IndexT>::max())));
+        }
+
+        ConstVectorSetMatrixMap<ScalarT,EigenDim> data_map_;
+        size_t max_leaf_size_;
+        std::vector<Node> nodes_;
+        // Original index of each point, in tree order
+        std::vector<IndexT> point_indices_;
+        // Points in tree order, one contiguous column per coordinate
+        Eigen::Matrix<ScalarT,Eigen::Dynamic,EigenDim> points_;
+        Vector<ScalarT,EigenDim> bbox_min_;
+        Vector<ScalarT,EigenDim> bbox_max_;
+        float search_eps_;
+        size_t max_leaf_visits_;
+
+        // Appends the subtree over point_indices_[left, right) to nodes in depth-first order.
+        // On input, bbox_min/bbox_max bound the cell; on output, they are the tight bounding box of its points.
+        // Child offsets are relative, so subtrees built by separate tasks are concatenated without fix-ups.
+        void build_subtree_(size_t left, size_t right, Vector<ScalarT,EigenDim> &bbox_min, Vector<ScalarT,EigenDim> &bbox_max, std::vector<Node> &nodes) {
+            const size_t node = nodes.size();
+            nodes.emplace_back();
+            nodes[node].rightChildOffset = 0;
+
+            if (right - left <= max_leaf_size_) {
+                bbox_min = bbox_max = data_map_.col(point_indices_[left]);
+                for (size_t i = left + 1; i < right; i++) {
+                    bbox_min = bbox_min.cwiseMin(data_map_.col(point_indices_[i]));
+                    bbox_max = bbox_max.cwiseMax(data_map_.col(point_indices_[i]));
+                }
+                return;
+            }
+
+            int cut_dim;
+            ScalarT cut_val;
+            const size_t mid = left + split_(left, right, bbox_min, bbox_max, cut_dim, cut_val);
+
+            Vector<ScalarT,EigenDim> left_min(bbox_min), left_max(bbox_max);
+            Vector<ScalarT,EigenDim> right_min(bbox_min), right_max(bbox_max);
+            left_max[cut_dim] = cut_val;
+            right_min[cut_dim] = cut_val;
+
+            if (right - left >= parallel_build_min_subtree_size_) {
+                std::vector<Node> left_nodes;
+#pragma omp task shared (left_min, left_max, left_nodes)
+                build_subtree_(left, mid, left_min, left_max, left_nodes);
+                std::vector<Node> right_nodes;
+                build_subtree_(mid, right, right_min, right_max, right_nodes);
+#pragma omp taskwait
+                nodes.insert(nodes.end(), left_nodes.begin(), left_nodes.end());
+                nodes[node].rightChildOffset = static_cast<uint32_t>(nodes.size() - node);
+                nodes.insert(nodes.end(), right_nodes.begin(), right_nodes.end());
+            } else {
+                build_subtree_(left, mid, left_min, left_max, nodes);
+                nodes[node].rightChildOffset = static_cast<uint32_t>(nodes.size() - node);
+                build_subtree_(mid, right, right_min, right_max, nodes);
+            }
+
+            nodes[node].leftMax = left_max[cut_dim];
+            nodes[node].rightMin = right_min[cut_dim];
+            nodes[node].splitIndex = static_cast<uint32_t>(mid);
+            nodes[node].splitDimension = cut_dim;
+
+            bbox_min = left_min.cwiseMin(right_min);
+            bbox_max = left_max.cwiseMax(right_max);
+        }
+
+        // nanoflann's middleSplit_/planeSplit: cut the widest cell dimension (among those, the one with the
+        // largest point spread) at its middle, clamped to the point range, keeping both sides non-empty.
+        // Returns the size of the left side.
+        size_t split_(size_t left, size_t right, const Vector<ScalarT,EigenDim> &bbox_min, const Vector<ScalarT,EigenDim> &bbox_max,
+                      int &cut_dim, ScalarT &cut_val)
+        {
+            const ScalarT eps = static_cast<ScalarT>(0.00001);
+            const ScalarT max_span = (bbox_max - bbox_min).maxCoeff();
+            ScalarT max_spread = -1;
+            ScalarT cut_min = 0, cut_max = 0;
+            cut_dim = 0;
+            for (size_t d = 0; d < EigenDim; d++) {
+                if (bbox_max[d] - bbox_min[d] > (1 - eps)*max_span) {
+                    ScalarT min_val, max_val;
+                    compute_min_max_(left, right, d, min_val, max_val);
+                    if (max_val - min_val > max_spread) {
+                        cut_dim = static_cast<int>(d);
+                        max_spread = max_val - min_val;
+                        cut_min = min_val;
+                        cut_max = max_val;
+                    }
+                }
+            }
+            cut_val = std::min(std::max((bbox_min[cut_dim] + bbox_max[cut_dim])/2, cut_min), cut_max);
+
+            IndexT *ind = point_indices_.data() + left;
+            const size_t count = right - left;
+            size_t lim1, lim2;
+            plane_split_(ind, count, cut_dim, cut_val, lim1, lim2);
+
+            if (lim1 > count/2) return lim1;
+            if (lim2 < count/2) return lim2;
+            return count/2;
+        }
+
+        inline void compute_min_max_(size_t left, size_t right, size_t dim, ScalarT &min_val, ScalarT &max_val) const {
+            min_val = max_val = data_map_(dim,point_indices_[left]);
+            for (size_t i = left + 1; i < right; i++) {
+                const ScalarT val = data_map_(dim,point_indices_[i]);
+                if (val < min_val) min_val = val;
+                if (val > max_val) max_val = val;
+            }
+        }
+
+        // On return: ind[0, lim1) < cut_val, ind[lim1, lim2) == cut_val, ind[lim2, count) > cut_val
+        inline void plane_split_(IndexT *ind, size_t count, int dim, ScalarT cut_val, size_t &lim1, size_t &lim2) const {
+            size_t left = 0;
+            size_t right = count - 1;
+            for (;;) {
+                while (left <= right && data_map_(dim,ind[left]) < cut_val) ++left;
+                while (right && left <= right && data_map_(dim,ind[right]) >= cut_val) --right;
+                if (left > right || !right) break;
+                std::swap(ind[left], ind[right]);
+                ++left;
+                --right;
+            }
+            lim1 = left;
+            right = count - 1;
+            for (;;) {
+                while (left <= right && data_map_(dim,ind[left]) <= cut_val) ++left;
+                while (right && left <= right && data_map_(dim,ind[right]) > cut_val) --right;
+                if (left > right || !right) break;
+                std::swap(ind[left], ind[right]);
+                ++left;
+                --right;
+            }
+            lim2 = left;
+        }
+
+        // offsets holds per-dimension squared distances from query_pt to the cell of node (a lower bound),
+        // and min_dist their sum; as in KDTree, subtrees are skipped only if eps_factor times their bound exceeds
+        // the worst distance. Returns false if result_set stopped the search or leaves_left ran out.
+        template <class ResultSetT>
+        bool search_subtree_(ResultSetT &result_set, const ScalarT *query_pt, size_t node, size_t left, size_t right,
+                             ScalarT min_dist, ScalarT *offsets, ScalarT eps_factor, size_t &leaves_left) const
+        {
+            const Node& split(nodes_[node]);
+            if (split.rightChildOffset == 0) {
+                if (leaves_left == 0) return false;
+                leaves_left--;
+                return search_leaf_(result_set, query_pt, left, right);
+            }
+
+            const size_t mid = split.splitIndex;
+            const ScalarT diff_left = query_pt[split.splitDimension] - split.leftMax;
+            const ScalarT diff_right = query_pt[split.splitDimension] - split.rightMin;
+            const bool left_first = diff_left + diff_right < (ScalarT)0;
+
+            bool proceed;
+            if (left_first) {
+                proceed = search_subtree_(result_set, query_pt, node + 1, left, mid, min_dist, offsets, eps_factor, leaves_left);
+            } else {
+                proceed = search_subtree_(result_set, query_pt, node + split.rightChildOffset, mid, right, min_dist, offsets, eps_factor, leaves_left);
+            }
+            if (!proceed) return false;
+
+            const ScalarT cut_dist = left_first ? diff_right*diff_right : diff_left*diff_left;
+            const ScalarT prev_offset = offsets[split.splitDimension];
+            const ScalarT far_dist = min_dist - prev_offset + cut_dist;
+            if (far_dist*eps_factor <= result_set.worstDist()) {
+                offsets[split.splitDimension] = cut_dist;
+                if (left_first) {
+                    proceed = search_subtree_(result_set, query_pt, node + split.rightChildOffset, mid, right, far_dist, offsets, eps_factor, leaves_left);
+                } else {
+                    proceed = search_subtree_(result_set, query_pt, node + 1, left, mid, far_dist, offsets, eps_factor, leaves_left);
+                }
+                offsets[split.splitDimension] = prev_offset;
+            }
+            return proceed;
+        }
+
+        template <class ResultSetT>
+        inline bool search_leaf_(ResultSetT &result_set, const ScalarT *query_pt, size_t left, size_t right) const {
+            const size_t len = right - left;
+            Eigen::Array<ScalarT,Eigen::Dynamic,1,Eigen::ColMajor,MaxLeafSize,1> dists(len);
+            dists = (points_.col(0).segment(left, len).array() - query_pt[0]).square();
+            for (size_t d = 1; d < EigenDim; d++) {
+                dists += (points_.col(d).segment(left, len).array() - query_pt[d]).square();
+            }
+
+            ScalarT worst_dist = result_set.worstDist();
+            for (size_t i = 0; i < len; i++) {
+                if (dists[i] < worst_dist) {
+                    if (!result_set.addPoint(dists[i], point_indices_[left + i])) return false;
+                    worst_dist = result_set.worstDist();
+                }
+            }
+            return true;
+        }
+    };
+
+    template <typename IndexT = size_t>
+    using ImplicitKDTree2f = ImplicitKDTree<float,2,IndexT>;
+
+    template <typename IndexT = size_t>
+    using ImplicitKDTree2d = ImplicitKDTree<double,2,IndexT>;
+
+    template <typename IndexT = size_t>
+    using ImplicitKDTree3f = ImplicitKDTree<float,3,IndexT>;
+
+    template <typename IndexT = size_t>
+    using ImplicitKDTree3d = ImplicitKDTree<double,3,IndexT>;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <cilantro/core/covariance.hpp>
+#include <cilantro/core/data_containers.hpp>
+
+namespace cilantro {
+    // Normal estimation for organized 3D point clouds: points_.col(y*image_w + x) is the point of pixel (x, y), as
+    // produced by depthImageToPoints (and related functions, or PointCloud::fromDepthImage) with
+    // keep_invalid = true, in the camera frame. Pixels with non-finite or non-positive depth (z) are invalid.
+    // Each pixel's normal comes from the covariance of the valid points in a square window around it, which is
+    // read in O(1) from integral images of the coordinates and their pairwise products, so the cost does not
+    // depend on the window size. Windows are shrunk so that they stay clear of depth discontinuities: pixels
+    // next to an invalid pixel, or to a pixel whose depth differs by more than max_depth_change_factor times
+    // their own. Pixels whose window would be smaller than 3x3 (including those on a discontinuity) get NaN
+    // normals and curvature.
+    template <typename ScalarT>
+    class IntegralImageNormalEstimation {
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+
+        IntegralImageNormalEstimation(const ConstVectorSetMatrixMap<ScalarT,3> &points, size_t image_w, size_t image_h)
+                : points_(points),
+                  image_w_(image_w),
+                  image_h_(image_h),
+                  window_radius_(4),
+                  max_depth_change_factor_((ScalarT)0.02),
+                  view_point_(Vector<ScalarT,3>::Zero())
+        {
+            if (points_.cols() != image_w_*image_h_) {
+                image_w_ = 0;
+                image_h_ = 0;
+            }
+            compute_integral_image_();
+        }
+
+        inline size_t getImageWidth() const { return image_w_; }
+
+        inline size_t getImageHeight() const { return image_h_; }
+
+        // Windows span (2*radius + 1) x (2*radius + 1) pixels, unless shrunk near discontinuities or image borders
+        inline size_t getWindowRadius() const { return window_radius_; }
+
+        inline IntegralImageNormalEstimation& setWindowRadius(size_t radius) {
+            window_radius_ = std::max<size_t>(radius, 1);
+            return *this;
+        }
+
+        inline ScalarT getMaxDepthChangeFactor() const { return max_depth_change_factor_; }
+
+        inline IntegralImageNormalEstimation& setMaxDepthChangeFactor(ScalarT factor) {
+            max_depth_change_factor_ = factor;
+            return *this;
+        }
+
+        // Normals point towards the view point (the camera center, by default)
+        inline const Vector<ScalarT,3>& getViewPoint() const { return view_point_; }
+
+        inline IntegralImageNormalEstimation& setViewPoint(const Eigen::Ref<const Vector<ScalarT,3>> &vp) {
+            view_point_ = vp;
+            return *this;
+        }
+
+        inline VectorSet<ScalarT,3> getNormals() const {
+            VectorSet<ScalarT,3> normals(3, points_.cols());
+            VectorSetMatrixMap<ScalarT,3> normals_map(normals);
+            compute_(&normals_map, NULL);
+            return normals;
+        }
+
+        // External buffer
+        inline const IntegralImageNormalEstimation& estimateNormals(VectorSetMatrixMap<ScalarT,3> normals) const {
+            compute_(&normals, NULL);
+            return *this;
+        }
+
+        inline const IntegralImageNormalEstimation& getNormalsAndCurvature(VectorSet<ScalarT,3> &normals,
+                                                                           VectorSet<ScalarT,1> &curvature) const
+        {
+            normals.resize(3, points_.cols());
+            curvature.resize(1, points_.cols());
+            VectorSetMatrixMap<ScalarT,3> normals_map(normals);
+            VectorSetMatrixMap<ScalarT,1> curvature_map(curvature);
+            compute_(&normals_map, &curvature_map);
+            return *this;
+        }
+
+        // External buffers
+        inline const IntegralImageNormalEstimation& estimateNormalsAndCurvature(VectorSetMatrixMap<ScalarT,3> normals,
+                                                                                VectorSetMatrixMap<ScalarT,1> curvature) const
+        {
+            compute_(&normals, &curvature);
+            return *this;
+        }
+
+    private:
+        // Integral image channels: valid point count, x, y, z, xx, xy, xz, yy, yz, zz
+        static const size_t num_channels_ = 10;
+
+        ConstVectorSetMatrixMap<ScalarT,3> points_;
+        size_t image_w_;
+        size_t image_h_;
+        size_t window_radius_;
+        ScalarT max_depth_change_factor_;
+        Vector<ScalarT,3> view_point_;
+        // (image_h_ + 1) x (image_w_ + 1) cells of num_channels_ sums each (interleaved, row-major); cell (y, x)
+        // holds the sums over pixels [0, x) x [0, y). Point coordinates are taken relative to offset_ (the
+        // centroid of the valid points), which keeps the second moments well conditioned.
+        std::vector<double> integral_;
+        Eigen::Vector3d offset_;
+
+        inline bool is_valid_(size_t k) const {
+            const ScalarT z = points_(2,k);
+            return z > (ScalarT)0.0 && std::isfinite(z) && std::isfinite(points_(0,k)) && std::isfinite(points_(1,k));
+        }
+
+        inline const double* cell_(size_t y, size_t x) const {
+            return integral_.data() + (y*(image_w_ + 1) + x)*num_channels_;
+        }
+
+        void compute_integral_image_() {
+            const size_t stride = (image_w_ + 1)*num_channels_;
+            // Only the zero border row/column needs initialization
+            integral_.resize((image_h_ + 1)*stride);
+            std::fill(integral_.begin(), integral_.begin() + stride, 0.0);
+
+            offset_.setZero();
+            size_t num_valid = 0;
+            for (size_t k = 0; k < points_.cols(); k++) {
+                if (!is_valid_(k)) continue;
+                offset_ += points_.col(k).template cast<double>();
+                num_valid++;
+            }
+            if (num_valid > 0) offset_ /= static_cast<double>(num_valid);
+
+            // Single pass: running row sums added to the cell above
+            for (size_t y = 0; y < image_h_; y++) {
+                double sums[num_channels_] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+                double *row = integral_.data() + (y + 1)*stride;
+                const double *prev = row - stride;
+                std::fill(row, row + num_channels_, 0.0);
+                for (size_t x = 0; x < image_w_; x++) {
+                    const size_t k = y*image_w_ + x;
+                    if (is_valid_(k)) {
+                        const double px = static_cast<double>(points_(0,k)) - offset_[0];
+                        const double py = static_cast<double>(points_(1,k)) - offset_[1];
+                        const double pz = static_cast<double>(points_(2,k)) - offset_[2];
+                        sums[0] += 1.0;
+                        sums[1] += px;
+                        sums[2] += py;
+                        sums[3] += pz;
+                        sums[4] += px*px;
+                        sums[5] += px*py;
+                        sums[6] += px*pz;
+                        sums[7] += py*py;
+                        sums[8] += py*pz;
+                        sums[9] += pz*pz;
+                    }
+                    const size_t offset = (x + 1)*num_channels_;
+                    for (size_t c = 0; c < num_channels_; c++) {
+                        row[offset + c] = prev[offset + c] + sums[c];
+                    }
+                }
+            }
+        }
+
+        // Chessboard distance (in pixels) from every pixel to the nearest discontinuity pixel, capped at cap
+        void compute_discontinuity_distances_(std::vector<size_t> &dist, size_t cap) const {
+            dist.resize(image_w_*image_h_);
+#pragma omp parallel for
+            for (size_t y = 0; y < image_h_; y++) {
+                for (size_t x = 0; x < image_w_; x++) {
+                    const size_t k = y*image_w_ + x;
+                    bool discontinuity = !is_valid_(k);
+                    if (!discontinuity) {
+                        const ScalarT max_change = max_depth_change_factor_*points_(2,k);
+                        const size_t neighbors[4] = {(x > 0) ? k - 1 : k, (x + 1 < image_w_) ? k + 1 : k,
+                                                     (y > 0) ? k - image_w_ : k, (y + 1 < image_h_) ? k + image_w_ : k};
+                        for (size_t n = 0; n < 4; n++) {
+                            if (!is_valid_(neighbors[n]) || std::abs(points_(2,neighbors[n]) - points_(2,k)) > max_change) {
+                                discontinuity = true;
+                                break;
+                            }
+                        }
+                    }
+                    dist[k] = discontinuity ? 0 : cap;
+                }
+            }
+
+            // Two-pass chamfer transform with unit weights on the 8-neighborhood (exact for this metric)
+            for (size_t y = 0; y < image_h_; y++) {
+                for (size_t x = 0; x < image_w_; x++) {
+                    size_t &d = dist[y*image_w_ + x];
+                    if (x > 0) d = std::min(d, dist[y*image_w_ + x - 1] + 1);
+                    if (y > 0) {
+                        const size_t *up = dist.data() + (y - 1)*image_w_;
+                        d = std::min(d, up[x] + 1);
+                        if (x > 0) d = std::min(d, up[x - 1] + 1);
+                        if (x + 1 < image_w_) d = std::min(d, up[x + 1] + 1);
+                    }
+                }
+            }
+            for (size_t y = image_h_; y-- > 0;) {
+                for (size_t x = image_w_; x-- > 0;) {
+                    size_t &d = dist[y*image_w_ + x];
+                    if (x + 1 < image_w_) d = std::min(d, dist[y*image_w_ + x + 1] + 1);
+                    if (y + 1 < image_h_) {
+                        const size_t *down = dist.data() + (y + 1)*image_w_;
+                        d = std::min(d, down[x] + 1);
+                        if (x > 0) d = std::min(d, down[x - 1] + 1);
+                        if (x + 1 < image_w_) d = std::min(d, down[x + 1] + 1);
+                    }
+                }
+            }
+        }
+
+        // Either output may be NULL
+        void compute_(VectorSetMatrixMap<ScalarT,3> *normals, VectorSetMatrixMap<ScalarT,1> *curvature) const {
+            // Image size does not match the number of points
+            if (image_w_*image_h_ != points_.cols()) {
+                if (normals != NULL) normals->setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
+                if (curvature != NULL) curvature->setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
+                return;
+            }
+
+            std::vector<size_t> dist;
+            compute_discontinuity_distances_(dist, window_radius_ + 1);
+
+#pragma omp parallel for
+            for (size_t y = 0; y < image_h_; y++) {
+                for (size_t x = 0; x < image_w_; x++) {
+                    const size_t k = y*image_w_ + x;
+                    // A window of radius r around (x, y) contains no discontinuity pixel iff r < dist[k] (which is
+                    // at most window_radius_ + 1)
+                    const size_t radius = (dist[k] == 0) ? 0 : std::min(dist[k] - 1, std::min(std::min(x, image_w_ - 1 - x), std::min(y, image_h_ - 1 - y)));
+                    if (radius < 1) {
+                        if (normals != NULL) normals->col(k).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
+                        if (curvature != NULL) (*curvature)[k] = std::numeric_limits<ScalarT>::quiet_NaN();
+                        continue;
+                    }
+
+                    const double *c00 = cell_(y - radius, x - radius);
+                    const double *c01 = cell_(y - radius, x + radius + 1);
+                    const double *c10 = cell_(y + radius + 1, x - radius);
+                    const double *c11 = cell_(y + radius + 1, x + radius + 1);
+                    double sums[num_channels_];
+                    for (size_t c = 0; c < num_channels_; c++) {
+                        sums[c] = c11[c] - c01[c] - c10[c] + c00[c];
+                    }
+
+                    const double inv_n = 1.0/sums[0];
+                    const Eigen::Vector3d mean(sums[1]*inv_n, sums[2]*inv_n, sums[3]*inv_n);
+                    Eigen::Matrix3d cov;
+                    cov(0,0) = sums[4]*inv_n - mean[0]*mean[0];
+                    cov(0,1) = cov(1,0) = sums[5]*inv_n - mean[0]*mean[1];
+                    cov(0,2) = cov(2,0) = sums[6]*inv_n - mean[0]*mean[2];
+                    cov(1,1) = sums[7]*inv_n - mean[1]*mean[1];
+                    cov(1,2) = cov(2,1) = sums[8]*inv_n - mean[1]*mean[2];
+                    cov(2,2) = sums[9]*inv_n - mean[2]*mean[2];
+
+                    Eigen::Vector3d normal;
+                    const double lambda = computeSmallestEigenPair3(cov, normal);
+                    if (normals != NULL) {
+                        if (normal.dot(view_point_.template cast<double>() - points_.col(k).template cast<double>()) < 0.0) normal = -normal;
+                        normals->col(k) = normal.template cast<ScalarT>();
+                    }
+                    if (curvature != NULL) (*curvature)[k] = static_cast<ScalarT>(lambda/cov.trace());
+                }
+            }
+        }
+    };
+
+    typedef IntegralImageNormalEstimation<float> IntegralImageNormalEstimationf;
+    typedef IntegralImageNormalEstimation<double> IntegralImageNormalEstimationd;
+}
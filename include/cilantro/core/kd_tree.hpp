@@ -1,8 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <memory>
 #include <cilantro/3rd_party/nanoflann/nanoflann.hpp>
 #include <cilantro/core/data_containers.hpp>
-#include <cilantro/core/nearest_neighbors.hpp>
+#include <cilantro/core/fixed_dimension_dispatch.hpp>
+#include <cilantro/core/memory_mapped_file.hpp>
+#include <cilantro/core/search_tree_base.hpp>
 
 namespace cilantro {
     namespace KDTreeDataAdaptors {
@@ -51,78 +57,8 @@ namespace cilantro {
         using SO3 = nanoflann::SO3_Adaptor<typename DataAdaptor::coord_t, DataAdaptor, typename DataAdaptor::coord_t>;
     } // namespace KDTreeDistanceAdaptors
 
-    template <typename ScalarT, typename IndexT = size_t, typename CountT = size_t>
-    class KNNSearchResultAdaptor {
-    public:
-        KNNSearchResultAdaptor(Neighborhood<ScalarT,IndexT> &results, CountT k, ScalarT max_radius = std::numeric_limits<ScalarT>::max())
-                : results_(results), k_(k), count_(0)
-        {
-            results_.resize(k_);
-            results_[k_-1].value = max_radius;
-        }
-
-        inline CountT size() const { return count_; }
-
-        inline bool full() const { return count_ == k_; }
-
-        inline bool addPoint(ScalarT dist, IndexT index) {
-            CountT i;
-            for (i = count_; i > 0; --i) {
-                if (results_[i-1].value > dist) {
-                    if (i < k_) {
-                        results_[i].index = results_[i-1].index;
-                        results_[i].value = results_[i-1].value;
-                    }
-                } else {
-                    break;
-                }
-            }
-            if (i < k_) {
-                results_[i].index = index;
-                results_[i].value = dist;
-            }
-            if (count_ < k_) count_++;
-
-            return true;
-        }
-
-        inline ScalarT worstDist() const { return results_[k_-1].value; }
-
-    private:
-        Neighborhood<ScalarT,IndexT>& results_;
-        const CountT k_;
-        CountT count_;
-    };
-
-
-    template <typename ScalarT, typename IndexT = size_t, typename CountT = size_t>
-    class RadiusSearchResultAdaptor {
-    public:
-        RadiusSearchResultAdaptor(Neighborhood<ScalarT,IndexT> &results, ScalarT radius)
-                : results_(results), radius_(radius)
-        {
-            results_.clear();
-        }
-
-        inline CountT size() const { return results_.size(); }
-
-        inline bool full() const { return true; }
-
-        inline bool addPoint(ScalarT dist, IndexT index) {
-            // dist < worstDist() is guaranteed when addPoint is called.
-            results_.emplace_back(index, dist);
-            return true;
-        }
-
-        inline ScalarT worstDist() const { return radius_; }
-
-    private:
-        Neighborhood<ScalarT,IndexT>& results_;
-        const ScalarT radius_;
-    };
-
     template <typename ScalarT, ptrdiff_t EigenDim, template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
-    class KDTree {
+    class KDTree : public SearchTreeBase<KDTree<ScalarT,EigenDim,DistAdaptor,IndexT>,ScalarT,EigenDim,IndexT> {
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
@@ -133,267 +69,1032 @@ namespace cilantro {
         typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
         typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
         typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
 
         enum { Dimension = EigenDim };
 
-        typedef nanoflann::KDTreeSingleIndexAdaptor<DistAdaptor<KDTreeDataAdaptors::EigenMap<ScalarT,EigenDim>>,KDTreeDataAdaptors::EigenMap<ScalarT,EigenDim>,EigenDim,IndexT> InternalTree;
+        // Eigen::Dynamic trees evaluate distances through fixed-size instantiations for common dimensions
+        typedef nanoflann::KDTreeSingleIndexAdaptor<internal::FixedDimensionDistanceIfDynamic<DistAdaptor<KDTreeDataAdaptors::EigenMap<ScalarT,EigenDim>>,EigenDim>,KDTreeDataAdaptors::EigenMap<ScalarT,EigenDim>,EigenDim,IndexT> InternalTree;
 
-        KDTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t max_leaf_size = 10)
+        // With parallel_build, large subtrees are built concurrently (OpenMP tasks); the resulting tree is
+        // identical to the one built serially.
+        KDTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t max_leaf_size = 10, bool parallel_build = true)
                 : data_map_(data),
                   data_adaptor_(data_map_),
-                  kd_tree_(data.rows(), data_adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(max_leaf_size))
+                  kd_tree_(data.rows(), data_adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(max_leaf_size)),
+                  indexes_subset_(false),
+                  loaded_from_file_(false),
+                  max_leaf_visits_(0)
         {
             params_.sorted = true;
+            build_index_(parallel_build);
+        }
+
+        // Strided points (e.g. interleaved {x,y,z,intensity,...} records) are copied into a dense buffer owned by
+        // the tree, which getPointsMatrixMap() refers to; data need not outlive the tree.
+        KDTree(const ConstStridedVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t max_leaf_size = 10, bool parallel_build = true)
+                : points_copy_(data),
+                  data_map_(points_copy_),
+                  data_adaptor_(data_map_),
+                  kd_tree_(data.rows(), data_adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(max_leaf_size)),
+                  indexes_subset_(false),
+                  loaded_from_file_(false),
+                  max_leaf_visits_(0)
+        {
+            params_.sorted = true;
+            build_index_(parallel_build);
+        }
+
+        // Indexes only the points selected by view; as the tree stores their column indices in the full point
+        // set, all search results refer to getPointsMatrixMap() (the view's base matrix). Self-join searches
+        // (allKNN, etc.) return one neighborhood per view column, in view order.
+        KDTree(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &view, size_t max_leaf_size = 10, bool parallel_build = true)
+                : data_map_(view.getBaseMatrixMap()),
+                  data_adaptor_(data_map_),
+                  kd_tree_(view.rows(), data_adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(max_leaf_size)),
+                  indexes_subset_(view.isSubset()),
+                  loaded_from_file_(false),
+                  max_leaf_visits_(0)
+        {
+            params_.sorted = true;
+            if (indexes_subset_) {
+                build_subset_index_(view, parallel_build);
+            } else {
+                build_index_(parallel_build);
+            }
+        }
+
+        // Reuses the index stored in index_file_path (see saveToFile) if it was built over exactly the same
+        // points as data; otherwise (missing, corrupted, or stale file) the tree is built from scratch.
+        KDTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, const std::string &index_file_path, size_t max_leaf_size = 10, bool parallel_build = true)
+                : data_map_(data),
+                  data_adaptor_(data_map_),
+                  kd_tree_(data.rows(), data_adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(max_leaf_size)),
+                  indexes_subset_(false),
+                  loaded_from_file_(false),
+                  max_leaf_visits_(0)
+        {
+            params_.sorted = true;
+            MemoryMappedFile file(index_file_path);
+            const FileHeader *header = get_valid_header_(file);
+            if (header != NULL && header->dim == (uint64_t)data_map_.rows() && header->num_points == (uint64_t)data_map_.cols() &&
+                header->points_checksum == computeChecksum(data_map_.data(), data_map_.size()*sizeof(ScalarT)) &&
+                is_valid_index_(*header, file.data(), true))
+            {
+                load_index_(*header, file.data());
+                loaded_from_file_ = true;
+                return;
+            }
+            build_index_(parallel_build);
+        }
+
+        // Loads points and index from a file written by saveToFile, without rebuilding the tree.
+        // Points are accessed in place through a read-only memory mapping of the file, which the tree keeps alive.
+        // If the file is missing, corrupted, or was written by a different tree type, the tree is left empty.
+        // Checksum verification touches the whole file; it can be skipped for trusted files. The structure of
+        // the index (point ranges, node links) is validated either way.
+        // The mapping is shared with the file: on POSIX systems, truncating the file while the tree is alive makes
+        // accesses to the lost pages raise SIGBUS, and other modifications show through to the tree.
+        KDTree(const std::string &file_path, bool verify_checksums = true)
+                : mapped_file_(open_index_file_(file_path, verify_checksums)),
+                  data_map_(get_mapped_points_(mapped_file_.get())),
+                  data_adaptor_(data_map_),
+                  kd_tree_(data_map_.rows(), data_adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(10)),
+                  indexes_subset_(false),
+                  loaded_from_file_(false),
+                  max_leaf_visits_(0)
+        {
+            params_.sorted = true;
+            if (mapped_file_) {
+                load_index_(*reinterpret_cast<const FileHeader *>(mapped_file_->data()), mapped_file_->data());
+                loaded_from_file_ = true;
+                return;
+            }
             kd_tree_.buildIndex();
         }
 
         ~KDTree() {}
 
+        // Writes points and index to a single binary file (see the KDTree(file_path) constructor).
+        // Trees built over a subset view cannot be saved.
+        bool saveToFile(const std::string &file_path) const {
+            if (indexes_subset_) return false;
+
+            std::vector<Node> nodes;
+            if (kd_tree_.root_node != NULL) flatten_nodes_(kd_tree_.root_node, nodes);
+
+            FileHeader header;
+            std::memset(&header, 0, sizeof(FileHeader));
+            std::memcpy(header.magic, "CILKDTR", 8);
+            header.version = 1;
+            header.scalar_type = get_scalar_type_();
+            header.index_size = sizeof(IndexT);
+            header.node_size = sizeof(Node);
+            header.dim = data_map_.rows();
+            header.num_points = data_map_.cols();
+            header.max_leaf_size = kd_tree_.m_leaf_max_size;
+            header.num_nodes = nodes.size();
+            compute_file_layout_(header);
+
+            std::vector<Interval> bbox(header.dim);
+            if (kd_tree_.root_node != NULL) std::copy(kd_tree_.root_bbox.begin(), kd_tree_.root_bbox.end(), bbox.begin());
+
+            header.points_checksum = computeChecksum(data_map_.data(), data_map_.size()*sizeof(ScalarT));
+            header.tree_checksum = compute_tree_checksum_(bbox.data(), kd_tree_.vind.data(), nodes.data(), header);
+            header.header_checksum = computeChecksum(&header, sizeof(FileHeader));
+
+            std::ofstream out(file_path, std::ios::out | std::ios::binary);
+            if (!out) return false;
+            const char zeros[file_alignment_] = {};
+            const auto write_section = [&out,&zeros](uint64_t offset, const void *data, size_t num_bytes) {
+                const uint64_t pos = out.tellp();
+                if (offset > pos) out.write(zeros, offset - pos);
+                out.write(static_cast<const char *>(data), num_bytes);
+            };
+            write_section(0, &header, sizeof(FileHeader));
+            write_section(header.bbox_offset, bbox.data(), bbox.size()*sizeof(Interval));
+            write_section(header.points_offset, data_map_.data(), data_map_.size()*sizeof(ScalarT));
+            write_section(header.vind_offset, kd_tree_.vind.data(), header.num_points*sizeof(IndexT));
+            write_section(header.nodes_offset, nodes.data(), nodes.size()*sizeof(Node));
+            return !!out;
+        }
+
+        // True if the index was reloaded from a file instead of being built
+        inline bool wasLoadedFromFile() const { return loaded_from_file_; }
+
         inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getPointsMatrixMap() const { return data_map_; }
 
-        inline bool isEmpty() const { return data_map_.cols() == 0; }
+        inline bool isEmpty() const { return kd_tree_.m_size == 0; }
+
+        // True if the tree was built over a subset view of getPointsMatrixMap()
+        inline bool indexesSubset() const { return indexes_subset_; }
+
+        // Column indices of the indexed points, in view order, if the tree indexes a subset (empty otherwise)
+        inline const std::vector<IndexT>& getSubsetIndices() const { return subset_indices_; }
+
+        // Number of indexed points (getPointsMatrixMap().cols(), unless the tree indexes a subset)
+        inline size_t getNumberOfIndexedPoints() const { return kd_tree_.m_size; }
 
         inline const InternalTree& nanoflannTree() const { return kd_tree_; }
 
-        // Do not call if tree is empty!
-        inline const KDTree& nearestNeighborSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                                   NeighborResult &result) const
-        {
-            kd_tree_.knnSearch(query_pt.data(), 1, &result.index, &result.value);
+        // Indices of the indexed points in tree order (the points of each leaf are contiguous)
+        inline const std::vector<IndexT>& getPointIndicesInTreeOrder() const { return kd_tree_.vind; }
+
+        // Approximate search: a subtree is skipped unless (1 + eps) times the lower bound of its distance to the
+        // query (as reported by the metric, i.e. squared for L2) is within the current worst neighbor distance,
+        // so every reported distance is within a factor of (1 + eps) of the corresponding exact one.
+        // 0 (default) means exact search.
+        inline KDTree& setSearchEpsilon(float eps) {
+            params_.eps = eps;
             return *this;
         }
 
-        // Do not call if tree is empty!
-        inline NeighborResult nearestNeighborSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt) const
-        {
-            NeighborResult result;
-            kd_tree_.knnSearch(query_pt.data(), 1, &result.index, &result.value);
-            return result;
-        }
+        inline float getSearchEpsilon() const { return params_.eps; }
 
-        // Do not call if tree is empty!
-        const KDTree& nearestNeighborSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                            NeighborhoodResult &results) const
-        {
-            results.resize(query_pts.cols());
-#pragma omp parallel for shared (results)
-            for (size_t i = 0; i < query_pts.cols(); i++) {
-                nearestNeighborSearch(query_pts.col(i), results[i]);
-            }
+        // Approximate search: each query stops after visiting this many leaves (depth-first, starting from the one
+        // that contains the query), so fewer than the requested number of neighbors may be returned.
+        // 0 (default) means no limit.
+        inline KDTree& setMaxLeafVisits(size_t max_leaf_visits) {
+            max_leaf_visits_ = max_leaf_visits;
             return *this;
         }
 
-        // Do not call if tree is empty!
-        // Unlike the other batch searches, this one returns a flat vector of Neighbor
-        inline NeighborhoodResult nearestNeighborSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts) const {
-            NeighborhoodResult results;
-            nearestNeighborSearch(query_pts, results);
-            return results;
+        inline size_t getMaxLeafVisits() const { return max_leaf_visits_; }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            if (max_leaf_visits_ == 0) {
+                kd_tree_.findNeighbors(result_set, query_pt, params_);
+                return;
+            }
+            if (kd_tree_.root_node == NULL) return;
+
+            typename InternalTree::distance_vector_t dists;
+            nanoflann::assign(dists, data_map_.rows(), static_cast<DistanceType>(0));
+            const DistanceType min_dist = kd_tree_.computeInitialDistances(kd_tree_, query_pt, dists);
+            size_t leaves_left = max_leaf_visits_;
+            search_level_(result_set, query_pt, kd_tree_.root_node, min_dist, dists, 1 + params_.eps, leaves_left);
         }
 
+        // Self-join searches: neighborhoods of all indexed points, with results[i] holding the neighbors of the
+        // i-th point (which includes the point itself). Instead of descending the tree once per point, each
+        // leaf is matched against the tree as a group: a subtree is pruned when its distance to the leaf's
+        // bounding box exceeds the worst current neighbor distance of every point in the leaf, and candidate
+        // leaves are scanned against all points of the query leaf at once.
+        // The approximation settings apply as in per-point searches: a subtree is skipped if (1 + eps) times its
+        // distance to the leaf's box exceeds every worst neighbor distance, and each leaf's group of points scans
+        // at most getMaxLeafVisits() leaves. Radius is in the units of the metric (i.e. squared for L2), as in
+        // radiusSearch.
         template <typename CountT = size_t>
-        inline const KDTree& kNNSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                       CountT k,
-                                       NeighborhoodResult &results) const
-        {
-            KNNSearchResultAdaptor<ScalarT,IndexT,CountT> sra(results, k);
-            kd_tree_.findNeighbors(sra, query_pt.data(), params_);
-            results.resize(sra.size());
-            return *this;
+        inline const KDTree& allKNN(CountT k, NeighborhoodSetResult &results) const {
+            return allKNNInRadius(k, std::numeric_limits<ScalarT>::max(), results);
         }
 
         template <typename CountT = size_t>
-        inline NeighborhoodResult kNNSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                            CountT k) const
-        {
-            NeighborhoodResult results;
-            kNNSearch(query_pt, k, results);
+        inline NeighborhoodSetResult allKNN(CountT k) const {
+            NeighborhoodSetResult results;
+            allKNN(k, results);
+            return results;
+        }
+
+        inline const KDTree& allRadius(ScalarT radius, NeighborhoodSetResult &results) const {
+            results.resize(kd_tree_.m_size);
+            return allRadiusVisit(radius, StoreNeighborhood_(results));
+        }
+
+        inline NeighborhoodSetResult allRadius(ScalarT radius) const {
+            NeighborhoodSetResult results;
+            allRadius(radius, results);
             return results;
         }
 
         template <typename CountT = size_t>
-        const KDTree& kNNSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                CountT k,
-                                NeighborhoodSetResult &results) const
-        {
-            results.resize(query_pts.cols());
-#pragma omp parallel for shared (results)
-            for (size_t i = 0; i < query_pts.cols(); i++) {
-                kNNSearch(query_pts.col(i), k, results[i]);
+        inline const KDTree& allKNNInRadius(CountT k, ScalarT radius, NeighborhoodSetResult &results) const {
+            if (k == 0) {
+                results.assign(kd_tree_.m_size, NeighborhoodResult());
+                return *this;
             }
-            return *this;
+            results.resize(kd_tree_.m_size);
+            return allKNNInRadiusVisit(k, radius, StoreNeighborhood_(results));
         }
 
         template <typename CountT = size_t>
-        inline NeighborhoodSetResult kNNSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                               CountT k) const
-        {
+        inline NeighborhoodSetResult allKNNInRadius(CountT k, ScalarT radius) const {
             NeighborhoodSetResult results;
-            kNNSearch(query_pts, k, results);
+            allKNNInRadius(k, radius, results);
             return results;
         }
 
-        inline const KDTree& radiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                          ScalarT radius,
-                                          NeighborhoodResult &results) const
-        {
-            RadiusSearchResultAdaptor<ScalarT,IndexT,size_t> sra(results, radius);
-            kd_tree_.findNeighbors(sra, query_pt.data(), params_);
-            std::sort(results.begin(), results.end(), typename NeighborResult::ValueLessComparator());
-            return *this;
+        // Streaming self-join searches: instead of storing all neighborhoods, visitor(i, nn) is called for every
+        // indexed point as soon as its neighborhood nn (a NeighborhoodResult) is complete, with i the slot the
+        // corresponding all* search would store it in. Each OpenMP thread calls its own copy of visitor (so it
+        // may carry per-thread scratch state), and only one leaf's worth of neighborhoods is buffered per thread.
+        template <typename CountT, class VisitorT>
+        inline const KDTree& allKNNVisit(CountT k, const VisitorT &visitor) const {
+            return allKNNInRadiusVisit(k, std::numeric_limits<ScalarT>::max(), visitor);
         }
 
-        inline NeighborhoodResult radiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                               ScalarT radius) const
-        {
-            NeighborhoodResult results;
-            radiusSearch(query_pt, radius, results);
-            return results;
+        template <class VisitorT>
+        inline const KDTree& allRadiusVisit(ScalarT radius, const VisitorT &visitor) const {
+            self_join_([radius](NeighborhoodResult &nn) {
+                return RadiusSearchResultAdaptor<ScalarT,IndexT,size_t>(nn, radius);
+            }, visitor);
+            return *this;
         }
 
-        const KDTree& radiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                   ScalarT radius,
-                                   NeighborhoodSetResult &results) const
-        {
-            results.resize(query_pts.cols());
-#pragma omp parallel for shared (results)
-            for (size_t i = 0; i < query_pts.cols(); i++) {
-                radiusSearch(query_pts.col(i), radius, results[i]);
+        template <typename CountT, class VisitorT>
+        inline const KDTree& allKNNInRadiusVisit(CountT k, ScalarT radius, const VisitorT &visitor) const {
+            if (k == 0) return *this;
+            if (static_cast<size_t>(k) < this->knn_heap_threshold_) {
+                self_join_([k,radius](NeighborhoodResult &nn) {
+                    return KNNSearchResultAdaptor<ScalarT,IndexT,CountT>(nn, k, radius);
+                }, visitor);
+            } else {
+                self_join_([k,radius](NeighborhoodResult &nn) {
+                    nn.resize(k);
+                    return KNNHeapSearchResultAdaptor<ScalarT,IndexT,CountT>(nn.data(), k, radius);
+                }, visitor);
             }
             return *this;
         }
 
-        inline NeighborhoodSetResult radiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                                  ScalarT radius) const
-        {
-            NeighborhoodSetResult results;
-            radiusSearch(query_pts, radius, results);
-            return results;
+        template <typename CountT, class VisitorT>
+        inline const KDTree& searchAllVisit(const KNNNeighborhoodSpecification<CountT> &nh, const VisitorT &visitor) const {
+            return allKNNVisit(nh.maxNumberOfNeighbors, visitor);
+        }
+
+        template <class VisitorT>
+        inline const KDTree& searchAllVisit(const RadiusNeighborhoodSpecification<ScalarT> &nh, const VisitorT &visitor) const {
+            return allRadiusVisit(nh.radius, visitor);
+        }
+
+        template <typename CountT, class VisitorT>
+        inline const KDTree& searchAllVisit(const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh, const VisitorT &visitor) const {
+            return allKNNInRadiusVisit(nh.maxNumberOfNeighbors, nh.radius, visitor);
+        }
+
+        template <typename CountT = size_t>
+        inline const KDTree& searchAll(const KNNNeighborhoodSpecification<CountT> &nh, NeighborhoodSetResult &results) const {
+            return allKNN(nh.maxNumberOfNeighbors, results);
+        }
+
+        inline const KDTree& searchAll(const RadiusNeighborhoodSpecification<ScalarT> &nh, NeighborhoodSetResult &results) const {
+            return allRadius(nh.radius, results);
         }
 
         template <typename CountT = size_t>
-        inline const KDTree& kNNInRadiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                               CountT k,
-                                               ScalarT radius,
-                                               NeighborhoodResult &results) const
+        inline const KDTree& searchAll(const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh, NeighborhoodSetResult &results) const {
+            return allKNNInRadius(nh.maxNumberOfNeighbors, nh.radius, results);
+        }
+
+        // Range searches: indices (in tree order) of the points inside a closed axis-aligned box [min_pt, max_pt],
+        // or inside an oriented box, given by its center, axes (orthonormal columns of rotation) and half extents
+        // along them. Subtrees whose bounding box misses the query box are skipped, and subtrees whose bounding
+        // box lies inside it are reported wholesale, without per-point tests.
+        const KDTree& boxSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &min_pt,
+                                const Eigen::Ref<const Vector<ScalarT,EigenDim>> &max_pt,
+                                std::vector<IndexT> &results) const
         {
-            KNNSearchResultAdaptor<ScalarT,IndexT,CountT> sra(results, k, radius);
-            kd_tree_.findNeighbors(sra, query_pt.data(), params_);
-            results.resize(sra.size());
+            results.clear();
+            range_search_(AlignedBoxRegion(min_pt, max_pt), results);
             return *this;
         }
 
-        template <typename CountT = size_t>
-        inline NeighborhoodResult kNNInRadiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                                    CountT k,
-                                                    ScalarT radius) const
+        inline std::vector<IndexT> boxSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &min_pt,
+                                             const Eigen::Ref<const Vector<ScalarT,EigenDim>> &max_pt) const
         {
-            NeighborhoodResult results;
-            kNNInRadiusSearch(query_pt, k, radius, results);
+            std::vector<IndexT> results;
+            boxSearch(min_pt, max_pt, results);
             return results;
         }
 
-        template <typename CountT = size_t>
-        const KDTree& kNNInRadiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                        CountT k,
-                                        ScalarT radius,
-                                        NeighborhoodSetResult &results) const
+        // Box i is [min_pts.col(i), max_pts.col(i)]; boxes are processed in parallel
+        const KDTree& boxSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &min_pts,
+                                const ConstVectorSetMatrixMap<ScalarT,EigenDim> &max_pts,
+                                std::vector<std::vector<IndexT>> &results) const
         {
-            results.resize(query_pts.cols());
-#pragma omp parallel for shared (results)
-            for (size_t i = 0; i < query_pts.cols(); i++) {
-                kNNInRadiusSearch(query_pts.col(i), k, radius, results[i]);
+            results.resize(min_pts.cols());
+#pragma omp parallel for shared (results) schedule (dynamic)
+            for (size_t i = 0; i < min_pts.cols(); i++) {
+                boxSearch(min_pts.col(i), max_pts.col(i), results[i]);
             }
             return *this;
         }
 
-        template <typename CountT = size_t>
-        inline NeighborhoodSetResult kNNInRadiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                                       CountT k,
-                                                       ScalarT radius) const
+        inline std::vector<std::vector<IndexT>> boxSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &min_pts,
+                                                          const ConstVectorSetMatrixMap<ScalarT,EigenDim> &max_pts) const
         {
-            NeighborhoodSetResult results;
-            kNNInRadiusSearch(query_pts, k, radius, results);
+            std::vector<std::vector<IndexT>> results;
+            boxSearch(min_pts, max_pts, results);
             return results;
         }
 
-        template <typename CountT = size_t>
-        inline const KDTree& search(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                    const KNNNeighborhoodSpecification<CountT> &nh,
-                                    NeighborhoodResult &results) const
+        const KDTree& orientedBoxSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &center,
+                                        const Eigen::Ref<const Eigen::Matrix<ScalarT,EigenDim,EigenDim>> &rotation,
+                                        const Eigen::Ref<const Vector<ScalarT,EigenDim>> &half_extents,
+                                        std::vector<IndexT> &results) const
         {
-            kNNSearch(query_pt, nh.maxNumberOfNeighbors, results);
+            results.clear();
+            range_search_(OrientedBoxRegion(center, rotation, half_extents), results);
             return *this;
         }
 
-        template <typename CountT = size_t>
-        inline const KDTree& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                    const KNNNeighborhoodSpecification<CountT> &nh,
-                                    NeighborhoodSetResult &results) const
+        inline std::vector<IndexT> orientedBoxSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &center,
+                                                     const Eigen::Ref<const Eigen::Matrix<ScalarT,EigenDim,EigenDim>> &rotation,
+                                                     const Eigen::Ref<const Vector<ScalarT,EigenDim>> &half_extents) const
         {
-            kNNSearch(query_pts, nh.maxNumberOfNeighbors, results);
-            return *this;
+            std::vector<IndexT> results;
+            orientedBoxSearch(center, rotation, half_extents, results);
+            return results;
         }
 
-        inline const KDTree& search(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                    const RadiusNeighborhoodSpecification<ScalarT> &nh,
-                                    NeighborhoodResult &results) const
-        {
-            radiusSearch(query_pt, nh.radius, results);
-            return *this;
+    private:
+        typedef typename InternalTree::Node Node;
+        typedef typename InternalTree::Interval Interval;
+        typedef typename InternalTree::BoundingBox BoundingBox;
+        typedef typename InternalTree::DistanceType DistanceType;
+
+        // On-disk layout: header, root bounding box, points (column-major), vind, nodes (pre-order).
+        // Sections start at multiples of file_alignment_; child pointers are stored as node array indices.
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t scalar_type;
+            uint32_t index_size;
+            uint32_t node_size;
+            uint64_t dim;
+            uint64_t num_points;
+            uint64_t max_leaf_size;
+            uint64_t num_nodes;
+            uint64_t bbox_offset;
+            uint64_t points_offset;
+            uint64_t vind_offset;
+            uint64_t nodes_offset;
+            uint64_t file_size;
+            uint64_t points_checksum;
+            uint64_t tree_checksum;
+            uint64_t header_checksum;
+        };
+
+        static const size_t file_alignment_ = 64;
+
+        // Subtrees with at least this many points are split into two parallel tasks
+        static const size_t parallel_build_min_subtree_size_ = 8192;
+
+        std::shared_ptr<MemoryMappedFile> mapped_file_;
+        // Dense copy of strided input points (empty otherwise)
+        VectorSet<ScalarT,EigenDim> points_copy_;
+        ConstVectorSetMatrixMap<ScalarT,EigenDim> data_map_;
+        const KDTreeDataAdaptors::EigenMap<ScalarT,EigenDim> data_adaptor_;
+        InternalTree kd_tree_;
+        // Node storage of subtrees built by parallel tasks (the rest lives in kd_tree_.pool)
+        std::vector<std::unique_ptr<nanoflann::PooledAllocator>> subtree_pools_;
+        // For subset trees, the view column of each vind entry
+        bool indexes_subset_;
+        std::vector<IndexT> subset_indices_;
+        std::vector<IndexT> subset_positions_;
+        nanoflann::SearchParams params_;
+        bool loaded_from_file_;
+        size_t max_leaf_visits_;
+
+        void build_index_(bool parallel) {
+            const size_t num_points = data_map_.cols();
+            if (!parallel || num_points < 2*parallel_build_min_subtree_size_) {
+                kd_tree_.buildIndex();
+                return;
+            }
+
+            kd_tree_.freeIndex(kd_tree_);
+            subtree_pools_.clear();
+            kd_tree_.m_size = num_points;
+            kd_tree_.m_size_at_index_build = num_points;
+            kd_tree_.vind.resize(num_points);
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                kd_tree_.vind[i] = static_cast<IndexT>(i);
+            }
+            compute_bounding_box_(kd_tree_.root_bbox);
+#pragma omp parallel
+#pragma omp single
+            kd_tree_.root_node = divide_tree_(0, static_cast<IndexT>(num_points), kd_tree_.root_bbox, kd_tree_.pool);
         }
 
-        inline const KDTree& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                    const RadiusNeighborhoodSpecification<ScalarT> &nh,
-                                    NeighborhoodSetResult &results) const
-        {
-            radiusSearch(query_pts, nh.radius, results);
-            return *this;
+        // vind starts out as the view's column indices instead of 0..n-1; everything else matches build_index_
+        void build_subset_index_(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &view, bool parallel) {
+            const size_t num_points = view.cols();
+            kd_tree_.freeIndex(kd_tree_);
+            subtree_pools_.clear();
+            kd_tree_.m_size = num_points;
+            kd_tree_.m_size_at_index_build = num_points;
+            subset_indices_.assign(view.getIndices(), view.getIndices() + num_points);
+            kd_tree_.vind.assign(view.getIndices(), view.getIndices() + num_points);
+            if (num_points == 0) return;
+
+            nanoflann::resize(kd_tree_.root_bbox, data_map_.rows());
+            for (size_t i = 0; i < data_map_.rows(); i++) {
+                kd_tree_.root_bbox[i].low = kd_tree_.root_bbox[i].high = data_map_(i,kd_tree_.vind[0]);
+            }
+            for (size_t k = 1; k < num_points; k++) {
+                for (size_t i = 0; i < data_map_.rows(); i++) {
+                    const ScalarT val = data_map_(i,kd_tree_.vind[k]);
+                    if (kd_tree_.root_bbox[i].low > val) kd_tree_.root_bbox[i].low = val;
+                    if (kd_tree_.root_bbox[i].high < val) kd_tree_.root_bbox[i].high = val;
+                }
+            }
+
+            if (parallel && num_points >= 2*parallel_build_min_subtree_size_) {
+#pragma omp parallel
+#pragma omp single
+                kd_tree_.root_node = divide_tree_(0, static_cast<IndexT>(num_points), kd_tree_.root_bbox, kd_tree_.pool);
+            } else {
+                kd_tree_.root_node = divide_tree_(0, static_cast<IndexT>(num_points), kd_tree_.root_bbox, kd_tree_.pool);
+            }
+
+            // Match vind entries to view columns; equal indices are paired up in order, so repeated view
+            // indices still map to distinct columns
+            std::vector<std::pair<IndexT,IndexT>> by_position(num_points), by_slot(num_points);
+            for (size_t i = 0; i < num_points; i++) {
+                by_position[i] = std::pair<IndexT,IndexT>(view.getIndices()[i], static_cast<IndexT>(i));
+                by_slot[i] = std::pair<IndexT,IndexT>(kd_tree_.vind[i], static_cast<IndexT>(i));
+            }
+            std::sort(by_position.begin(), by_position.end());
+            std::sort(by_slot.begin(), by_slot.end());
+            subset_positions_.resize(num_points);
+            for (size_t i = 0; i < num_points; i++) {
+                subset_positions_[by_slot[i].second] = by_position[i].second;
+            }
         }
 
-        template <typename CountT = size_t>
-        inline const KDTree& search(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
-                                    const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh,
-                                    NeighborhoodResult &results) const
-        {
-            kNNInRadiusSearch(query_pt, nh.maxNumberOfNeighbors, nh.radius, results);
-            return *this;
+        // Per-block extrema are computed in parallel and then combined; min/max are exact, so the box matches
+        // nanoflann's serial computation.
+        void compute_bounding_box_(BoundingBox &bbox) const {
+            const size_t num_points = data_map_.cols();
+            const size_t block_size = 4096;
+            const size_t num_blocks = (num_points + block_size - 1)/block_size;
+
+            VectorSet<ScalarT,EigenDim> block_min(data_map_.rows(), num_blocks);
+            VectorSet<ScalarT,EigenDim> block_max(data_map_.rows(), num_blocks);
+#pragma omp parallel for
+            for (size_t b = 0; b < num_blocks; b++) {
+                const size_t block_len = std::min(block_size, num_points - b*block_size);
+                block_min.col(b) = data_map_.middleCols(b*block_size, block_len).rowwise().minCoeff();
+                block_max.col(b) = data_map_.middleCols(b*block_size, block_len).rowwise().maxCoeff();
+            }
+
+            nanoflann::resize(bbox, data_map_.rows());
+            for (size_t i = 0; i < data_map_.rows(); i++) {
+                bbox[i].low = block_min.row(i).minCoeff();
+                bbox[i].high = block_max.row(i).maxCoeff();
+            }
         }
 
-        template <typename CountT = size_t>
-        inline const KDTree& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
-                                    const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh,
-                                    NeighborhoodSetResult &results) const
+        // Same recursion as nanoflann's divideTree (which always allocates from kd_tree_.pool), except that
+        // large subtrees are built in separate tasks, each with its own node pool.
+        // Splits only depend on the index range and its bounding box, so the tree is identical to a serial build.
+        Node* divide_tree_(IndexT left, IndexT right, BoundingBox &bbox, nanoflann::PooledAllocator &pool) {
+            Node *node = pool.template allocate<Node>();
+
+            if ((right - left) <= static_cast<IndexT>(kd_tree_.m_leaf_max_size)) {
+                node->child1 = node->child2 = NULL;
+                node->node_type.lr.left = left;
+                node->node_type.lr.right = right;
+                for (size_t i = 0; i < data_map_.rows(); i++) {
+                    bbox[i].low = bbox[i].high = data_map_(i,kd_tree_.vind[left]);
+                }
+                for (IndexT k = left + 1; k < right; k++) {
+                    for (size_t i = 0; i < data_map_.rows(); i++) {
+                        const ScalarT val = data_map_(i,kd_tree_.vind[k]);
+                        if (bbox[i].low > val) bbox[i].low = val;
+                        if (bbox[i].high < val) bbox[i].high = val;
+                    }
+                }
+                return node;
+            }
+
+            IndexT idx;
+            int cutfeat;
+            DistanceType cutval;
+            kd_tree_.middleSplit_(kd_tree_, kd_tree_.vind.data() + left, right - left, idx, cutfeat, cutval, bbox);
+
+            node->node_type.sub.divfeat = cutfeat;
+
+            BoundingBox left_bbox(bbox);
+            left_bbox[cutfeat].high = cutval;
+            BoundingBox right_bbox(bbox);
+            right_bbox[cutfeat].low = cutval;
+
+            if (right - left >= parallel_build_min_subtree_size_) {
+                nanoflann::PooledAllocator *left_pool = new nanoflann::PooledAllocator;
+#pragma omp critical (KDTreeSubtreePools)
+                subtree_pools_.emplace_back(left_pool);
+#pragma omp task shared (left_bbox)
+                node->child1 = divide_tree_(left, left + idx, left_bbox, *left_pool);
+                node->child2 = divide_tree_(left + idx, right, right_bbox, pool);
+#pragma omp taskwait
+            } else {
+                node->child1 = divide_tree_(left, left + idx, left_bbox, pool);
+                node->child2 = divide_tree_(left + idx, right, right_bbox, pool);
+            }
+
+            node->node_type.sub.divlow = left_bbox[cutfeat].high;
+            node->node_type.sub.divhigh = right_bbox[cutfeat].low;
+
+            for (size_t i = 0; i < data_map_.rows(); i++) {
+                bbox[i].low = std::min(left_bbox[i].low, right_bbox[i].low);
+                bbox[i].high = std::max(left_bbox[i].high, right_bbox[i].high);
+            }
+
+            return node;
+        }
+
+        static inline uint32_t get_scalar_type_() {
+            return static_cast<uint32_t>(sizeof(ScalarT)) | (std::is_floating_point<ScalarT>::value ? 0 : 0x100);
+        }
+
+        static inline uint64_t align_offset_(uint64_t offset) {
+            return (offset + file_alignment_ - 1)/file_alignment_*file_alignment_;
+        }
+
+        static void compute_file_layout_(FileHeader &header) {
+            header.bbox_offset = align_offset_(sizeof(FileHeader));
+            header.points_offset = align_offset_(header.bbox_offset + header.dim*sizeof(Interval));
+            header.vind_offset = align_offset_(header.points_offset + header.dim*header.num_points*sizeof(ScalarT));
+            header.nodes_offset = align_offset_(header.vind_offset + header.num_points*sizeof(IndexT));
+            header.file_size = header.nodes_offset + header.num_nodes*sizeof(Node);
+        }
+
+        static uint64_t compute_tree_checksum_(const Interval *bbox, const IndexT *vind, const Node *nodes, const FileHeader &header) {
+            const uint64_t checksums[3] = {computeChecksum(bbox, header.dim*sizeof(Interval)),
+                                           computeChecksum(vind, header.num_points*sizeof(IndexT)),
+                                           computeChecksum(nodes, header.num_nodes*sizeof(Node))};
+            return computeChecksum(checksums, sizeof(checksums));
+        }
+
+        // Returns NULL unless the file holds a consistent header that matches this tree type
+        static const FileHeader* get_valid_header_(const MemoryMappedFile &file) {
+            if (!file.isOpen() || file.size() < sizeof(FileHeader)) return NULL;
+            FileHeader header;
+            std::memcpy(&header, file.data(), sizeof(FileHeader));
+            const uint64_t header_checksum = header.header_checksum;
+            header.header_checksum = 0;
+            if (std::memcmp(header.magic, "CILKDTR", 8) != 0 || header.version != 1 ||
+                computeChecksum(&header, sizeof(FileHeader)) != header_checksum ||
+                header.scalar_type != get_scalar_type_() || header.index_size != sizeof(IndexT) || header.node_size != sizeof(Node) ||
+                (EigenDim != Eigen::Dynamic && header.dim != (uint64_t)EigenDim) ||
+                header.num_points > (uint64_t)std::numeric_limits<IndexT>::max())
+            {
+                return NULL;
+            }
+            // Every section must fit in the file, so that computing the layout cannot overflow
+            const uint64_t file_size = file.size();
+            if (header.dim > file_size/sizeof(Interval) || header.num_points > file_size/sizeof(IndexT) || header.num_nodes > file_size/sizeof(Node) ||
+                (header.num_points > 0 && header.dim > file_size/sizeof(ScalarT)/header.num_points))
+            {
+                return NULL;
+            }
+            FileHeader layout(header);
+            compute_file_layout_(layout);
+            if (std::memcmp(&layout, &header, sizeof(FileHeader)) != 0 || header.file_size != file.size()) return NULL;
+            return reinterpret_cast<const FileHeader *>(file.data());
+        }
+
+        // Maps file_path and returns it if it holds a valid index (see is_valid_index_), or NULL otherwise
+        static std::shared_ptr<MemoryMappedFile> open_index_file_(const std::string &file_path, bool verify_checksums) {
+            std::shared_ptr<MemoryMappedFile> file(new MemoryMappedFile(file_path));
+            const FileHeader *header = get_valid_header_(*file);
+            if (header == NULL ||
+                (verify_checksums && header->points_checksum != computeChecksum(file->data() + header->points_offset, header->dim*header->num_points*sizeof(ScalarT))) ||
+                !is_valid_index_(*header, file->data(), verify_checksums))
+            {
+                file.reset();
+            }
+            return file;
+        }
+
+        // Points of a file returned by open_index_file_ (empty if file is NULL)
+        static ConstVectorSetMatrixMap<ScalarT,EigenDim> get_mapped_points_(const MemoryMappedFile *file) {
+            if (file == NULL) {
+                return Eigen::Map<const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>>(NULL, (EigenDim == Eigen::Dynamic) ? 0 : EigenDim, 0);
+            }
+            const FileHeader *header = reinterpret_cast<const FileHeader *>(file->data());
+            return Eigen::Map<const Eigen::Matrix<ScalarT,EigenDim,Eigen::Dynamic>>(reinterpret_cast<const ScalarT *>(file->data() + header->points_offset), header->dim, header->num_points);
+        }
+
+        static size_t flatten_nodes_(const Node *node, std::vector<Node> &nodes) {
+            const size_t ind = nodes.size();
+            nodes.emplace_back(*node);
+            // Root is at 0, so a child index is never 0 and NULL remains distinguishable
+            if (node->child1 != NULL) nodes[ind].child1 = reinterpret_cast<Node *>(static_cast<uintptr_t>(flatten_nodes_(node->child1, nodes)));
+            if (node->child2 != NULL) nodes[ind].child2 = reinterpret_cast<Node *>(static_cast<uintptr_t>(flatten_nodes_(node->child2, nodes)));
+            return ind;
+        }
+
+        // nanoflann's searchLevel, stopping once leaves_left leaves have been visited
+        template <class ResultSetT>
+        bool search_level_(ResultSetT &result_set, const ScalarT *query_pt, const Node *node, DistanceType min_dist,
+                           typename InternalTree::distance_vector_t &dists, float eps_factor, size_t &leaves_left) const
         {
-            kNNInRadiusSearch(query_pts, nh.maxNumberOfNeighbors, nh.radius, results);
-            return *this;
+            if (node->child1 == NULL && node->child2 == NULL) {
+                if (leaves_left == 0) return false;
+                leaves_left--;
+                const DistanceType worst_dist = result_set.worstDist();
+                for (IndexT i = node->node_type.lr.left; i < node->node_type.lr.right; i++) {
+                    const IndexT index = kd_tree_.vind[i];
+                    const DistanceType dist = kd_tree_.distance.evalMetric(query_pt, index, data_map_.rows());
+                    if (dist < worst_dist && !result_set.addPoint(dist, index)) return false;
+                }
+                return true;
+            }
+
+            const int dim = node->node_type.sub.divfeat;
+            const ScalarT val = query_pt[dim];
+            const DistanceType diff1 = val - node->node_type.sub.divlow;
+            const DistanceType diff2 = val - node->node_type.sub.divhigh;
+
+            const Node *best_child, *other_child;
+            DistanceType cut_dist;
+            if (diff1 + diff2 < 0) {
+                best_child = node->child1;
+                other_child = node->child2;
+                cut_dist = kd_tree_.distance.accum_dist(val, node->node_type.sub.divhigh, dim);
+            } else {
+                best_child = node->child2;
+                other_child = node->child1;
+                cut_dist = kd_tree_.distance.accum_dist(val, node->node_type.sub.divlow, dim);
+            }
+
+            if (!search_level_(result_set, query_pt, best_child, min_dist, dists, eps_factor, leaves_left)) return false;
+
+            const DistanceType prev_dist = dists[dim];
+            min_dist = min_dist + cut_dist - prev_dist;
+            dists[dim] = cut_dist;
+            if (min_dist*eps_factor <= result_set.worstDist()) {
+                if (!search_level_(result_set, query_pt, other_child, min_dist, dists, eps_factor, leaves_left)) return false;
+            }
+            dists[dim] = prev_dist;
+            return true;
+        }
+
+        static inline void collect_leaves_(const Node *node, std::vector<const Node *> &leaves) {
+            if (node->child1 == NULL && node->child2 == NULL) {
+                leaves.emplace_back(node);
+                return;
+            }
+            collect_leaves_(node->child1, leaves);
+            collect_leaves_(node->child2, leaves);
+        }
+
+        inline void finalize_result_(const RadiusSearchResultAdaptor<ScalarT,IndexT,size_t> &, NeighborhoodResult &nn) const {
+            std::sort(nn.begin(), nn.end(), typename NeighborResult::ValueLessComparator());
+        }
+
+        template <typename CountT>
+        inline void finalize_result_(const KNNSearchResultAdaptor<ScalarT,IndexT,CountT> &result_set, NeighborhoodResult &nn) const {
+            nn.resize(result_set.size());
+        }
+
+        template <typename CountT>
+        inline void finalize_result_(KNNHeapSearchResultAdaptor<ScalarT,IndexT,CountT> &result_set, NeighborhoodResult &nn) const {
+            if (this->knn_result_sorting_) result_set.sort();
+            nn.resize(result_set.size());
+        }
+
+        // Self-join visitor that moves each neighborhood into its slot of a NeighborhoodSet
+        struct StoreNeighborhood_ {
+            NeighborhoodSetResult &results;
+
+            StoreNeighborhood_(NeighborhoodSetResult &results) : results(results) {}
+
+            inline void operator()(IndexT i, NeighborhoodResult &nn) const { results[i].swap(nn); }
+        };
+
+        // make_result_set(nn) returns the (nanoflann protocol) result set that fills nn; every completed
+        // neighborhood is handed to (a per-thread copy of) visitor
+        template <class MakeResultSetT, class VisitorT>
+        void self_join_(MakeResultSetT make_result_set, const VisitorT &visitor) const {
+            if (kd_tree_.root_node == NULL) return;
+
+            typedef decltype(make_result_set(std::declval<NeighborhoodResult&>())) ResultSet;
+
+            std::vector<const Node *> leaves;
+            collect_leaves_(kd_tree_.root_node, leaves);
+
+            const DistanceType eps_factor = static_cast<DistanceType>(1 + params_.eps);
+            const size_t max_leaf_visits = (max_leaf_visits_ == 0) ? std::numeric_limits<size_t>::max() : max_leaf_visits_;
+
+#pragma omp parallel shared (leaves)
+            {
+                VisitorT local_visitor(visitor);
+                std::vector<NeighborhoodResult> neighborhoods;
+                std::vector<ResultSet> result_sets;
+                std::vector<ScalarT> query_low(data_map_.rows()), query_high(data_map_.rows());
+                typename InternalTree::distance_vector_t gaps;
+#pragma omp for schedule (dynamic, 16)
+                for (size_t l = 0; l < leaves.size(); l++) {
+                    const IndexT left = leaves[l]->node_type.lr.left;
+                    const IndexT right = leaves[l]->node_type.lr.right;
+
+                    // Sized before any result set refers to its elements
+                    if (neighborhoods.size() < static_cast<size_t>(right - left)) neighborhoods.resize(right - left);
+                    result_sets.clear();
+                    result_sets.reserve(right - left);
+                    for (size_t i = 0; i < data_map_.rows(); i++) {
+                        query_low[i] = query_high[i] = data_map_(i,kd_tree_.vind[left]);
+                    }
+                    for (IndexT q = left; q < right; q++) {
+                        result_sets.emplace_back(make_result_set(neighborhoods[q - left]));
+                        for (size_t i = 0; i < data_map_.rows(); i++) {
+                            const ScalarT val = data_map_(i,kd_tree_.vind[q]);
+                            if (query_low[i] > val) query_low[i] = val;
+                            if (query_high[i] < val) query_high[i] = val;
+                        }
+                    }
+
+                    // All points lie within the root bounding box
+                    nanoflann::assign(gaps, data_map_.rows(), static_cast<DistanceType>(0));
+                    DistanceType worst_dist = result_sets[0].worstDist();
+                    size_t leaves_left = max_leaf_visits;
+                    self_join_level_(result_sets, left, right, query_low, query_high, kd_tree_.root_node, 0, gaps, worst_dist, eps_factor, leaves_left);
+
+                    for (IndexT q = left; q < right; q++) {
+                        finalize_result_(result_sets[q - left], neighborhoods[q - left]);
+                        local_visitor(result_slot_(q), neighborhoods[q - left]);
+                    }
+                }
+            }
+        }
+
+        // Self-join output slot of the point at vind[q]
+        inline IndexT result_slot_(IndexT q) const {
+            return (indexes_subset_) ? subset_positions_[q] : kd_tree_.vind[q];
         }
 
-        template <typename PointT, typename NeighborhoodSpecT>
-        inline typename std::enable_if<PointT::ColsAtCompileTime == 1,NeighborhoodResult>::type
-        search(const PointT &query_pt,
-               const NeighborhoodSpecT &nh) const
+        // Matches the points vind[query_left..query_right) (with bounding box [query_low, query_high]) against the
+        // subtree under node; min_dist is the distance from the query box to the node's box (along each dimension,
+        // gaps), and worst_dist the largest worst neighbor distance among the queries. Subtrees are skipped if
+        // eps_factor times their distance reaches worst_dist; no more leaves are scanned once leaves_left runs out.
+        template <class ResultSetT>
+        void self_join_level_(std::vector<ResultSetT> &result_sets, IndexT query_left, IndexT query_right,
+                              const std::vector<ScalarT> &query_low, const std::vector<ScalarT> &query_high,
+                              const Node *node, DistanceType min_dist, typename InternalTree::distance_vector_t &gaps,
+                              DistanceType &worst_dist, DistanceType eps_factor, size_t &leaves_left) const
         {
-            NeighborhoodResult res;
-            search(query_pt, nh, res);
-            return res;
+            if (node->child1 == NULL && node->child2 == NULL) {
+                if (leaves_left == 0) return;
+                leaves_left--;
+                for (IndexT q = query_left; q < query_right; q++) {
+                    ResultSetT& result_set(result_sets[q - query_left]);
+                    const ScalarT *query_pt = data_map_.col(kd_tree_.vind[q]).data();
+                    for (IndexT i = node->node_type.lr.left; i < node->node_type.lr.right; i++) {
+                        const IndexT index = kd_tree_.vind[i];
+                        const DistanceType dist = kd_tree_.distance.evalMetric(query_pt, index, data_map_.rows());
+                        if (dist < result_set.worstDist()) result_set.addPoint(dist, index);
+                    }
+                }
+                worst_dist = result_sets[0].worstDist();
+                for (size_t q = 1; q < result_sets.size(); q++) {
+                    worst_dist = std::max<DistanceType>(worst_dist, result_sets[q].worstDist());
+                }
+                return;
+            }
+
+            // Child boxes are the node's box with its upper (child1) or lower (child2) bound along dim replaced
+            const int dim = node->node_type.sub.divfeat;
+            const DistanceType prev_gap = gaps[dim];
+            const DistanceType gap1 = (query_low[dim] > node->node_type.sub.divlow) ? std::max(prev_gap, kd_tree_.distance.accum_dist(query_low[dim], node->node_type.sub.divlow, dim)) : prev_gap;
+            const DistanceType gap2 = (query_high[dim] < node->node_type.sub.divhigh) ? std::max(prev_gap, kd_tree_.distance.accum_dist(query_high[dim], node->node_type.sub.divhigh, dim)) : prev_gap;
+
+            const Node *children[2] = {node->child1, node->child2};
+            const DistanceType child_gaps[2] = {gap1, gap2};
+            const int first = (gap2 < gap1) ? 1 : 0;
+            for (int c = first; c != first + 2; c++) {
+                const DistanceType child_min_dist = min_dist + child_gaps[c%2] - prev_gap;
+                if (child_min_dist*eps_factor >= worst_dist) continue;
+                gaps[dim] = child_gaps[c%2];
+                self_join_level_(result_sets, query_left, query_right, query_low, query_high, children[c%2], child_min_dist, gaps, worst_dist, eps_factor, leaves_left);
+            }
+            gaps[dim] = prev_gap;
         }
 
-        template <typename PointsT, typename NeighborhoodSpecT>
-        inline typename std::enable_if<PointsT::ColsAtCompileTime == Eigen::Dynamic,NeighborhoodSetResult>::type
-        search(const PointsT &query_pts,
-               const NeighborhoodSpecT &nh) const
+        // Query regions for range_search_: classify(low, high) tells whether the box [low, high] is disjoint from
+        // (Outside), partially overlaps (Overlapping) or lies inside (Inside) the region
+        enum RegionRelation { Outside, Overlapping, Inside };
+
+        struct AlignedBoxRegion {
+            const Eigen::Ref<const Vector<ScalarT,EigenDim>>& min_pt;
+            const Eigen::Ref<const Vector<ScalarT,EigenDim>>& max_pt;
+
+            AlignedBoxRegion(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &min_pt, const Eigen::Ref<const Vector<ScalarT,EigenDim>> &max_pt)
+                    : min_pt(min_pt), max_pt(max_pt)
+            {}
+
+            inline RegionRelation classify(const Vector<ScalarT,EigenDim> &low, const Vector<ScalarT,EigenDim> &high) const {
+                if ((high.array() < min_pt.array()).any() || (low.array() > max_pt.array()).any()) return Outside;
+                if ((low.array() >= min_pt.array()).all() && (high.array() <= max_pt.array()).all()) return Inside;
+                return Overlapping;
+            }
+
+            template <class PointT>
+            inline bool contains(const PointT &pt) const {
+                return (pt.array() >= min_pt.array()).all() && (pt.array() <= max_pt.array()).all();
+            }
+        };
+
+        struct OrientedBoxRegion {
+            const Eigen::Ref<const Vector<ScalarT,EigenDim>>& center;
+            const Eigen::Ref<const Eigen::Matrix<ScalarT,EigenDim,EigenDim>>& rotation;
+            const Eigen::Ref<const Vector<ScalarT,EigenDim>>& half_extents;
+            const Eigen::Matrix<ScalarT,EigenDim,EigenDim> abs_rotation;
+            // Half extents of the box's axis-aligned bounding box
+            const Vector<ScalarT,EigenDim> aligned_half_extents;
+
+            OrientedBoxRegion(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &center,
+                               const Eigen::Ref<const Eigen::Matrix<ScalarT,EigenDim,EigenDim>> &rotation,
+                               const Eigen::Ref<const Vector<ScalarT,EigenDim>> &half_extents)
+                    : center(center), rotation(rotation), half_extents(half_extents),
+                      abs_rotation(rotation.cwiseAbs()), aligned_half_extents(abs_rotation*half_extents)
+            {}
+
+            // Separating axis tests along the world and box axes (conservative for Outside, exact for Inside)
+            inline RegionRelation classify(const Vector<ScalarT,EigenDim> &low, const Vector<ScalarT,EigenDim> &high) const {
+                const Vector<ScalarT,EigenDim> box_half((high - low)/2);
+                const Vector<ScalarT,EigenDim> offset((low + high)/2 - center);
+                if ((offset.cwiseAbs() - box_half - aligned_half_extents).maxCoeff() > (ScalarT)0) return Outside;
+                const Vector<ScalarT,EigenDim> local_offset((rotation.transpose()*offset).cwiseAbs());
+                const Vector<ScalarT,EigenDim> local_half(abs_rotation.transpose()*box_half);
+                if ((local_offset - local_half - half_extents).maxCoeff() > (ScalarT)0) return Outside;
+                if ((local_offset + local_half - half_extents).maxCoeff() <= (ScalarT)0) return Inside;
+                return Overlapping;
+            }
+
+            template <class PointT>
+            inline bool contains(const PointT &pt) const {
+                return ((rotation.transpose()*(pt - center)).cwiseAbs() - half_extents).maxCoeff() <= (ScalarT)0;
+            }
+        };
+
+        template <class RegionT>
+        void range_search_(const RegionT &region, std::vector<IndexT> &results) const {
+            if (kd_tree_.root_node == NULL) return;
+            Vector<ScalarT,EigenDim> low(data_map_.rows()), high(data_map_.rows());
+            for (size_t i = 0; i < data_map_.rows(); i++) {
+                low[i] = kd_tree_.root_bbox[i].low;
+                high[i] = kd_tree_.root_bbox[i].high;
+            }
+            range_search_level_(region, kd_tree_.root_node, low, high, results);
+        }
+
+        // [low, high] is the bounding box of the subtree under node; vind is partitioned so that every subtree
+        // owns a contiguous range of it
+        template <class RegionT>
+        void range_search_level_(const RegionT &region, const Node *node, Vector<ScalarT,EigenDim> &low,
+                                 Vector<ScalarT,EigenDim> &high, std::vector<IndexT> &results) const
         {
-            NeighborhoodSetResult res;
-            search(query_pts, nh, res);
-            return res;
+            const RegionRelation relation = region.classify(low, high);
+            if (relation == Outside) return;
+
+            if (relation == Inside) {
+                const Node *first = node, *last = node;
+                while (first->child1 != NULL) first = first->child1;
+                while (last->child2 != NULL) last = last->child2;
+                results.insert(results.end(), kd_tree_.vind.begin() + first->node_type.lr.left, kd_tree_.vind.begin() + last->node_type.lr.right);
+                return;
+            }
+
+            if (node->child1 == NULL && node->child2 == NULL) {
+                for (IndexT i = node->node_type.lr.left; i < node->node_type.lr.right; i++) {
+                    if (region.contains(data_map_.col(kd_tree_.vind[i]))) results.emplace_back(kd_tree_.vind[i]);
+                }
+                return;
+            }
+
+            const int dim = node->node_type.sub.divfeat;
+            const ScalarT prev_high = high[dim];
+            high[dim] = node->node_type.sub.divlow;
+            range_search_level_(region, node->child1, low, high, results);
+            high[dim] = prev_high;
+
+            const ScalarT prev_low = low[dim];
+            low[dim] = node->node_type.sub.divhigh;
+            range_search_level_(region, node->child2, low, high, results);
+            low[dim] = prev_low;
         }
 
-    private:
-        ConstVectorSetMatrixMap<ScalarT,EigenDim> data_map_;
-        const KDTreeDataAdaptors::EigenMap<ScalarT,EigenDim> data_adaptor_;
-        InternalTree kd_tree_;
-        nanoflann::SearchParams params_;
+        // Checks that the index sections of a file with a valid header describe a well-formed tree, so that
+        // searches over it cannot read out of bounds or loop: vind is a permutation of the points, every non-root
+        // node is the child of exactly one node with a smaller (pre-order) index, leaves hold non-empty point
+        // ranges, and the ranges of the two children of a node are adjacent (so the root covers all points).
+        // Header checksums are easy to forge, so this runs whether or not the tree checksum is verified.
+        static bool is_valid_index_(const FileHeader &header, const char *file_data, bool verify_checksum) {
+            const Interval *bbox = reinterpret_cast<const Interval *>(file_data + header.bbox_offset);
+            const IndexT *vind = reinterpret_cast<const IndexT *>(file_data + header.vind_offset);
+            const Node *nodes = reinterpret_cast<const Node *>(file_data + header.nodes_offset);
+            if (verify_checksum && compute_tree_checksum_(bbox, vind, nodes, header) != header.tree_checksum) return false;
+            if ((header.num_points == 0) != (header.num_nodes == 0)) return false;
+
+            std::vector<char> indexed(header.num_points, 0);
+            for (size_t i = 0; i < header.num_points; i++) {
+                const uint64_t ind = static_cast<uint64_t>(vind[i]);
+                if (ind >= header.num_points || indexed[ind]) return false;
+                indexed[ind] = 1;
+            }
+
+            // Children have larger indices than their parents, so visiting nodes backwards sees children first
+            std::vector<uint64_t> range_begin(header.num_nodes), range_end(header.num_nodes);
+            std::vector<char> has_parent(header.num_nodes, 0);
+            for (size_t i = header.num_nodes; i-- > 0;) {
+                const uint64_t child1 = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(nodes[i].child1));
+                const uint64_t child2 = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(nodes[i].child2));
+                if (child1 == 0 && child2 == 0) {
+                    range_begin[i] = static_cast<uint64_t>(nodes[i].node_type.lr.left);
+                    range_end[i] = static_cast<uint64_t>(nodes[i].node_type.lr.right);
+                    if (range_begin[i] >= range_end[i] || range_end[i] > header.num_points) return false;
+                    continue;
+                }
+                const int divfeat = nodes[i].node_type.sub.divfeat;
+                if (child1 <= i || child2 <= i || child1 >= header.num_nodes || child2 >= header.num_nodes || child1 == child2 ||
+                    has_parent[child1] || has_parent[child2] || range_end[child1] != range_begin[child2] ||
+                    divfeat < 0 || static_cast<uint64_t>(divfeat) >= header.dim)
+                {
+                    return false;
+                }
+                has_parent[child1] = has_parent[child2] = 1;
+                range_begin[i] = range_begin[child1];
+                range_end[i] = range_end[child2];
+            }
+            for (size_t i = 1; i < header.num_nodes; i++) {
+                if (!has_parent[i]) return false;
+            }
+            return header.num_nodes == 0 || (range_begin[0] == 0 && range_end[0] == header.num_points);
+        }
+
+        // Restores bounding box, vind and nodes of a tree that was built over data_map_, from a file that passed
+        // is_valid_index_
+        void load_index_(const FileHeader &header, const char *file_data) {
+            const Interval *bbox = reinterpret_cast<const Interval *>(file_data + header.bbox_offset);
+            const IndexT *vind = reinterpret_cast<const IndexT *>(file_data + header.vind_offset);
+            const Node *nodes = reinterpret_cast<const Node *>(file_data + header.nodes_offset);
+
+            kd_tree_.freeIndex(kd_tree_);
+            kd_tree_.m_leaf_max_size = header.max_leaf_size;
+            kd_tree_.vind.assign(vind, vind + header.num_points);
+            if (header.num_nodes == 0) return;
+
+            nanoflann::resize(kd_tree_.root_bbox, header.dim);
+            std::copy(bbox, bbox + header.dim, kd_tree_.root_bbox.begin());
+
+            Node *tree_nodes = kd_tree_.pool.template allocate<Node>(header.num_nodes);
+            std::memcpy(tree_nodes, nodes, header.num_nodes*sizeof(Node));
+            for (size_t i = 0; i < header.num_nodes; i++) {
+                const uintptr_t child1 = reinterpret_cast<uintptr_t>(tree_nodes[i].child1);
+                const uintptr_t child2 = reinterpret_cast<uintptr_t>(tree_nodes[i].child2);
+                tree_nodes[i].child1 = (child1 == 0) ? NULL : tree_nodes + child1;
+                tree_nodes[i].child2 = (child2 == 0) ? NULL : tree_nodes + child2;
+            }
+            kd_tree_.root_node = tree_nodes;
+            kd_tree_.m_size_at_index_build = kd_tree_.m_size;
+        }
     };
 
     template <template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, typename IndexT = size_t>
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cilantro {
+    // Read-only view of a file's contents: memory-mapped on POSIX systems, read into memory elsewhere
+    // (MAP_SHARED: the file must not be truncated while mapped, or accessing the lost pages raises SIGBUS)
+    class MemoryMappedFile {
+    public:
+        MemoryMappedFile(const std::string &file_path) : data_(NULL), size_(0) {
+#ifdef _WIN32
+            std::ifstream in(file_path, std::ios::in | std::ios::binary | std::ios::ate);
+            if (!in) return;
+            buffer_.resize(static_cast<size_t>(in.tellg()));
+            in.seekg(0);
+            if (!in.read(buffer_.data(), buffer_.size())) {
+                buffer_.clear();
+                return;
+            }
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+#else
+            const int fd = ::open(file_path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                void *ptr = ::mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+                if (ptr != MAP_FAILED) {
+                    data_ = static_cast<const char *>(ptr);
+                    size_ = static_cast<size_t>(st.st_size);
+                }
+            }
+            ::close(fd);
+#endif
+        }
+
+        MemoryMappedFile(const MemoryMappedFile&) = delete;
+
+        MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+        ~MemoryMappedFile() {
+#ifndef _WIN32
+            if (data_ != NULL) ::munmap(const_cast<char *>(data_), size_);
+#endif
+        }
+
+        inline bool isOpen() const { return data_ != NULL; }
+
+        inline const char* data() const { return data_; }
+
+        inline size_t size() const { return size_; }
+
+    private:
+        const char *data_;
+        size_t size_;
+#ifdef _WIN32
+        std::vector<char> buffer_;
+#endif
+    };
+
+    // Fast 64-bit (non-cryptographic) checksum, meant for detecting stale or corrupted binary data.
+    // Fixed-size chunks are hashed in parallel and then combined in order, so the result does not
+    // depend on the number of threads.
+    inline uint64_t computeChecksum(const void *data, size_t num_bytes) {
+        const size_t chunk_size = 1 << 20;
+        const size_t num_chunks = (num_bytes + chunk_size - 1)/chunk_size;
+        const char *bytes = static_cast<const char *>(data);
+
+        std::vector<uint64_t> chunk_hashes(num_chunks);
+#pragma omp parallel for shared (chunk_hashes)
+        for (size_t c = 0; c < num_chunks; c++) {
+            const char *chunk = bytes + c*chunk_size;
+            const size_t len = (c + 1 == num_chunks) ? num_bytes - c*chunk_size : chunk_size;
+            uint64_t h = 0xcbf29ce484222325ULL;
+            uint64_t word;
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+                std::memcpy(&word, chunk + i, sizeof(uint64_t));
+                h = (h ^ word)*0x9e3779b97f4a7c15ULL;
+                h ^= h >> 29;
+            }
+            for (; i < len; i++) {
+                h = (h ^ static_cast<unsigned char>(chunk[i]))*0x100000001b3ULL;
+            }
+            chunk_hashes[c] = h;
+        }
+
+        uint64_t h = 0xcbf29ce484222325ULL ^ static_cast<uint64_t>(num_bytes);
+        for (size_t c = 0; c < num_chunks; c++) {
+            h = (h ^ chunk_hashes[c])*0x100000001b3ULL;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cilantro/core/data_containers.hpp>
+
+namespace cilantro {
+    // Number of bits per coordinate used by 64-bit Morton codes in the given dimension (at least 1)
+    inline size_t getMortonCodeBitsPerDimension(size_t dim) {
+        return (dim == 0 || dim >= 64) ? 1 : std::min<size_t>(64/dim, 32);
+    }
+
+    // Interleaves the bits of the given non-negative grid coordinates (most significant bit first);
+    // coordinates are assumed to fit in bits_per_dim bits, and only the first 64 dimensions are used
+    template <typename GridCoordT>
+    inline uint64_t computeMortonCode(const GridCoordT *coords, size_t dim, size_t bits_per_dim) {
+        const size_t num_dims = std::min<size_t>(dim, 64);
+        uint64_t code = 0;
+        for (size_t b = bits_per_dim; b > 0; b--) {
+            for (size_t d = 0; d < num_dims; d++) {
+                code = (code << 1) | ((static_cast<uint64_t>(coords[d]) >> (b - 1)) & 1);
+            }
+        }
+        return code;
+    }
+
+    // Morton (Z-order) codes of points, quantized over their bounding box
+    template <typename ScalarT, ptrdiff_t EigenDim>
+    void computeMortonCodes(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points,
+                            std::vector<uint64_t> &codes,
+                            bool parallel = true)
+    {
+        codes.resize(points.cols());
+        if (points.cols() == 0) return;
+
+        const size_t dim = points.rows();
+        const size_t bits_per_dim = getMortonCodeBitsPerDimension(dim);
+        const ScalarT max_coord = static_cast<ScalarT>((uint64_t(1) << bits_per_dim) - 1);
+
+        const Vector<ScalarT,EigenDim> min_pt(points.rowwise().minCoeff());
+        const Vector<ScalarT,EigenDim> extent(points.rowwise().maxCoeff() - min_pt);
+        Vector<ScalarT,EigenDim> scale(dim);
+        for (size_t d = 0; d < dim; d++) {
+            scale[d] = (extent[d] > (ScalarT)0) ? max_coord/extent[d] : (ScalarT)0;
+        }
+
+#pragma omp parallel if (parallel)
+        {
+            std::vector<uint64_t> grid_coords(dim);
+#pragma omp for
+            for (size_t i = 0; i < points.cols(); i++) {
+                for (size_t d = 0; d < dim; d++) {
+                    grid_coords[d] = static_cast<uint64_t>(std::min(std::max((points(d,i) - min_pt[d])*scale[d], (ScalarT)0), max_coord));
+                }
+                codes[i] = computeMortonCode(grid_coords.data(), dim, bits_per_dim);
+            }
+        }
+    }
+
+    // Permutation that sorts points along the Morton curve (ties keep their input order)
+    template <typename ScalarT, ptrdiff_t EigenDim>
+    void computeMortonOrder(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points,
+                            std::vector<size_t> &order,
+                            bool parallel = true)
+    {
+        std::vector<uint64_t> codes;
+        computeMortonCodes<ScalarT,EigenDim>(points, codes, parallel);
+
+        std::vector<std::pair<uint64_t,size_t>> sorted(codes.size());
+        for (size_t i = 0; i < codes.size(); i++) {
+            sorted[i].first = codes[i];
+            sorted[i].second = i;
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        order.resize(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            order[i] = sorted[i].second;
+        }
+    }
+
+    template <typename ScalarT, ptrdiff_t EigenDim>
+    inline std::vector<size_t> computeMortonOrder(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points,
+                                                  bool parallel = true)
+    {
+        std::vector<size_t> order;
+        computeMortonOrder<ScalarT,EigenDim>(points, order, parallel);
+        return order;
+    }
+}
@@ -55,6 +55,87 @@ namespace cilantro {
     template <typename ScalarT, typename IndexT = size_t>
     using NeighborhoodSet = std::vector<Neighborhood<ScalarT,IndexT>>;
 
+    // Non-owning view of a contiguous range of neighbors (one neighborhood of a FlatNeighborhoodSet)
+    template <typename ScalarT, typename IndexT = size_t>
+    class NeighborhoodView {
+    public:
+        typedef Neighbor<ScalarT,IndexT> value_type;
+        typedef const Neighbor<ScalarT,IndexT>* const_iterator;
+        typedef const_iterator iterator;
+
+        inline NeighborhoodView() : begin_(NULL), end_(NULL) {}
+
+        inline NeighborhoodView(const Neighbor<ScalarT,IndexT> *begin, const Neighbor<ScalarT,IndexT> *end)
+                : begin_(begin), end_(end)
+        {}
+
+        inline size_t size() const { return end_ - begin_; }
+
+        inline bool empty() const { return begin_ == end_; }
+
+        inline const Neighbor<ScalarT,IndexT>& operator[](size_t i) const { return begin_[i]; }
+
+        inline const_iterator begin() const { return begin_; }
+
+        inline const_iterator end() const { return end_; }
+
+    private:
+        const Neighbor<ScalarT,IndexT> *begin_;
+        const Neighbor<ScalarT,IndexT> *end_;
+    };
+
+    // Compressed (CSR) storage for a set of neighborhoods: all neighbors live in a single buffer and
+    // the neighborhood of the i-th query occupies the range [offsets[i], offsets[i+1]).
+    // Indexing returns a NeighborhoodView, so code written against NeighborhoodSet (adj_list[i][j].index, etc.)
+    // works unchanged.
+    template <typename ScalarT, typename IndexT = size_t>
+    struct FlatNeighborhoodSet {
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef NeighborhoodView<ScalarT,IndexT> value_type;
+
+        std::vector<Neighbor<ScalarT,IndexT>> neighbors;
+        std::vector<size_t> offsets;
+
+        inline FlatNeighborhoodSet() : offsets(1, 0) {}
+
+        FlatNeighborhoodSet(const NeighborhoodSet<ScalarT,IndexT> &nh_set) : offsets(nh_set.size() + 1) {
+            offsets[0] = 0;
+            for (size_t i = 0; i < nh_set.size(); i++) {
+                offsets[i + 1] = offsets[i] + nh_set[i].size();
+            }
+            neighbors.reserve(offsets.back());
+            for (size_t i = 0; i < nh_set.size(); i++) {
+                neighbors.insert(neighbors.end(), nh_set[i].begin(), nh_set[i].end());
+            }
+        }
+
+        inline size_t size() const { return offsets.size() - 1; }
+
+        inline bool empty() const { return offsets.size() == 1; }
+
+        inline size_t getNumberOfNeighbors() const { return neighbors.size(); }
+
+        inline NeighborhoodView<ScalarT,IndexT> operator[](size_t i) const {
+            return NeighborhoodView<ScalarT,IndexT>(neighbors.data() + offsets[i], neighbors.data() + offsets[i + 1]);
+        }
+
+        inline FlatNeighborhoodSet& clear() {
+            neighbors.clear();
+            offsets.assign(1, 0);
+            return *this;
+        }
+
+        NeighborhoodSet<ScalarT,IndexT> toNeighborhoodSet() const {
+            NeighborhoodSet<ScalarT,IndexT> nh_set(size());
+            for (size_t i = 0; i < nh_set.size(); i++) {
+                nh_set[i].assign(neighbors.begin() + offsets[i], neighbors.begin() + offsets[i + 1]);
+            }
+            return nh_set;
+        }
+    };
+
     template <typename CountT = size_t>
     struct KNNNeighborhoodSpecification {
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -0,0 +1,470 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <cilantro/core/data_containers.hpp>
+#include <cilantro/core/nearest_neighbors.hpp>
+
+namespace cilantro {
+    // Approximate kNN graph construction by NN-descent (Dong et al., "Efficient k-nearest neighbor graph
+    // construction for generic similarity measures", WWW 2011), under the squared L2 metric.
+    // Starting from random neighbors, every iteration compares the (sampled) neighbors and reverse neighbors of
+    // each point with each other (local join), on the premise that a neighbor of a neighbor is likely a neighbor.
+    // The cost per iteration is linear in the number of points and the dimension, so, unlike KDTree, it stays
+    // practical for high-dimensional data (e.g., spectral embeddings or feature descriptors).
+    // Local joins run in parallel over blocks of points, each collecting its candidate updates in its own buffer;
+    // updates are then bucketed by target point range and applied in parallel, one range per thread. Candidate
+    // sampling is partitioned the same way (reverse neighbors are bucketed by the point they are sampled for), with
+    // counter-based random priorities, so the graph only depends on the random seed, not on the number of threads.
+    // The output matches KDTree's self-search layout (e.g. tree.search(points, KNNNeighborhoodSpecification<>(k))):
+    // the neighborhood of every point starts with the point itself, followed by its k - 1 approximate nearest
+    // neighbors in order of increasing distance, so it can be fed directly to the getNNGraph* utilities.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t>
+    class NNDescent {
+    public:
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        NNDescent(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data)
+                : data_map_(data),
+                  sample_rate_(1.0f),
+                  termination_threshold_(0.001f),
+                  max_iter_(10),
+                  random_seed_(std::random_device{}()),
+                  iteration_count_(0)
+        {}
+
+        ~NNDescent() {}
+
+        inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getPointsMatrixMap() const { return data_map_; }
+
+        // Fraction of each point's neighbors (and, separately, reverse neighbors) that take part in its local
+        // join; higher values improve recall at the cost of more distance evaluations per iteration
+        inline NNDescent& setSampleRate(float sample_rate) {
+            sample_rate_ = sample_rate;
+            return *this;
+        }
+
+        inline float getSampleRate() const { return sample_rate_; }
+
+        // Iterations stop when fewer than termination_threshold*num_points*k neighbor lists entries change
+        inline NNDescent& setTerminationThreshold(float termination_threshold) {
+            termination_threshold_ = termination_threshold;
+            return *this;
+        }
+
+        inline float getTerminationThreshold() const { return termination_threshold_; }
+
+        inline NNDescent& setMaxNumberOfIterations(size_t max_iter) {
+            max_iter_ = max_iter;
+            return *this;
+        }
+
+        inline size_t getMaxNumberOfIterations() const { return max_iter_; }
+
+        inline NNDescent& setRandomSeed(unsigned int seed) {
+            random_seed_ = seed;
+            return *this;
+        }
+
+        inline unsigned int getRandomSeed() const { return random_seed_; }
+
+        // Number of iterations performed by the last graph construction
+        inline size_t getNumberOfPerformedIterations() const { return iteration_count_; }
+
+        const NNDescent& computeKNNGraph(size_t k, NeighborhoodSetResult &results) {
+            compute_graph_(k);
+            const size_t num_points = data_map_.cols();
+            results.resize(num_points);
+#pragma omp parallel for shared (results)
+            for (size_t i = 0; i < num_points; i++) {
+                results[i].resize((k == 0) ? 0 : num_neighbors_ + 1);
+                if (k > 0) copy_neighborhood_(i, results[i].data());
+            }
+            release_graph_();
+            return *this;
+        }
+
+        inline NeighborhoodSetResult computeKNNGraph(size_t k) {
+            NeighborhoodSetResult results;
+            computeKNNGraph(k, results);
+            return results;
+        }
+
+        const NNDescent& computeKNNGraph(size_t k, FlatNeighborhoodSetResult &results) {
+            compute_graph_(k);
+            const size_t num_points = data_map_.cols();
+            const size_t neighborhood_size = (k == 0) ? 0 : num_neighbors_ + 1;
+            results.offsets.resize(num_points + 1);
+            results.neighbors.resize(num_points*neighborhood_size);
+#pragma omp parallel for shared (results)
+            for (size_t i = 0; i <= num_points; i++) {
+                results.offsets[i] = i*neighborhood_size;
+                if (i < num_points && k > 0) copy_neighborhood_(i, results.neighbors.data() + i*neighborhood_size);
+            }
+            release_graph_();
+            return *this;
+        }
+
+    private:
+        // Candidate neighbor found by a local join
+        struct Update {
+            IndexT target;
+            IndexT neighbor;
+            ScalarT distance;
+        };
+
+        // Reverse neighbor sampled for target: the neighbor list entry of candidate that holds target
+        struct ReverseCandidate {
+            IndexT target;
+            IndexT candidate;
+            float priority;
+            bool isNew;
+        };
+
+        // Point blocks of local joins, and number of target point ranges that updates are bucketed into
+        static const size_t join_block_size_ = 256;
+        static const size_t num_update_partitions_ = 64;
+
+        ConstVectorSetMatrixMap<ScalarT,EigenDim> data_map_;
+        float sample_rate_;
+        float termination_threshold_;
+        size_t max_iter_;
+        unsigned int random_seed_;
+        size_t iteration_count_;
+
+        // Neighbor lists, num_neighbors_ entries per point, kept as max-heaps by distance; flags mark entries
+        // that have not taken part in a local join yet
+        size_t num_neighbors_;
+        std::vector<IndexT> nn_indices_;
+        std::vector<ScalarT> nn_distances_;
+        std::vector<char> nn_new_;
+
+        // Sampled local join candidates, max_candidates_ entries per point, kept as max-heaps by random priority
+        size_t max_candidates_;
+        std::vector<IndexT> new_candidates_;
+        std::vector<float> new_priorities_;
+        std::vector<size_t> num_new_candidates_;
+        std::vector<IndexT> old_candidates_;
+        std::vector<float> old_priorities_;
+        std::vector<size_t> num_old_candidates_;
+
+        inline ScalarT distance_(size_t i, size_t j) const {
+            return (data_map_.col(i) - data_map_.col(j)).squaredNorm();
+        }
+
+        void compute_graph_(size_t k) {
+            const size_t num_points = data_map_.cols();
+            num_neighbors_ = (k == 0 || num_points == 0) ? 0 : std::min(k - 1, num_points - 1);
+            iteration_count_ = 0;
+            if (num_neighbors_ == 0) return;
+
+            std::mt19937 rng(random_seed_);
+            init_random_graph_(rng);
+
+            max_candidates_ = std::max<size_t>(1, static_cast<size_t>(sample_rate_*num_neighbors_));
+            new_candidates_.resize(num_points*max_candidates_);
+            new_priorities_.resize(num_points*max_candidates_);
+            num_new_candidates_.resize(num_points);
+            old_candidates_.resize(num_points*max_candidates_);
+            old_priorities_.resize(num_points*max_candidates_);
+            num_old_candidates_.resize(num_points);
+
+            const size_t num_blocks = (num_points + join_block_size_ - 1)/join_block_size_;
+            std::vector<std::vector<ReverseCandidate>> block_candidates(num_blocks);
+            std::vector<ReverseCandidate> reverse_candidates;
+            std::vector<std::vector<Update>> block_updates(num_blocks);
+            std::vector<Update> updates;
+            const double min_changes = termination_threshold_*static_cast<double>(num_points*num_neighbors_);
+            while (iteration_count_ < max_iter_) {
+                if (!sample_candidates_(rng, block_candidates, reverse_candidates)) break;
+                local_join_(block_updates);
+                const size_t num_changes = apply_updates_(block_updates, updates);
+                iteration_count_++;
+                if (num_changes <= min_changes) break;
+            }
+        }
+
+        void release_graph_() {
+            std::vector<IndexT>().swap(nn_indices_);
+            std::vector<ScalarT>().swap(nn_distances_);
+            std::vector<char>().swap(nn_new_);
+            std::vector<IndexT>().swap(new_candidates_);
+            std::vector<float>().swap(new_priorities_);
+            std::vector<size_t>().swap(num_new_candidates_);
+            std::vector<IndexT>().swap(old_candidates_);
+            std::vector<float>().swap(old_priorities_);
+            std::vector<size_t>().swap(num_old_candidates_);
+        }
+
+        // Writes the point itself, followed by its neighbors sorted by distance
+        inline void copy_neighborhood_(size_t i, NeighborResult *neighborhood) const {
+            neighborhood[0].index = static_cast<IndexT>(i);
+            neighborhood[0].value = (ScalarT)0;
+            for (size_t m = 0; m < num_neighbors_; m++) {
+                neighborhood[m + 1].index = nn_indices_[i*num_neighbors_ + m];
+                neighborhood[m + 1].value = nn_distances_[i*num_neighbors_ + m];
+            }
+            std::sort(neighborhood + 1, neighborhood + num_neighbors_ + 1, typename NeighborResult::ValueLessComparator());
+        }
+
+        void init_random_graph_(std::mt19937 &rng) {
+            const size_t num_points = data_map_.cols();
+            nn_indices_.assign(num_points*num_neighbors_, static_cast<IndexT>(num_points));
+            nn_distances_.assign(num_points*num_neighbors_, std::numeric_limits<ScalarT>::max());
+            nn_new_.assign(num_points*num_neighbors_, 1);
+
+            // Distinct random neighbors (excluding the point itself) by rejection; num_neighbors_ < num_points
+            std::uniform_int_distribution<size_t> dist(0, num_points - 2);
+            for (size_t i = 0; i < num_points; i++) {
+                IndexT *indices = nn_indices_.data() + i*num_neighbors_;
+                for (size_t m = 0; m < num_neighbors_; ) {
+                    size_t j = dist(rng);
+                    if (j >= i) j++;
+                    if (std::find(indices, indices + m, static_cast<IndexT>(j)) == indices + m) indices[m++] = static_cast<IndexT>(j);
+                }
+            }
+
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                IndexT *indices = nn_indices_.data() + i*num_neighbors_;
+                ScalarT *distances = nn_distances_.data() + i*num_neighbors_;
+                for (size_t m = 0; m < num_neighbors_; m++) {
+                    distances[m] = distance_(i, indices[m]);
+                    // Sift up
+                    for (size_t c = m; c > 0 && distances[(c - 1)/2] < distances[c]; c = (c - 1)/2) {
+                        std::swap(distances[c], distances[(c - 1)/2]);
+                        std::swap(indices[c], indices[(c - 1)/2]);
+                    }
+                }
+            }
+        }
+
+        // Inserts neighbor into the neighbor list of point i, unless it is already there or not closer than the
+        // current worst neighbor; returns whether the list changed
+        inline bool push_neighbor_(size_t i, IndexT neighbor, ScalarT distance) {
+            IndexT *indices = nn_indices_.data() + i*num_neighbors_;
+            ScalarT *distances = nn_distances_.data() + i*num_neighbors_;
+            char *is_new = nn_new_.data() + i*num_neighbors_;
+            if (distance >= distances[0]) return false;
+            if (std::find(indices, indices + num_neighbors_, neighbor) != indices + num_neighbors_) return false;
+
+            // Replace the root and sift down
+            size_t pos = 0;
+            for (size_t child = 1; child < num_neighbors_; child = 2*pos + 1) {
+                if (child + 1 < num_neighbors_ && distances[child] < distances[child + 1]) child++;
+                if (distances[child] <= distance) break;
+                indices[pos] = indices[child];
+                distances[pos] = distances[child];
+                is_new[pos] = is_new[child];
+                pos = child;
+            }
+            indices[pos] = neighbor;
+            distances[pos] = distance;
+            is_new[pos] = 1;
+            return true;
+        }
+
+        // Adds candidate to a bounded candidate list (indices/priorities, of current size num), keeping the entries
+        // with the smallest priorities, i.e., a uniform sample
+        inline void push_candidate_(IndexT *indices, float *priorities, size_t &num, IndexT candidate, float priority) const {
+            if (std::find(indices, indices + num, candidate) != indices + num) return;
+            size_t pos;
+            if (num < max_candidates_) {
+                for (pos = num++; pos > 0 && priorities[(pos - 1)/2] < priority; pos = (pos - 1)/2) {
+                    indices[pos] = indices[(pos - 1)/2];
+                    priorities[pos] = priorities[(pos - 1)/2];
+                }
+            } else {
+                if (priority >= priorities[0]) return;
+                pos = 0;
+                for (size_t child = 1; child < num; child = 2*pos + 1) {
+                    if (child + 1 < num && priorities[child] < priorities[child + 1]) child++;
+                    if (priorities[child] <= priority) break;
+                    indices[pos] = indices[child];
+                    priorities[pos] = priorities[child];
+                    pos = child;
+                }
+            }
+            indices[pos] = candidate;
+            priorities[pos] = priority;
+        }
+
+        // Uniform [0, 1) sampling priority of neighbor list entry m, for the iteration with the given seed
+        // (splitmix64 finalizer of a per-entry counter)
+        static inline float sample_priority_(uint64_t seed, size_t m) {
+            uint64_t z = seed + (static_cast<uint64_t>(m) + 1)*0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+            z ^= z >> 31;
+            return static_cast<float>(z >> 40)*(1.0f/16777216.0f);
+        }
+
+        inline void push_candidate_(size_t i, IndexT candidate, float priority, bool is_new) {
+            if (is_new) {
+                push_candidate_(new_candidates_.data() + i*max_candidates_, new_priorities_.data() + i*max_candidates_, num_new_candidates_[i], candidate, priority);
+            } else {
+                push_candidate_(old_candidates_.data() + i*max_candidates_, old_priorities_.data() + i*max_candidates_, num_old_candidates_[i], candidate, priority);
+            }
+        }
+
+        // Samples the new and old neighbors and reverse neighbors of every point into its candidate lists, and marks
+        // sampled new neighbors as old; returns false if there are no new candidates left.
+        // Reverse neighbors are collected per block of points and bucketed by target point range (as in
+        // apply_updates_); each range is then filled by one thread, in the order of a sequential pass over all
+        // neighbor lists.
+        bool sample_candidates_(std::mt19937 &rng,
+                                std::vector<std::vector<ReverseCandidate>> &block_candidates,
+                                std::vector<ReverseCandidate> &reverse_candidates)
+        {
+            const size_t num_points = data_map_.cols();
+            const uint64_t seed = (static_cast<uint64_t>(rng()) << 32) | static_cast<uint64_t>(rng());
+
+            bool has_new = false;
+#pragma omp parallel for shared (block_candidates) reduction (||: has_new)
+            for (size_t b = 0; b < block_candidates.size(); b++) {
+                std::vector<ReverseCandidate>& candidates(block_candidates[b]);
+                candidates.clear();
+                const size_t block_end = std::min((b + 1)*join_block_size_, num_points);
+                for (size_t m = b*join_block_size_*num_neighbors_; m < block_end*num_neighbors_; m++) {
+                    candidates.push_back(ReverseCandidate{nn_indices_[m], static_cast<IndexT>(m/num_neighbors_), sample_priority_(seed, m), nn_new_[m] != 0});
+                    if (nn_new_[m]) has_new = true;
+                }
+            }
+
+            std::vector<size_t> offsets;
+            const size_t num_blocks = block_candidates.size();
+            const size_t num_partitions = partition_by_target_(block_candidates, reverse_candidates, offsets);
+            const size_t partition_size = (num_points + num_partitions - 1)/num_partitions;
+
+#pragma omp parallel for shared (offsets, reverse_candidates) schedule (dynamic)
+            for (size_t p = 0; p < num_partitions; p++) {
+                const size_t begin = std::min(p*partition_size, num_points);
+                const size_t end = std::min((p + 1)*partition_size, num_points);
+                std::fill(num_new_candidates_.begin() + begin, num_new_candidates_.begin() + end, 0);
+                std::fill(num_old_candidates_.begin() + begin, num_old_candidates_.begin() + end, 0);
+
+                // Reverse neighbors from lower indexed points, the point's own neighbors, then reverse neighbors
+                // from higher indexed points
+                for (size_t u = offsets[p*num_blocks]; u < offsets[(p + 1)*num_blocks]; u++) {
+                    const ReverseCandidate& rc(reverse_candidates[u]);
+                    if (rc.candidate < rc.target) push_candidate_(rc.target, rc.candidate, rc.priority, rc.isNew);
+                }
+                for (size_t m = begin*num_neighbors_; m < end*num_neighbors_; m++) {
+                    push_candidate_(m/num_neighbors_, nn_indices_[m], sample_priority_(seed, m), nn_new_[m] != 0);
+                }
+                for (size_t u = offsets[p*num_blocks]; u < offsets[(p + 1)*num_blocks]; u++) {
+                    const ReverseCandidate& rc(reverse_candidates[u]);
+                    if (rc.candidate > rc.target) push_candidate_(rc.target, rc.candidate, rc.priority, rc.isNew);
+                }
+            }
+
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                const IndexT *candidates = new_candidates_.data() + i*max_candidates_;
+                for (size_t m = i*num_neighbors_; m < (i + 1)*num_neighbors_; m++) {
+                    if (nn_new_[m] && std::find(candidates, candidates + num_new_candidates_[i], nn_indices_[m]) != candidates + num_new_candidates_[i]) {
+                        nn_new_[m] = 0;
+                    }
+                }
+            }
+
+            return has_new;
+        }
+
+        // Compares new candidates with each other and with old candidates, for every point, and collects the pairs
+        // that would improve either neighbor list
+        void local_join_(std::vector<std::vector<Update>> &block_updates) const {
+            const size_t num_points = data_map_.cols();
+#pragma omp parallel for shared (block_updates) schedule (dynamic)
+            for (size_t b = 0; b < block_updates.size(); b++) {
+                std::vector<Update>& updates(block_updates[b]);
+                updates.clear();
+                const size_t block_end = std::min((b + 1)*join_block_size_, num_points);
+                for (size_t i = b*join_block_size_; i < block_end; i++) {
+                    const IndexT *new_cand = new_candidates_.data() + i*max_candidates_;
+                    const IndexT *old_cand = old_candidates_.data() + i*max_candidates_;
+                    for (size_t m = 0; m < num_new_candidates_[i]; m++) {
+                        for (size_t l = m + 1; l < num_new_candidates_[i]; l++) {
+                            add_join_pair_(new_cand[m], new_cand[l], updates);
+                        }
+                        for (size_t l = 0; l < num_old_candidates_[i]; l++) {
+                            if (new_cand[m] != old_cand[l]) add_join_pair_(new_cand[m], old_cand[l], updates);
+                        }
+                    }
+                }
+            }
+        }
+
+        inline void add_join_pair_(IndexT u1, IndexT u2, std::vector<Update> &updates) const {
+            const ScalarT distance = distance_(u1, u2);
+            if (distance < nn_distances_[u1*num_neighbors_]) updates.push_back(Update{u1, u2, distance});
+            if (distance < nn_distances_[u2*num_neighbors_]) updates.push_back(Update{u2, u1, distance});
+        }
+
+        // Concatenates the per-block items into items, bucketed by target point range: partition-major, then in
+        // block order, so that every target sees its items in their original order. Partition p spans
+        // items[offsets[p*num_blocks], offsets[(p + 1)*num_blocks]); returns the number of partitions.
+        template <class ItemT>
+        size_t partition_by_target_(const std::vector<std::vector<ItemT>> &block_items,
+                                    std::vector<ItemT> &items,
+                                    std::vector<size_t> &offsets) const
+        {
+            const size_t num_points = data_map_.cols();
+            const size_t num_blocks = block_items.size();
+            const size_t num_partitions = std::min(num_update_partitions_, num_points);
+            const size_t partition_size = (num_points + num_partitions - 1)/num_partitions;
+
+            // Partition-major offsets of every (partition, block) segment
+            offsets.assign(num_partitions*num_blocks + 1, 0);
+#pragma omp parallel for shared (offsets)
+            for (size_t b = 0; b < num_blocks; b++) {
+                for (size_t u = 0; u < block_items[b].size(); u++) {
+                    offsets[(block_items[b][u].target/partition_size)*num_blocks + b + 1]++;
+                }
+            }
+            for (size_t s = 0; s < num_partitions*num_blocks; s++) {
+                offsets[s + 1] += offsets[s];
+            }
+
+            items.resize(offsets.back());
+#pragma omp parallel for shared (offsets, items)
+            for (size_t b = 0; b < num_blocks; b++) {
+                std::vector<size_t> pos(num_partitions);
+                for (size_t p = 0; p < num_partitions; p++) {
+                    pos[p] = offsets[p*num_blocks + b];
+                }
+                for (size_t u = 0; u < block_items[b].size(); u++) {
+                    items[pos[block_items[b][u].target/partition_size]++] = block_items[b][u];
+                }
+            }
+            return num_partitions;
+        }
+
+        // Buckets the updates by target point range and applies each bucket in parallel; returns the number of
+        // neighbor list changes
+        size_t apply_updates_(std::vector<std::vector<Update>> &block_updates, std::vector<Update> &updates) {
+            const size_t num_blocks = block_updates.size();
+            std::vector<size_t> offsets;
+            const size_t num_partitions = partition_by_target_(block_updates, updates, offsets);
+
+            size_t num_changes = 0;
+#pragma omp parallel for shared (offsets, updates) reduction (+: num_changes) schedule (dynamic)
+            for (size_t p = 0; p < num_partitions; p++) {
+                for (size_t u = offsets[p*num_blocks]; u < offsets[(p + 1)*num_blocks]; u++) {
+                    if (push_neighbor_(updates[u].target, updates[u].neighbor, updates[u].distance)) num_changes++;
+                }
+            }
+            return num_changes;
+        }
+    };
+}
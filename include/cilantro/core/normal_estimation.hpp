@@ -4,7 +4,8 @@
 #include <cilantro/core/kd_tree.hpp>
 
 namespace cilantro {
-    template <typename ScalarT, ptrdiff_t EigenDim, typename CovarianceT = Covariance<ScalarT, EigenDim>, typename IndexT = size_t>
+    // SearchTreeT may be any tree with the KDTree search interface (e.g. ImplicitKDTree for 2D/3D points)
+    template <typename ScalarT, ptrdiff_t EigenDim, typename CovarianceT = Covariance<ScalarT, EigenDim>, typename IndexT = size_t, class SearchTreeT = KDTree<ScalarT,EigenDim,KDTreeDistanceAdaptors::L2,IndexT>>
     class NormalEstimation {
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -12,12 +13,13 @@ namespace cilantro {
         typedef ScalarT Scalar;
         typedef IndexT Index;
         typedef CovarianceT Covariance;
-        typedef KDTree<ScalarT,EigenDim,KDTreeDistanceAdaptors::L2,IndexT> SearchTree;
+        typedef SearchTreeT SearchTree;
 
         enum { Dimension = EigenDim };
 
         NormalEstimation(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points, size_t max_leaf_size = 10)
                 : points_(points),
+                  query_points_(points_),
                   kd_tree_ptr_(new SearchTree(points, max_leaf_size)),
                   kd_tree_owned_(true),
                   view_point_(Vector<ScalarT,EigenDim>::Constant(points_.rows(), 1, std::numeric_limits<ScalarT>::quiet_NaN())),
@@ -26,8 +28,24 @@ namespace cilantro {
             compute_mean_and_covariance_.setMinValidSampleSize(points_.rows());
         }
 
+        // Normals of the points selected by view only (in view order), with neighborhoods drawn from the same
+        // subset; SearchTree must be constructible from a ConstVectorSetIndexView (e.g. KDTree)
+        NormalEstimation(const ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> &view, size_t max_leaf_size = 10)
+                : points_(view.getBaseMatrixMap()),
+                  query_points_(view),
+                  kd_tree_ptr_(new SearchTree(view, max_leaf_size)),
+                  kd_tree_owned_(true),
+                  view_point_(Vector<ScalarT,EigenDim>::Constant(points_.rows(), 1, std::numeric_limits<ScalarT>::quiet_NaN())),
+                  ref_normals_(NULL)
+        {
+            compute_mean_and_covariance_.setMinValidSampleSize(points_.rows());
+        }
+
+        // If kd_tree indexes a subset view (e.g. KDTree's view constructor), normals are computed for that
+        // subset only, in view order
         NormalEstimation(const SearchTree &kd_tree)
                 : points_(kd_tree.getPointsMatrixMap()),
+                  query_points_(indexed_points_(kd_tree, 0)),
                   kd_tree_ptr_(&kd_tree),
                   kd_tree_owned_(false),
                   view_point_(Vector<ScalarT,EigenDim>::Constant(points_.rows(), 1, std::numeric_limits<ScalarT>::quiet_NaN())),
@@ -58,7 +76,7 @@ namespace cilantro {
         inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getReferenceNormals() const { return ref_normals_; }
 
         inline NormalEstimation& setReferenceNormals(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &ref_normals) {
-            if (ref_normals.cols() == points_.cols()) {
+            if (ref_normals.cols() == query_points_.cols()) {
                 new (&ref_normals_) ConstVectorSetMatrixMap<ScalarT,EigenDim>(ref_normals);
             }
             return *this;
@@ -69,8 +87,8 @@ namespace cilantro {
                                                                  VectorSet<ScalarT,1> &curvature,
                                                                  CountT k) const
         {
-            normals.resize(points_.rows(), points_.cols());
-            curvature.resize(1, points_.cols());
+            normals.resize(points_.rows(), query_points_.cols());
+            curvature.resize(1, query_points_.cols());
             compute_normals_curvature_(normals, curvature, KNNNeighborhoodSpecification<CountT>(k));
             return *this;
         }
@@ -87,7 +105,7 @@ namespace cilantro {
 
         template <typename CountT = size_t>
         inline VectorSet<ScalarT,EigenDim> getNormalsKNN(CountT k) const {
-            VectorSet<ScalarT,EigenDim> normals(points_.rows(), points_.cols());
+            VectorSet<ScalarT,EigenDim> normals(points_.rows(), query_points_.cols());
             compute_normals_(normals, KNNNeighborhoodSpecification<CountT>(k));
             return normals;
         }
@@ -103,7 +121,7 @@ namespace cilantro {
 
         template <typename CountT = size_t>
         inline VectorSet<ScalarT,1> getCurvatureKNN(CountT k) const {
-            VectorSet<ScalarT,1> curvature(1, points_.cols());
+            VectorSet<ScalarT,1> curvature(1, query_points_.cols());
             compute_curvature_(curvature, KNNNeighborhoodSpecification<CountT>(k));
             return curvature;
         }
@@ -121,8 +139,8 @@ namespace cilantro {
                                                                     VectorSet<ScalarT,1> &curvature,
                                                                     ScalarT radius) const
         {
-            normals.resize(points_.rows(), points_.cols());
-            curvature.resize(1, points_.cols());
+            normals.resize(points_.rows(), query_points_.cols());
+            curvature.resize(1, query_points_.cols());
             compute_normals_curvature_(normals, curvature, RadiusNeighborhoodSpecification<ScalarT>(radius*radius));
             return *this;
         }
@@ -137,7 +155,7 @@ namespace cilantro {
         }
 
         inline VectorSet<ScalarT,EigenDim> getNormalsRadius(ScalarT radius) const {
-            VectorSet<ScalarT,EigenDim> normals(points_.rows(), points_.cols());
+            VectorSet<ScalarT,EigenDim> normals(points_.rows(), query_points_.cols());
             compute_normals_(normals, RadiusNeighborhoodSpecification<ScalarT>(radius*radius));
             return normals;
         }
@@ -151,7 +169,7 @@ namespace cilantro {
         }
 
         inline VectorSet<ScalarT,1> getCurvatureRadius(ScalarT radius) const {
-            VectorSet<ScalarT,1> curvature(1, points_.cols());
+            VectorSet<ScalarT,1> curvature(1, query_points_.cols());
             compute_curvature_(curvature, RadiusNeighborhoodSpecification<ScalarT>(radius*radius));
             return curvature;
         }
@@ -170,8 +188,8 @@ namespace cilantro {
                                                                          CountT k,
                                                                          ScalarT radius) const
         {
-            normals.resize(points_.rows(), points_.cols());
-            curvature.resize(1, points_.cols());
+            normals.resize(points_.rows(), query_points_.cols());
+            curvature.resize(1, query_points_.cols());
             compute_normals_curvature_(normals, curvature, KNNInRadiusNeighborhoodSpecification<ScalarT,CountT>(k, radius*radius));
             return *this;
         }
@@ -189,7 +207,7 @@ namespace cilantro {
 
         template <typename CountT = size_t>
         inline VectorSet<ScalarT,EigenDim> getNormalsKNNInRadius(CountT k, ScalarT radius) const {
-            VectorSet<ScalarT,EigenDim> normals(points_.rows(), points_.cols());
+            VectorSet<ScalarT,EigenDim> normals(points_.rows(), query_points_.cols());
             compute_normals_(normals, KNNInRadiusNeighborhoodSpecification<ScalarT,CountT>(k, radius*radius));
             return normals;
         }
@@ -205,7 +223,7 @@ namespace cilantro {
 
         template <typename CountT = size_t>
         inline VectorSet<ScalarT,1> getCurvatureKNNInRadius(CountT k, ScalarT radius) const {
-            VectorSet<ScalarT,1> curvature(1, points_.cols());
+            VectorSet<ScalarT,1> curvature(1, query_points_.cols());
             compute_curvature_(curvature, KNNInRadiusNeighborhoodSpecification<ScalarT,CountT>(k, radius*radius));
             return curvature;
         }
@@ -224,8 +242,8 @@ namespace cilantro {
                                                               VectorSet<ScalarT,1> &curvature,
                                                               const NeighborhoodSpecT &nh) const
         {
-            normals.resize(points_.rows(), points_.cols());
-            curvature.resize(1, points_.cols());
+            normals.resize(points_.rows(), query_points_.cols());
+            curvature.resize(1, query_points_.cols());
             compute_normals_curvature_(normals, curvature, nh);
             return *this;
         }
@@ -242,7 +260,7 @@ namespace cilantro {
 
         template <typename NeighborhoodSpecT>
         inline VectorSet<ScalarT,EigenDim> getNormals(const NeighborhoodSpecT &nh) const {
-            VectorSet<ScalarT,EigenDim> normals(points_.rows(), points_.cols());
+            VectorSet<ScalarT,EigenDim> normals(points_.rows(), query_points_.cols());
             compute_normals_(normals, nh);
             return normals;
         }
@@ -258,7 +276,7 @@ namespace cilantro {
 
         template <typename NeighborhoodSpecT>
         inline VectorSet<ScalarT,1> getCurvature(const NeighborhoodSpecT &nh) const {
-            VectorSet<ScalarT,1> curvature(1, points_.cols());
+            VectorSet<ScalarT,1> curvature(1, query_points_.cols());
             compute_curvature_(curvature, nh);
             return curvature;
         }
@@ -272,19 +290,319 @@ namespace cilantro {
             return *this;
         }
 
+        // Multi-scale estimation from a single kNN query per point: the neighborhoods of sizes ks (e.g.
+        // {10, 20, 40, 80}) are the prefixes of the distance-sorted neighborhood of the largest size, so their
+        // covariances follow from running sums. Each point gets the normal and curvature of the scale with the
+        // lowest curvature (surface variation); scale_indices[i] is the index of that scale in ks, or ks.size()
+        // if no scale had enough neighbors (NaN outputs). Covariances are plain sample covariances (the
+        // configured covariance estimator only contributes its minimum sample size).
+        template <typename CountT = size_t>
+        inline const NormalEstimation& getNormalsAndCurvatureMultiScaleKNN(VectorSet<ScalarT,EigenDim> &normals,
+                                                                           VectorSet<ScalarT,1> &curvature,
+                                                                           std::vector<size_t> &scale_indices,
+                                                                           const std::vector<CountT> &ks) const
+        {
+            normals.resize(points_.rows(), query_points_.cols());
+            curvature.resize(1, query_points_.cols());
+            compute_multi_scale_knn_(normals, curvature, scale_indices, ks);
+            return *this;
+        }
+
+        // External buffers
+        template <typename CountT = size_t>
+        inline const NormalEstimation& estimateNormalsAndCurvatureMultiScaleKNN(VectorSetMatrixMap<ScalarT,EigenDim> normals,
+                                                                                VectorSetMatrixMap<ScalarT,1> curvature,
+                                                                                std::vector<size_t> &scale_indices,
+                                                                                const std::vector<CountT> &ks) const
+        {
+            compute_multi_scale_knn_(normals, curvature, scale_indices, ks);
+            return *this;
+        }
+
     private:
         ConstVectorSetMatrixMap<ScalarT,EigenDim> points_;
+        // Points whose normals are computed (all of points_, unless constructed from a subset view)
+        ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> query_points_;
         const SearchTree *kd_tree_ptr_;
         bool kd_tree_owned_;
         Vector<ScalarT,EigenDim> view_point_;
         ConstVectorSetMatrixMap<ScalarT,EigenDim> ref_normals_;
         CovarianceT compute_mean_and_covariance_;
 
+        // Points indexed by tree: its subset view, if it has one, or all of its points
+        template <class TreeT = SearchTree>
+        static inline auto indexed_points_(const TreeT &tree, int) -> decltype(ConstVectorSetIndexView<ScalarT,EigenDim,IndexT>(tree.getPointsMatrixMap(), tree.getSubsetIndices())) {
+            if (!tree.indexesSubset()) return ConstVectorSetIndexView<ScalarT,EigenDim,IndexT>(tree.getPointsMatrixMap());
+            return ConstVectorSetIndexView<ScalarT,EigenDim,IndexT>(tree.getPointsMatrixMap(), tree.getSubsetIndices());
+        }
+
+        static inline ConstVectorSetIndexView<ScalarT,EigenDim,IndexT> indexed_points_(const SearchTree &tree, long) {
+            return ConstVectorSetIndexView<ScalarT,EigenDim,IndexT>(tree.getPointsMatrixMap());
+        }
+
+        // Largest k served by the 3D fixed-k path (see compute_fixed_k_3d_)
+        static const size_t fixed_k_capacity_ = 128;
+
+        typedef std::integral_constant<bool,EigenDim == 3 && std::is_same<CovarianceT,cilantro::Covariance<ScalarT,3>>::value> FixedK3DEnabled;
+
+        // Number of neighbors and (metric) search radius of the specifications the fixed-k path handles
+        template <typename CountT>
+        static inline bool get_fixed_k_(const KNNNeighborhoodSpecification<CountT> &nh, size_t &k, ScalarT &max_radius) {
+            k = static_cast<size_t>(nh.maxNumberOfNeighbors);
+            max_radius = std::numeric_limits<ScalarT>::max();
+            return true;
+        }
+
+        template <typename CountT>
+        static inline bool get_fixed_k_(const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh, size_t &k, ScalarT &max_radius) {
+            k = static_cast<size_t>(nh.maxNumberOfNeighbors);
+            max_radius = nh.radius;
+            return true;
+        }
+
+        template <typename NeighborhoodSpecT>
+        static inline bool get_fixed_k_(const NeighborhoodSpecT &, size_t &, ScalarT &) { return false; }
+
+        // Order in which the fixed-k path visits query_points_ (empty for view order): consecutive queries in a
+        // spatially coherent order revisit the same tree nodes and points, which keeps them in cache.
+        // Tree (leaf) order if the tree exposes it and indexes all of points_, Morton order otherwise.
+        template <class TreeT = SearchTree>
+        inline auto get_fixed_k_query_order_(std::vector<size_t> &order, int) const -> decltype((void)std::declval<const TreeT&>().getPointIndicesInTreeOrder(), (void)std::declval<const TreeT&>().indexesSubset(), void()) {
+            if (query_points_.isSubset() || kd_tree_ptr_->indexesSubset()) {
+                get_fixed_k_query_order_(order, 0L);
+                return;
+            }
+            const auto &tree_order = kd_tree_ptr_->getPointIndicesInTreeOrder();
+            order.assign(tree_order.begin(), tree_order.end());
+        }
+
+        inline void get_fixed_k_query_order_(std::vector<size_t> &order, long) const {
+            if (!query_points_.isSubset()) computeMortonOrder<ScalarT,EigenDim>(points_, order);
+        }
+
+        // Fast path for 3D points with the default covariance estimator and kNN (or kNN in radius) neighborhoods
+        // of at most fixed_k_capacity_ points. Each neighborhood is collected in a stack buffer (no
+        // NeighborhoodSet), its covariance is accumulated in a single pass over the neighbor indices (packed
+        // upper triangle, in double precision, relative to the query point), and decomposed in closed form
+        // (SelfAdjointEigenSolver::computeDirect) instead of iteratively.
+        // Neighbors come from per-point tree searches (see get_fixed_k_query_order_), so the tree's approximation
+        // settings apply.
+        // Either output may be NULL; normals are oriented as in the generic path (reference normals take
+        // precedence over the view point). Returns false if the inputs do not qualify.
+        template <typename NeighborhoodSpecT>
+        bool compute_fixed_k_3d_(VectorSetMatrixMap<ScalarT,EigenDim> *normals,
+                                 VectorSetMatrixMap<ScalarT,1> *curvature,
+                                 const NeighborhoodSpecT &nh,
+                                 std::true_type) const
+        {
+            size_t k;
+            ScalarT max_radius;
+            if (!get_fixed_k_(nh, k, max_radius) || k == 0 || k > fixed_k_capacity_) return false;
+
+            const size_t min_size = compute_mean_and_covariance_.getMinValidSampleSize();
+            const bool use_ref_normals = ref_normals_.data() != NULL;
+            const bool use_view_point = !use_ref_normals && view_point_.allFinite();
+            const int options = (normals != NULL) ? Eigen::ComputeEigenvectors : Eigen::EigenvaluesOnly;
+
+            std::vector<size_t> order;
+            get_fixed_k_query_order_(order, 0);
+
+#pragma omp parallel for shared (order) schedule (dynamic, 256)
+            for (size_t j = 0; j < query_points_.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                Neighbor<ScalarT,IndexT> neighbors[fixed_k_capacity_];
+                KNNSearchResultAdaptor<ScalarT,IndexT,size_t> sra(neighbors, k, max_radius);
+                const Eigen::Matrix<ScalarT,3,1> query(query_points_.col(i));
+                kd_tree_ptr_->findNeighbors(sra, query.data());
+
+                const size_t num_neighbors = sra.size();
+                if (num_neighbors < min_size) {
+                    if (normals != NULL) normals->col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
+                    if (curvature != NULL) (*curvature)[i] = std::numeric_limits<ScalarT>::quiet_NaN();
+                    continue;
+                }
+
+                // Sums of d and of the upper triangle of d*d^T, for d = p - query
+                double sum[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+                for (size_t m = 0; m < num_neighbors; m++) {
+                    const ScalarT *pt = points_.col(neighbors[m].index).data();
+                    const double dx = static_cast<double>(pt[0]) - static_cast<double>(query[0]);
+                    const double dy = static_cast<double>(pt[1]) - static_cast<double>(query[1]);
+                    const double dz = static_cast<double>(pt[2]) - static_cast<double>(query[2]);
+                    sum[0] += dx;
+                    sum[1] += dy;
+                    sum[2] += dz;
+                    sum[3] += dx*dx;
+                    sum[4] += dx*dy;
+                    sum[5] += dx*dz;
+                    sum[6] += dy*dy;
+                    sum[7] += dy*dz;
+                    sum[8] += dz*dz;
+                }
+
+                const double n = static_cast<double>(num_neighbors);
+                const double scale = 1.0/(n - 1.0);
+                Eigen::Matrix3d cov;
+                cov(0,0) = (sum[3] - sum[0]*sum[0]/n)*scale;
+                cov(0,1) = cov(1,0) = (sum[4] - sum[0]*sum[1]/n)*scale;
+                cov(0,2) = cov(2,0) = (sum[5] - sum[0]*sum[2]/n)*scale;
+                cov(1,1) = (sum[6] - sum[1]*sum[1]/n)*scale;
+                cov(1,2) = cov(2,1) = (sum[7] - sum[1]*sum[2]/n)*scale;
+                cov(2,2) = (sum[8] - sum[2]*sum[2]/n)*scale;
+
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eig;
+                eig.computeDirect(cov, options);
+
+                if (normals != NULL) {
+                    Eigen::Matrix<ScalarT,3,1> normal(eig.eigenvectors().col(0).template cast<ScalarT>());
+                    if ((use_ref_normals && normal.dot(ref_normals_.col(i)) < (ScalarT)0.0) ||
+                        (use_view_point && normal.dot(view_point_ - query) < (ScalarT)0.0))
+                    {
+                        normal = -normal;
+                    }
+                    normals->col(i) = normal;
+                }
+                if (curvature != NULL) (*curvature)[i] = static_cast<ScalarT>(eig.eigenvalues()[0]/eig.eigenvalues().sum());
+            }
+            return true;
+        }
+
+        template <typename NeighborhoodSpecT>
+        inline bool compute_fixed_k_3d_(VectorSetMatrixMap<ScalarT,EigenDim> *,
+                                        VectorSetMatrixMap<ScalarT,1> *,
+                                        const NeighborhoodSpecT &,
+                                        std::false_type) const
+        {
+            return false;
+        }
+
+        // Smallest eigenvalue and its eigenvector (closed form in 3D)
+        static inline double smallest_eigen_pair_(const Eigen::Matrix3d &cov, Eigen::Vector3d &eigenvector) {
+            return computeSmallestEigenPair3(cov, eigenvector);
+        }
+
+        template <class MatrixT, class VectorT>
+        static inline double smallest_eigen_pair_(const MatrixT &cov, VectorT &eigenvector) {
+            Eigen::SelfAdjointEigenSolver<MatrixT> eig(cov);
+            eigenvector = eig.eigenvectors().col(0);
+            return eig.eigenvalues()[0];
+        }
+
+        template <typename CountT>
+        void compute_multi_scale_knn_(VectorSetMatrixMap<ScalarT,EigenDim> normals,
+                                      VectorSetMatrixMap<ScalarT,1> curvature,
+                                      std::vector<size_t> &scale_indices,
+                                      const std::vector<CountT> &ks) const
+        {
+            typedef Eigen::Matrix<double,EigenDim,1> VectorD;
+            typedef Eigen::Matrix<double,EigenDim,EigenDim> MatrixD;
+
+            const size_t dim = points_.rows();
+            const size_t num_scales = ks.size();
+            scale_indices.assign(query_points_.cols(), num_scales);
+
+            // Scales by increasing neighborhood size
+            std::vector<size_t> scales(num_scales);
+            for (size_t s = 0; s < num_scales; s++) scales[s] = s;
+            std::sort(scales.begin(), scales.end(), [&ks](size_t a, size_t b) { return ks[a] < ks[b]; });
+            const size_t k_max = (num_scales > 0) ? static_cast<size_t>(ks[scales.back()]) : 0;
+
+            const size_t min_size = std::max<size_t>(compute_mean_and_covariance_.getMinValidSampleSize(), 2);
+            const bool use_ref_normals = ref_normals_.data() != NULL;
+            const bool use_view_point = !use_ref_normals && view_point_.allFinite();
+
+            std::vector<size_t> order;
+            get_fixed_k_query_order_(order, 0);
+
+#pragma omp parallel shared (normals, curvature, scale_indices, order)
+            {
+                typename SearchTree::NeighborhoodResult nn;
+                VectorD query(dim), diff(dim), sum(dim), normal(dim), best_normal(dim);
+                MatrixD sum_sq(dim, dim), cov(dim, dim);
+
+#pragma omp for schedule (dynamic, 256)
+                for (size_t j = 0; j < query_points_.cols(); j++) {
+                    const size_t i = order.empty() ? j : order[j];
+                    kd_tree_ptr_->kNNSearch(query_points_.col(i), k_max, nn);
+                    if (!std::is_sorted(nn.begin(), nn.end(), typename SearchTree::NeighborResult::ValueLessComparator())) {
+                        std::sort(nn.begin(), nn.end(), typename SearchTree::NeighborResult::ValueLessComparator());
+                    }
+
+                    // Running sums of d and d*d^T, for d = p - query, over the sorted neighbors
+                    query = query_points_.col(i).template cast<double>();
+                    sum.setZero();
+                    sum_sq.setZero();
+                    size_t count = 0, last_size = 0;
+                    double best_curvature = std::numeric_limits<double>::quiet_NaN();
+                    for (size_t s = 0; s < num_scales; s++) {
+                        const size_t size = std::min<size_t>(static_cast<size_t>(ks[scales[s]]), nn.size());
+                        for (; count < size; count++) {
+                            diff = points_.col(nn[count].index).template cast<double>() - query;
+                            sum += diff;
+                            sum_sq.noalias() += diff*diff.transpose();
+                        }
+                        // Too small, or the same neighborhood as the previous scale
+                        if (size < min_size || size == last_size) continue;
+                        last_size = size;
+
+                        const double n = static_cast<double>(size);
+                        cov = sum_sq;
+                        cov.noalias() -= (sum/n)*sum.transpose();
+                        cov /= n - 1.0;
+                        const double variation = smallest_eigen_pair_(cov, normal)/cov.trace();
+                        if (scale_indices[i] == num_scales || variation < best_curvature) {
+                            scale_indices[i] = scales[s];
+                            best_curvature = variation;
+                            best_normal = normal;
+                        }
+                    }
+
+                    if (scale_indices[i] == num_scales) {
+                        normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
+                        curvature[i] = std::numeric_limits<ScalarT>::quiet_NaN();
+                        continue;
+                    }
+                    if ((use_ref_normals && best_normal.dot(ref_normals_.col(i).template cast<double>()) < 0.0) ||
+                        (use_view_point && best_normal.dot(view_point_.template cast<double>() - query) < 0.0))
+                    {
+                        best_normal = -best_normal;
+                    }
+                    normals.col(i) = best_normal.template cast<ScalarT>();
+                    curvature[i] = static_cast<ScalarT>(best_curvature);
+                }
+            }
+        }
+
+        // Calls visitor(i, nn) with the neighborhood nn of every query point i, one neighborhood at a time (no
+        // NeighborhoodSet of all points): through the tree's streaming self-join search (e.g.
+        // KDTree::searchAllVisit) if it has one, per-point searches otherwise. Either way, the tree's approximation
+        // settings apply. Each thread calls its own copy of visitor, which may thus hold scratch buffers.
+        template <typename NeighborhoodSpecT, class VisitorT, class TreeT = SearchTree>
+        inline auto for_each_neighborhood_(const NeighborhoodSpecT &nh, const VisitorT &visitor, int) const -> decltype(std::declval<const TreeT&>().searchAllVisit(nh, visitor), void()) {
+            kd_tree_ptr_->searchAllVisit(nh, visitor);
+        }
+
+        template <typename NeighborhoodSpecT, class VisitorT>
+        inline void for_each_neighborhood_(const NeighborhoodSpecT &nh, const VisitorT &visitor, long) const {
+#pragma omp parallel
+            {
+                VisitorT local_visitor(visitor);
+                typename SearchTree::NeighborhoodResult nn;
+#pragma omp for schedule (dynamic, 256)
+                for (size_t i = 0; i < query_points_.cols(); i++) {
+                    kd_tree_ptr_->search(query_points_.col(i), nh, nn);
+                    local_visitor(i, nn);
+                }
+            }
+        }
+
         // Normals only, no normal consistency unless view point or reference normals were set
         template <typename NeighborhoodSpecT>
         void compute_normals_(VectorSetMatrixMap<ScalarT,EigenDim> normals,
                               const NeighborhoodSpecT &nh) const
         {
+            if (compute_fixed_k_3d_(&normals, NULL, nh, FixedK3DEnabled())) return;
+
             // Check if we can enforce consistency; reference normals take precedence
             if (ref_normals_.data() == NULL) {
                 if (view_point_.allFinite()) {
@@ -296,20 +614,17 @@ namespace cilantro {
                 return;
             }
 
-            typename SearchTree::NeighborhoodResult nn;
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (normals) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &normals, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov);
                 normals.col(i) = eig.eigenvectors().col(0);
-            }
+            }, 0);
         }
 
         // Normals only, normal consistency by view point
@@ -317,24 +632,21 @@ namespace cilantro {
         void compute_normals_view_point_(VectorSetMatrixMap<ScalarT,EigenDim> normals,
                                         const NeighborhoodSpecT &nh) const
         {
-            typename SearchTree::NeighborhoodResult nn;
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (normals) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &normals, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov);
-                if (eig.eigenvectors().col(0).dot(view_point_ - points_.col(i)) < (ScalarT)0.0) {
+                if (eig.eigenvectors().col(0).dot(view_point_ - query_points_.col(i)) < (ScalarT)0.0) {
                     normals.col(i) = -eig.eigenvectors().col(0);
                 } else {
                     normals.col(i) = eig.eigenvectors().col(0);
                 }
-            }
+            }, 0);
         }
 
         // Normals only, normal consistency by reference normals
@@ -342,16 +654,13 @@ namespace cilantro {
         void compute_normals_reference_normals_(VectorSetMatrixMap<ScalarT,EigenDim> normals,
                                                 const NeighborhoodSpecT &nh) const
         {
-            typename SearchTree::NeighborhoodResult nn;
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (normals) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &normals, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
                     // normals.col(i) = ref_normals_.col(i).normalized();
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov);
@@ -360,7 +669,7 @@ namespace cilantro {
                 } else {
                     normals.col(i) = eig.eigenvectors().col(0);
                 }
-            }
+            }, 0);
         }
 
         // Normals and curvature, no normal consistency unless view point or reference normals were set
@@ -369,6 +678,8 @@ namespace cilantro {
                                         VectorSetMatrixMap<ScalarT,1> curvature,
                                         const NeighborhoodSpecT &nh) const
         {
+            if (compute_fixed_k_3d_(&normals, &curvature, nh, FixedK3DEnabled())) return;
+
             // Check if we can enforce consistency; reference normals take precedence
             if (ref_normals_.data() == NULL) {
                 if (view_point_.allFinite()) {
@@ -380,22 +691,19 @@ namespace cilantro {
                 return;
             }
 
-            typename SearchTree::NeighborhoodResult nn;
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (normals, curvature) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &normals, &curvature, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
                     curvature[i] = std::numeric_limits<ScalarT>::quiet_NaN();
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov);
                 normals.col(i) = eig.eigenvectors().col(0);
                 curvature[i] = eig.eigenvalues()[0]/eig.eigenvalues().sum();
-            }
+            }, 0);
         }
 
         // Normals and curvature, normal consistency by view point
@@ -404,26 +712,23 @@ namespace cilantro {
                                                    VectorSetMatrixMap<ScalarT,1> curvature,
                                                    const NeighborhoodSpecT &nh) const
         {
-            typename SearchTree::NeighborhoodResult nn;
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (normals, curvature) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &normals, &curvature, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
                     curvature[i] = std::numeric_limits<ScalarT>::quiet_NaN();
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov);
-                if (eig.eigenvectors().col(0).dot(view_point_ - points_.col(i)) < (ScalarT)0.0) {
+                if (eig.eigenvectors().col(0).dot(view_point_ - query_points_.col(i)) < (ScalarT)0.0) {
                     normals.col(i) = -eig.eigenvectors().col(0);
                 } else {
                     normals.col(i) = eig.eigenvectors().col(0);
                 }
                 curvature[i] = eig.eigenvalues()[0]/eig.eigenvalues().sum();
-            }
+            }, 0);
         }
 
         // Normals and curvature, normal consistency by reference normals
@@ -432,16 +737,13 @@ namespace cilantro {
                                         VectorSetMatrixMap<ScalarT,1> curvature,
                                         const NeighborhoodSpecT &nh) const
         {
-            typename SearchTree::NeighborhoodResult nn;
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (normals, curvature) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &normals, &curvature, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     normals.col(i).setConstant(std::numeric_limits<ScalarT>::quiet_NaN());
                     curvature[i] = std::numeric_limits<ScalarT>::quiet_NaN();
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov);
@@ -451,7 +753,7 @@ namespace cilantro {
                     normals.col(i) = eig.eigenvectors().col(0);
                 }
                 curvature[i] = eig.eigenvalues()[0]/eig.eigenvalues().sum();
-            }
+            }, 0);
         }
 
         // Curvature only
@@ -459,20 +761,19 @@ namespace cilantro {
         void compute_curvature_(VectorSetMatrixMap<ScalarT,1> curvature,
                                 const NeighborhoodSpecT &nh) const
         {
-            typename SearchTree::NeighborhoodResult nn;
+            if (compute_fixed_k_3d_(NULL, &curvature, nh, FixedK3DEnabled())) return;
+
             Vector<ScalarT,EigenDim> mean;
             Eigen::Matrix<ScalarT,EigenDim,EigenDim> cov;
-#pragma omp parallel for shared (curvature) private (nn, mean, cov)
-            for (size_t i = 0; i < points_.cols(); i++) {
-                kd_tree_ptr_->search(points_.col(i), nh, nn);
+            for_each_neighborhood_(nh, [this, &curvature, mean, cov](size_t i, const typename SearchTree::NeighborhoodResult &nn) mutable {
                 if (!compute_mean_and_covariance_(points_, nn, mean, cov)) {
                     curvature[i] = std::numeric_limits<ScalarT>::quiet_NaN();
-                    continue;
+                    return;
                 }
 
                 Eigen::SelfAdjointEigenSolver<Eigen::Matrix<ScalarT,EigenDim,EigenDim>> eig(cov, Eigen::EigenvaluesOnly);
                 curvature[i] = eig.eigenvalues()[0]/eig.eigenvalues().sum();
-            }
+            }, 0);
         }
     };
 
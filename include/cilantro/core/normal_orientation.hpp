@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <cilantro/core/kd_tree.hpp>
+#include <cilantro/core/morton_order.hpp>
+
+namespace cilantro {
+    namespace internal {
+        inline void atomicMin(std::atomic<uint64_t> &target, uint64_t value) {
+            uint64_t current = target.load(std::memory_order_relaxed);
+            while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed));
+        }
+
+        inline size_t findRoot(std::vector<size_t> &parent, size_t i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        }
+    } // namespace internal
+
+    // Globally consistent normal orientation (Hoppe et al., 1992): normals are flipped so that they agree in
+    // sign along a minimum spanning tree of the neighborhood graph, with edge weights 1 - |n_i.n_j| (i.e. the
+    // propagation prefers nearly parallel neighbors). neighbors[i] lists the graph neighbors of point i (e.g. a
+    // KDTree::searchAll or NNDescent kNN graph; the graph is treated as undirected and self-loops are ignored).
+    // The MST is built with parallel Boruvka rounds over a CSR copy of the graph (vertices in Morton order).
+    // Every connected component is rooted at its point with the largest last coordinate (z in 3D), whose normal
+    // is made to point along the positive last axis. Points with non-finite normals are left untouched and do
+    // not link their neighbors.
+    template <typename ScalarT, ptrdiff_t EigenDim, class NeighborhoodSetT>
+    void orientNormalsMST(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points,
+                          const NeighborhoodSetT &neighbors,
+                          VectorSetMatrixMap<ScalarT,EigenDim> normals)
+    {
+        const size_t num_points = normals.cols();
+        if (num_points == 0 || points.cols() != num_points || neighbors.size() != num_points) return;
+        const size_t dim = normals.rows();
+
+        // Work on vertices relabeled along the Morton curve (order[v] is the input index of vertex v), so that
+        // graph neighbors are mostly close in memory
+        std::vector<size_t> order, rank(num_points);
+        computeMortonOrder<ScalarT,EigenDim>(points, order);
+        VectorSet<ScalarT,EigenDim> vertex_normals(dim, num_points);
+        std::vector<char> valid(num_points);
+#pragma omp parallel for
+        for (size_t v = 0; v < num_points; v++) {
+            rank[order[v]] = v;
+            vertex_normals.col(v) = normals.col(order[v]);
+            valid[v] = vertex_normals.col(v).allFinite();
+        }
+
+        // CSR graph: edge e runs from the vertex whose range contains e to targets[e]
+        std::vector<size_t> offsets(num_points + 1, 0);
+        for (size_t v = 0; v < num_points; v++) {
+            offsets[v + 1] = offsets[v] + neighbors[order[v]].size();
+        }
+        const size_t num_edges = offsets[num_points];
+        std::vector<size_t> targets(num_edges);
+        // Weights quantized to 24 bits, edge index in the lower 40 bits: keys are unique, so Boruvka rounds
+        // never select a cycle, and the result does not depend on thread scheduling
+        const uint64_t no_edge = std::numeric_limits<uint64_t>::max();
+        std::vector<uint64_t> keys(num_edges);
+        // Edges of each vertex still leaving its component: active[offsets[v]] to active[active_ends[v] - 1]
+        std::vector<size_t> active(num_edges), active_ends(num_points);
+#pragma omp parallel for schedule (dynamic, 1024)
+        for (size_t v = 0; v < num_points; v++) {
+            const auto &nn = neighbors[order[v]];
+            size_t num_active = offsets[v];
+            for (size_t e = offsets[v]; e < offsets[v + 1]; e++) {
+                const size_t i = static_cast<size_t>(nn[e - offsets[v]].index);
+                const size_t u = (i < num_points) ? rank[i] : v;
+                targets[e] = u;
+                if (u == v || !valid[v] || !valid[u]) {
+                    keys[e] = no_edge;
+                    continue;
+                }
+                const double weight = std::min(std::max(1.0 - std::abs(static_cast<double>(vertex_normals.col(v).dot(vertex_normals.col(u)))), 0.0), 1.0);
+                keys[e] = (static_cast<uint64_t>(std::llround(weight*16777215.0)) << 40) | static_cast<uint64_t>(e);
+                active[num_active++] = e;
+            }
+            active_ends[v] = num_active;
+        }
+
+        // Parallel Boruvka: each round, every component picks its lightest outgoing edge (by atomic min over
+        // both endpoints of all active edges); the picks are merged through union-find, and edges that became
+        // internal to a component are dropped
+        std::vector<size_t> parent(num_points), component(num_points);
+        for (size_t v = 0; v < num_points; v++) parent[v] = component[v] = v;
+        std::vector<std::atomic<uint64_t>> best(num_points);
+        std::vector<std::pair<size_t,size_t>> tree_edges;
+        tree_edges.reserve(num_points);
+
+        bool merged = true;
+        while (merged) {
+#pragma omp parallel for
+            for (size_t v = 0; v < num_points; v++) {
+                best[v].store(no_edge, std::memory_order_relaxed);
+            }
+
+#pragma omp parallel for schedule (dynamic, 1024)
+            for (size_t v = 0; v < num_points; v++) {
+                const size_t cv = component[v];
+                size_t num_active = offsets[v];
+                for (size_t a = offsets[v]; a < active_ends[v]; a++) {
+                    const size_t e = active[a];
+                    const size_t cu = component[targets[e]];
+                    if (cu == cv) continue;
+                    active[num_active++] = e;
+                    internal::atomicMin(best[cv], keys[e]);
+                    internal::atomicMin(best[cu], keys[e]);
+                }
+                active_ends[v] = num_active;
+            }
+
+            merged = false;
+            for (size_t c = 0; c < num_points; c++) {
+                const uint64_t key = best[c].load(std::memory_order_relaxed);
+                if (component[c] != c || key == no_edge) continue;
+                const size_t e = static_cast<size_t>(key & ((uint64_t(1) << 40) - 1));
+                const size_t v = static_cast<size_t>(std::upper_bound(offsets.begin(), offsets.end(), e) - offsets.begin()) - 1;
+                const size_t rv = internal::findRoot(parent, v), ru = internal::findRoot(parent, targets[e]);
+                // Both components may have picked the same edge
+                if (rv == ru) continue;
+                parent[ru] = rv;
+                tree_edges.emplace_back(v, targets[e]);
+                merged = true;
+            }
+
+            // Flatten (read-only on parent, so safe in parallel once the merges are done)
+#pragma omp parallel for
+            for (size_t v = 0; v < num_points; v++) {
+                size_t r = v;
+                while (parent[r] != r) r = parent[r];
+                component[v] = r;
+            }
+            for (size_t v = 0; v < num_points; v++) parent[v] = component[v];
+        }
+
+        // Tree adjacency (CSR)
+        std::vector<size_t> tree_offsets(num_points + 1, 0);
+        for (size_t t = 0; t < tree_edges.size(); t++) {
+            tree_offsets[tree_edges[t].first + 1]++;
+            tree_offsets[tree_edges[t].second + 1]++;
+        }
+        for (size_t v = 0; v < num_points; v++) tree_offsets[v + 1] += tree_offsets[v];
+        std::vector<size_t> tree_adjacency(tree_offsets[num_points]);
+        std::vector<size_t> fill(tree_offsets.begin(), tree_offsets.end() - 1);
+        for (size_t t = 0; t < tree_edges.size(); t++) {
+            tree_adjacency[fill[tree_edges[t].first]++] = tree_edges[t].second;
+            tree_adjacency[fill[tree_edges[t].second]++] = tree_edges[t].first;
+        }
+
+        // Component roots: valid vertex with the largest last coordinate
+        const size_t none = std::numeric_limits<size_t>::max();
+        std::vector<size_t> root(num_points, none);
+        for (size_t v = 0; v < num_points; v++) {
+            if (!valid[v]) continue;
+            size_t &r = root[component[v]];
+            if (r == none || points(dim - 1, order[v]) > points(dim - 1, order[r])) r = v;
+        }
+
+        // Propagate signs breadth first from each root
+        std::vector<char> visited(num_points, 0);
+        std::vector<size_t> queue;
+        queue.reserve(num_points);
+        for (size_t c = 0; c < num_points; c++) {
+            if (root[c] == none) continue;
+            const size_t r = root[c];
+            if (vertex_normals(dim - 1, r) < (ScalarT)0.0) vertex_normals.col(r) = -vertex_normals.col(r);
+            visited[r] = 1;
+            queue.clear();
+            queue.emplace_back(r);
+            for (size_t q = 0; q < queue.size(); q++) {
+                const size_t v = queue[q];
+                for (size_t a = tree_offsets[v]; a < tree_offsets[v + 1]; a++) {
+                    const size_t u = tree_adjacency[a];
+                    if (visited[u]) continue;
+                    visited[u] = 1;
+                    if (vertex_normals.col(v).dot(vertex_normals.col(u)) < (ScalarT)0.0) vertex_normals.col(u) = -vertex_normals.col(u);
+                    queue.emplace_back(u);
+                }
+            }
+        }
+
+#pragma omp parallel for
+        for (size_t v = 0; v < num_points; v++) {
+            if (valid[v]) normals.col(order[v]) = vertex_normals.col(v);
+        }
+    }
+
+    // As above, on the k-nearest neighbor graph of points (neighborhoods include the point itself)
+    template <typename ScalarT, ptrdiff_t EigenDim, typename CountT = size_t>
+    void orientNormalsMSTKNN(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &points,
+                             CountT k,
+                             VectorSetMatrixMap<ScalarT,EigenDim> normals)
+    {
+        const KDTree<ScalarT,EigenDim,KDTreeDistanceAdaptors::L2> kd_tree(points);
+        typename KDTree<ScalarT,EigenDim,KDTreeDistanceAdaptors::L2>::NeighborhoodSetResult neighbors;
+        kd_tree.searchAll(KNNNeighborhoodSpecification<CountT>(k), neighbors);
+        orientNormalsMST<ScalarT,EigenDim>(points, neighbors, normals);
+    }
+}
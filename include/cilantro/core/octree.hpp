@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <cilantro/core/morton_order.hpp>
+#include <cilantro/core/parallel_sort.hpp>
+#include <cilantro/core/search_tree_base.hpp>
+
+namespace cilantro {
+    // Linear octree over 3D points under the squared L2 metric, with the same search interface as KDTree, plus
+    // axis-aligned box queries and per-node aggregates.
+    // Points are sorted (in parallel) by their 63-bit Morton code over the bounding cube of the data, so every node
+    // is a contiguous range of the sorted points, and the children of a node are found by binary search over the
+    // codes. Nodes live in a single array, with the children of each node stored next to each other.
+    // Every node keeps the point count, centroid and scatter matrix of its points (computed in parallel,
+    // bottom-up), so the nodes that cut the tree at a given depth (see getNodesAtDepth) give a decimated view of
+    // the cloud in time linear in the number of nodes.
+    template <typename ScalarT, typename IndexT = size_t>
+    class Octree : public SearchTreeBase<Octree<ScalarT,IndexT>,ScalarT,3,IndexT> {
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = 3 };
+
+        // Deepest level representable by 63-bit Morton codes
+        enum { MaxDepth = 21 };
+
+        struct Node {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+            // Center of the node's cube (see getHalfSizeAtDepth)
+            Vector<ScalarT,3> center;
+            // Centroid of the node's points, and sum of the outer products of their deviations from it
+            Vector<ScalarT,3> centroid;
+            Eigen::Matrix<ScalarT,3,3> scatter;
+            // The node's points are getPointIndices()[begin..end)
+            size_t begin;
+            size_t end;
+            // Children are nodes [firstChild, firstChild + numChildren)
+            size_t firstChild;
+            size_t numChildren;
+            size_t depth;
+
+            inline size_t getNumberOfPoints() const { return end - begin; }
+
+            inline bool isLeaf() const { return numChildren == 0; }
+
+            // Sample covariance of the node's points (zero for single-point nodes)
+            inline Eigen::Matrix<ScalarT,3,3> getCovariance() const {
+                if (end - begin < 2) return Eigen::Matrix<ScalarT,3,3>::Zero();
+                return (ScalarT(1.0)/static_cast<ScalarT>(end - begin - 1))*scatter;
+            }
+        };
+
+        typedef std::vector<Node,Eigen::aligned_allocator<Node>> NodeSet;
+
+        // Nodes with more than max_leaf_size points are split, up to max_depth (at most MaxDepth)
+        Octree(const ConstVectorSetMatrixMap<ScalarT,3> &data, size_t max_leaf_size = 16, size_t max_depth = MaxDepth)
+                : data_map_(data),
+                  max_leaf_size_(std::max<size_t>(max_leaf_size, 1)),
+                  max_depth_(std::min<size_t>(max_depth, MaxDepth)),
+                  tree_depth_(0)
+        {
+            build_index_();
+        }
+
+        ~Octree() {}
+
+        inline const ConstVectorSetMatrixMap<ScalarT,3>& getPointsMatrixMap() const { return data_map_; }
+
+        inline bool isEmpty() const { return data_map_.cols() == 0; }
+
+        // Depth of the deepest node
+        inline size_t getTreeDepth() const { return tree_depth_; }
+
+        inline size_t getNumberOfNodes() const { return nodes_.size(); }
+
+        inline const NodeSet& getNodes() const { return nodes_; }
+
+        // The root is node 0
+        inline const Node& getNode(size_t node_ind) const { return nodes_[node_ind]; }
+
+        // Point indices in tree order (the points of each node are a contiguous range)
+        inline const std::vector<IndexT>& getPointIndices() const { return point_indices_; }
+
+        inline ScalarT getHalfSizeAtDepth(size_t depth) const { return half_sizes_[depth]; }
+
+        // Nodes at the given depth, plus the shallower leaves, i.e., a partition of the points into the coarsest
+        // nodes that are not above depth
+        const Octree& getNodesAtDepth(size_t depth, std::vector<size_t> &node_inds) const {
+            node_inds.clear();
+            if (!nodes_.empty()) collect_nodes_at_depth_(0, depth, node_inds);
+            return *this;
+        }
+
+        inline std::vector<size_t> getNodesAtDepth(size_t depth) const {
+            std::vector<size_t> node_inds;
+            getNodesAtDepth(depth, node_inds);
+            return node_inds;
+        }
+
+        // Centroids of the nodes returned by getNodesAtDepth (with at least min_points_in_node points)
+        const Octree& getCentroidsAtDepth(size_t depth, VectorSet<ScalarT,3> &centroids, size_t min_points_in_node = 1) const {
+            const std::vector<size_t> node_inds(getNodesAtDepth(depth));
+            centroids.resize(3, node_inds.size());
+            size_t num_centroids = 0;
+            for (size_t i = 0; i < node_inds.size(); i++) {
+                if (nodes_[node_inds[i]].getNumberOfPoints() < min_points_in_node) continue;
+                centroids.col(num_centroids++) = nodes_[node_inds[i]].centroid;
+            }
+            centroids.conservativeResize(Eigen::NoChange, num_centroids);
+            return *this;
+        }
+
+        inline VectorSet<ScalarT,3> getCentroidsAtDepth(size_t depth, size_t min_points_in_node = 1) const {
+            VectorSet<ScalarT,3> centroids;
+            getCentroidsAtDepth(depth, centroids, min_points_in_node);
+            return centroids;
+        }
+
+        // Indices of the points inside the closed box [min_pt, max_pt], in tree order
+        const Octree& boxSearch(const Eigen::Ref<const Vector<ScalarT,3>> &min_pt,
+                                const Eigen::Ref<const Vector<ScalarT,3>> &max_pt,
+                                std::vector<IndexT> &results) const
+        {
+            results.clear();
+            if (!nodes_.empty()) box_search_(0, min_pt, max_pt, results);
+            return *this;
+        }
+
+        inline std::vector<IndexT> boxSearch(const Eigen::Ref<const Vector<ScalarT,3>> &min_pt,
+                                             const Eigen::Ref<const Vector<ScalarT,3>> &max_pt) const
+        {
+            std::vector<IndexT> results;
+            boxSearch(min_pt, max_pt, results);
+            return results;
+        }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            if (nodes_.empty()) return;
+            search_node_(result_set, Eigen::Map<const Vector<ScalarT,3>>(query_pt), 0);
+        }
+
+    private:
+        ConstVectorSetMatrixMap<ScalarT,3> data_map_;
+        size_t max_leaf_size_;
+        size_t max_depth_;
+        size_t tree_depth_;
+
+        // Points in tree order, and their original indices
+        VectorSet<ScalarT,3> points_;
+        std::vector<IndexT> point_indices_;
+
+        NodeSet nodes_;
+        ScalarT half_sizes_[MaxDepth + 1];
+        // Slack for node cube bounds, which absorbs rounding in the assignment of points to cells
+        ScalarT bound_slack_;
+
+        void build_index_() {
+            const size_t num_points = data_map_.cols();
+            std::fill(half_sizes_, half_sizes_ + MaxDepth + 1, (ScalarT)0);
+            bound_slack_ = (ScalarT)0;
+            if (num_points == 0) return;
+
+            const Vector<ScalarT,3> min_pt(data_map_.rowwise().minCoeff());
+            ScalarT size = (data_map_.rowwise().maxCoeff() - min_pt).maxCoeff();
+            if (!(size > (ScalarT)0)) size = (ScalarT)1;
+            for (size_t d = 0; d <= MaxDepth; d++) {
+                half_sizes_[d] = std::ldexp(size, -(int)d - 1);
+            }
+            bound_slack_ = 4*std::numeric_limits<ScalarT>::epsilon()*(size + min_pt.cwiseAbs().maxCoeff());
+
+            const uint64_t num_cells = uint64_t(1) << MaxDepth;
+            const ScalarT scale = static_cast<ScalarT>(num_cells)/size;
+            std::vector<std::pair<uint64_t,IndexT>> sorted(num_points);
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                uint64_t grid_coords[3];
+                for (size_t d = 0; d < 3; d++) {
+                    const ScalarT coord = std::max((data_map_(d,i) - min_pt[d])*scale, (ScalarT)0);
+                    grid_coords[d] = std::min(static_cast<uint64_t>(coord), num_cells - 1);
+                }
+                sorted[i].first = computeMortonCode(grid_coords, 3, MaxDepth);
+                sorted[i].second = static_cast<IndexT>(i);
+            }
+            parallelSort(sorted);
+
+            point_indices_.resize(num_points);
+            points_.resize(3, num_points);
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                point_indices_[i] = sorted[i].second;
+                points_.col(i) = data_map_.col(sorted[i].second);
+            }
+
+            nodes_.resize(1);
+            nodes_[0].center = min_pt + Vector<ScalarT,3>::Constant(half_sizes_[0]);
+            nodes_[0].begin = 0;
+            nodes_[0].end = num_points;
+            nodes_[0].depth = 0;
+            std::vector<std::vector<size_t>> depth_nodes(1, std::vector<size_t>(1, 0));
+            build_children_(0, sorted, depth_nodes);
+            tree_depth_ = depth_nodes.size() - 1;
+
+            // Aggregates, bottom-up; leaves from their points, inner nodes by merging their children
+            for (size_t d = depth_nodes.size(); d > 0; d--) {
+                const std::vector<size_t>& level(depth_nodes[d - 1]);
+#pragma omp parallel for schedule (dynamic, 64)
+                for (size_t i = 0; i < level.size(); i++) {
+                    compute_aggregates_(nodes_[level[i]]);
+                }
+            }
+        }
+
+        void build_children_(size_t node_ind, const std::vector<std::pair<uint64_t,IndexT>> &sorted, std::vector<std::vector<size_t>> &depth_nodes) {
+            // nodes_ grows below, so the node is re-read by index
+            const size_t begin = nodes_[node_ind].begin;
+            const size_t end = nodes_[node_ind].end;
+            const size_t depth = nodes_[node_ind].depth;
+            nodes_[node_ind].firstChild = nodes_.size();
+            nodes_[node_ind].numChildren = 0;
+            if (end - begin <= max_leaf_size_ || depth >= max_depth_) return;
+
+            if (depth_nodes.size() < depth + 2) depth_nodes.resize(depth + 2);
+            const size_t shift = 3*(MaxDepth - depth - 1);
+            const auto octant_less = [shift](size_t octant, const std::pair<uint64_t,IndexT> &p) {
+                return octant < ((p.first >> shift) & 7);
+            };
+            for (size_t child_begin = begin, child_end; child_begin < end; child_begin = child_end) {
+                const size_t octant = (sorted[child_begin].first >> shift) & 7;
+                child_end = std::upper_bound(sorted.begin() + child_begin, sorted.begin() + end, octant, octant_less) - sorted.begin();
+
+                Node child;
+                for (size_t d = 0; d < 3; d++) {
+                    const ScalarT offset = ((octant >> (2 - d)) & 1) ? half_sizes_[depth + 1] : -half_sizes_[depth + 1];
+                    child.center[d] = nodes_[node_ind].center[d] + offset;
+                }
+                child.begin = child_begin;
+                child.end = child_end;
+                child.depth = depth + 1;
+                depth_nodes[depth + 1].emplace_back(nodes_.size());
+                nodes_.emplace_back(child);
+                nodes_[node_ind].numChildren++;
+            }
+
+            const size_t first_child = nodes_[node_ind].firstChild;
+            const size_t num_children = nodes_[node_ind].numChildren;
+            for (size_t c = first_child; c < first_child + num_children; c++) {
+                build_children_(c, sorted, depth_nodes);
+            }
+        }
+
+        void compute_aggregates_(Node &node) const {
+            if (node.isLeaf()) {
+                const auto node_points(points_.middleCols(node.begin, node.end - node.begin));
+                node.centroid = node_points.rowwise().mean();
+                node.scatter.setZero();
+                for (size_t i = 0; i < node_points.cols(); i++) {
+                    const Vector<ScalarT,3> diff(node_points.col(i) - node.centroid);
+                    node.scatter.noalias() += diff*diff.transpose();
+                }
+                return;
+            }
+
+            // Pairwise combination of centroids and scatter matrices
+            const Node& first(nodes_[node.firstChild]);
+            size_t count = first.getNumberOfPoints();
+            node.centroid = first.centroid;
+            node.scatter = first.scatter;
+            for (size_t c = node.firstChild + 1; c < node.firstChild + node.numChildren; c++) {
+                const Node& child(nodes_[c]);
+                const size_t child_count = child.getNumberOfPoints();
+                const Vector<ScalarT,3> delta(child.centroid - node.centroid);
+                const ScalarT weight = static_cast<ScalarT>(child_count)/static_cast<ScalarT>(count + child_count);
+                node.centroid += weight*delta;
+                node.scatter += child.scatter + (weight*static_cast<ScalarT>(count))*delta*delta.transpose();
+                count += child_count;
+            }
+        }
+
+        // Squared distance from pt to the (closed) cube of a node at the given depth
+        inline ScalarT get_cube_distance_(const Eigen::Map<const Vector<ScalarT,3>> &pt, const Vector<ScalarT,3> &center, size_t depth) const {
+            const ScalarT half_size = half_sizes_[depth] + bound_slack_;
+            ScalarT dist = (ScalarT)0;
+            for (size_t d = 0; d < 3; d++) {
+                const ScalarT diff = std::max(std::abs(pt[d] - center[d]) - half_size, (ScalarT)0);
+                dist += diff*diff;
+            }
+            return dist;
+        }
+
+        template <class ResultSetT>
+        bool search_node_(ResultSetT &result_set, const Eigen::Map<const Vector<ScalarT,3>> &query, size_t node_ind) const {
+            const Node& node(nodes_[node_ind]);
+            if (node.isLeaf()) {
+                for (size_t i = node.begin; i < node.end; i++) {
+                    const ScalarT dist = (points_.col(i) - query).squaredNorm();
+                    if (dist < result_set.worstDist() && !result_set.addPoint(dist, point_indices_[i])) return false;
+                }
+                return true;
+            }
+
+            // Children in order of distance to their cubes
+            ScalarT child_dists[8];
+            size_t child_order[8];
+            for (size_t c = 0; c < node.numChildren; c++) {
+                const ScalarT dist = get_cube_distance_(query, nodes_[node.firstChild + c].center, node.depth + 1);
+                size_t pos = c;
+                while (pos > 0 && child_dists[pos - 1] > dist) {
+                    child_dists[pos] = child_dists[pos - 1];
+                    child_order[pos] = child_order[pos - 1];
+                    pos--;
+                }
+                child_dists[pos] = dist;
+                child_order[pos] = node.firstChild + c;
+            }
+            for (size_t c = 0; c < node.numChildren; c++) {
+                if (child_dists[c] >= result_set.worstDist()) break;
+                if (!search_node_(result_set, query, child_order[c])) return false;
+            }
+            return true;
+        }
+
+        void box_search_(size_t node_ind, const Eigen::Ref<const Vector<ScalarT,3>> &min_pt,
+                         const Eigen::Ref<const Vector<ScalarT,3>> &max_pt, std::vector<IndexT> &results) const
+        {
+            const Node& node(nodes_[node_ind]);
+            const ScalarT half_size = half_sizes_[node.depth] + bound_slack_;
+            bool contained = true;
+            for (size_t d = 0; d < 3; d++) {
+                if (node.center[d] + half_size < min_pt[d] || node.center[d] - half_size > max_pt[d]) return;
+                if (node.center[d] - half_size < min_pt[d] || node.center[d] + half_size > max_pt[d]) contained = false;
+            }
+
+            if (contained) {
+                results.insert(results.end(), point_indices_.begin() + node.begin, point_indices_.begin() + node.end);
+            } else if (node.isLeaf()) {
+                for (size_t i = node.begin; i < node.end; i++) {
+                    if ((points_.col(i).array() >= min_pt.array()).all() && (points_.col(i).array() <= max_pt.array()).all()) {
+                        results.emplace_back(point_indices_[i]);
+                    }
+                }
+            } else {
+                for (size_t c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+                    box_search_(c, min_pt, max_pt, results);
+                }
+            }
+        }
+
+        void collect_nodes_at_depth_(size_t node_ind, size_t depth, std::vector<size_t> &node_inds) const {
+            const Node& node(nodes_[node_ind]);
+            if (node.depth >= depth || node.isLeaf()) {
+                node_inds.emplace_back(node_ind);
+                return;
+            }
+            for (size_t c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+                collect_nodes_at_depth_(c, depth, node_inds);
+            }
+        }
+    };
+
+    template <typename IndexT = size_t>
+    using Octreef = Octree<float,IndexT>;
+
+    template <typename IndexT = size_t>
+    using Octreed = Octree<double,IndexT>;
+}
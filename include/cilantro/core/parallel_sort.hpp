@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+namespace cilantro {
+    // Sorts values in ascending order: chunks are sorted in parallel and then merged pairwise, also in parallel
+    template <typename T>
+    void parallelSort(std::vector<T> &values, size_t chunk_size = 1 << 16) {
+        const size_t num_values = values.size();
+        const size_t num_chunks = (num_values + chunk_size - 1)/chunk_size;
+#pragma omp parallel for schedule (dynamic)
+        for (size_t c = 0; c < num_chunks; c++) {
+            std::sort(values.begin() + c*chunk_size, values.begin() + std::min((c + 1)*chunk_size, num_values));
+        }
+        if (num_chunks < 2) return;
+
+        std::vector<T> merged(num_values);
+        for (size_t width = chunk_size; width < num_values; width *= 2) {
+            const size_t num_pairs = (num_values + 2*width - 1)/(2*width);
+#pragma omp parallel for shared (values, merged) schedule (dynamic)
+            for (size_t p = 0; p < num_pairs; p++) {
+                const size_t begin = p*2*width;
+                const size_t mid = std::min(begin + width, num_values);
+                const size_t end = std::min(begin + 2*width, num_values);
+                std::merge(values.begin() + begin, values.begin() + mid, values.begin() + mid, values.begin() + end, merged.begin() + begin);
+            }
+            values.swap(merged);
+        }
+    }
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <cilantro/core/search_tree_base.hpp>
+
+namespace cilantro {
+    // Compact, self-contained KD-tree for low-dimensional (2D/3D) points under the squared L2 metric, for clouds
+    // too large to keep both a full-precision copy of the points and a KDTree over them. Points are stored in tree
+    // order as 16-bit fixed-point coordinates relative to the bounding box of their leaf, with 32-bit indices by
+    // default, i.e., 2*EigenDim + 4 bytes per point, plus about 2 bytes per point of nodes and leaf frames with
+    // the default leaf size. The tree does not refer to the input data after construction, so the data may be
+    // released: for 1M random 3D floats, the tree takes about 12 bytes per point in total, against about 13.5 for
+    // KDTree<float,3,L2,uint32_t> plus the 12 bytes per point of the data it searches.
+    // Searches are approximate: distances are evaluated on the dequantized points, whose coordinates are within
+    // half a quantization step (1/65535 of the leaf's extent along that dimension) of the original ones.
+    // Nodes are split at the median of their widest dimension and are stored in depth-first order as in
+    // ImplicitKDTree. Supports up to 2^31 points (fewer if IndexT is narrower); larger inputs leave the tree empty.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = uint32_t>
+    class QuantizedKDTree : public SearchTreeBase<QuantizedKDTree<ScalarT,EigenDim,IndexT>,ScalarT,EigenDim,IndexT> {
+        static_assert(EigenDim != Eigen::Dynamic, "QuantizedKDTree requires a compile-time dimension");
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        // Upper bound for max_leaf_size (leaf distance buffers live on the stack)
+        enum { MaxLeafSize = 64 };
+
+        QuantizedKDTree(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t max_leaf_size = 32)
+                : max_leaf_size_(std::min<size_t>(std::max<size_t>(max_leaf_size, 1), MaxLeafSize))
+        {
+            const size_t num_points = data.cols();
+            if (num_points == 0 || num_points > max_num_points_()) return;
+
+            point_indices_.resize(num_points);
+            for (size_t i = 0; i < num_points; i++) {
+                point_indices_[i] = static_cast<IndexT>(i);
+            }
+
+            bbox_min_ = data.rowwise().minCoeff();
+            bbox_max_ = data.rowwise().maxCoeff();
+
+#pragma omp parallel if (num_points >= 2*parallel_build_min_subtree_size_)
+#pragma omp single
+            build_subtree_(data, 0, num_points, nodes_);
+
+            std::vector<std::pair<size_t,size_t>> leaf_ranges;
+            number_leaves_(0, 0, num_points, leaf_ranges);
+            leaf_frames_.resize(leaf_ranges.size());
+            codes_.resize(num_points, EigenDim);
+#pragma omp parallel for
+            for (size_t l = 0; l < leaf_ranges.size(); l++) {
+                quantize_leaf_(data, l, leaf_ranges[l].first, leaf_ranges[l].second);
+            }
+        }
+
+        ~QuantizedKDTree() {}
+
+        inline bool isEmpty() const { return nodes_.empty(); }
+
+        inline size_t getNumberOfPoints() const { return point_indices_.size(); }
+
+        // Dequantized points, in original index order
+        VectorSet<ScalarT,EigenDim> getPoints() const {
+            VectorSet<ScalarT,EigenDim> points(EigenDim, point_indices_.size());
+            std::vector<std::pair<size_t,size_t>> leaf_ranges;
+            if (!nodes_.empty()) collect_leaf_ranges_(0, 0, point_indices_.size(), leaf_ranges);
+#pragma omp parallel for shared (points)
+            for (size_t l = 0; l < leaf_ranges.size(); l++) {
+                const LeafFrame& frame(leaf_frames_[l]);
+                for (size_t i = leaf_ranges[l].first; i < leaf_ranges[l].second; i++) {
+                    for (size_t d = 0; d < EigenDim; d++) {
+                        points(d,point_indices_[i]) = codes_(i,d)*frame.step[d] + frame.origin[d];
+                    }
+                }
+            }
+            return points;
+        }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        inline void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            if (nodes_.empty()) return;
+            ScalarT offsets[EigenDim];
+            ScalarT min_dist = (ScalarT)0;
+            for (size_t d = 0; d < EigenDim; d++) {
+                const ScalarT diff = std::max(bbox_min_[d] - query_pt[d], std::max(query_pt[d] - bbox_max_[d], (ScalarT)0));
+                offsets[d] = diff*diff;
+                min_dist += offsets[d];
+            }
+            search_subtree_(result_set, query_pt, 0, 0, point_indices_.size(), min_dist, offsets);
+        }
+
+    private:
+        struct Node {
+            // Largest coordinate of the left subtree and smallest coordinate of the right subtree along splitDimension
+            ScalarT leftMax;
+            ScalarT rightMin;
+            // Offset from this node to its right child; 0 for leaves
+            uint32_t rightChildOffset;
+            // Position (in tree order) of the first point of the right subtree; for leaves, position in leaf_frames_
+            uint32_t splitIndex;
+            int splitDimension;
+        };
+
+        // Point d-th coordinates in a leaf are origin[d] + code*step[d]
+        struct LeafFrame {
+            ScalarT origin[EigenDim];
+            ScalarT step[EigenDim];
+        };
+
+        // Subtrees with at least this many points are split into two parallel tasks
+        static const size_t parallel_build_min_subtree_size_ = 8192;
+
+        static const uint16_t max_code_ = std::numeric_limits<uint16_t>::max();
+
+        // A tree over n points has fewer than 2n nodes, so right child offsets and split indices (uint32_t) fit
+        // for n <= 2^31
+        static inline size_t max_num_points_() {
+            return static_cast<size_t>(std::min<uint64_t>(uint64_t(1) << 31, static_cast<uint64_t>(std::numeric_limits<IndexT>::max())));
+        }
+
+        size_t max_leaf_size_;
+        std::vector<Node> nodes_;
+        std::vector<LeafFrame> leaf_frames_;
+        // Original index of each point, in tree order
+        std::vector<IndexT> point_indices_;
+        // Quantized points in tree order, one contiguous column per coordinate
+        Eigen::Matrix<uint16_t,Eigen::Dynamic,EigenDim> codes_;
+        Vector<ScalarT,EigenDim> bbox_min_;
+        Vector<ScalarT,EigenDim> bbox_max_;
+
+        // Appends the subtree over point_indices_[left, right) to nodes in depth-first order.
+        // Child offsets are relative, so subtrees built by separate tasks are concatenated without fix-ups.
+        void build_subtree_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t left, size_t right, std::vector<Node> &nodes) {
+            const size_t node = nodes.size();
+            nodes.emplace_back();
+            nodes[node].rightChildOffset = 0;
+            if (right - left <= max_leaf_size_) return;
+
+            Vector<ScalarT,EigenDim> min_pt(data.col(point_indices_[left]));
+            Vector<ScalarT,EigenDim> max_pt(min_pt);
+            for (size_t i = left + 1; i < right; i++) {
+                min_pt = min_pt.cwiseMin(data.col(point_indices_[i]));
+                max_pt = max_pt.cwiseMax(data.col(point_indices_[i]));
+            }
+            int cut_dim;
+            (max_pt - min_pt).maxCoeff(&cut_dim);
+
+            const size_t mid = left + (right - left)/2;
+            const auto coord_less = [&data,cut_dim](IndexT i, IndexT j) {
+                return data(cut_dim,i) < data(cut_dim,j);
+            };
+            std::nth_element(point_indices_.begin() + left, point_indices_.begin() + mid, point_indices_.begin() + right, coord_less);
+            // Children reorder their ranges, so bounds are read first
+            const ScalarT right_min = data(cut_dim,point_indices_[mid]);
+            ScalarT left_max = data(cut_dim,point_indices_[left]);
+            for (size_t i = left + 1; i < mid; i++) {
+                left_max = std::max(left_max, data(cut_dim,point_indices_[i]));
+            }
+
+            if (right - left >= parallel_build_min_subtree_size_) {
+                std::vector<Node> left_nodes;
+#pragma omp task shared (left_nodes)
+                build_subtree_(data, left, mid, left_nodes);
+                std::vector<Node> right_nodes;
+                build_subtree_(data, mid, right, right_nodes);
+#pragma omp taskwait
+                nodes.insert(nodes.end(), left_nodes.begin(), left_nodes.end());
+                nodes[node].rightChildOffset = static_cast<uint32_t>(nodes.size() - node);
+                nodes.insert(nodes.end(), right_nodes.begin(), right_nodes.end());
+            } else {
+                build_subtree_(data, left, mid, nodes);
+                nodes[node].rightChildOffset = static_cast<uint32_t>(nodes.size() - node);
+                build_subtree_(data, mid, right, nodes);
+            }
+
+            nodes[node].leftMax = left_max;
+            nodes[node].rightMin = right_min;
+            nodes[node].splitIndex = static_cast<uint32_t>(mid);
+            nodes[node].splitDimension = cut_dim;
+        }
+
+        void number_leaves_(size_t node, size_t left, size_t right, std::vector<std::pair<size_t,size_t>> &leaf_ranges) {
+            if (nodes_[node].rightChildOffset == 0) {
+                nodes_[node].splitIndex = static_cast<uint32_t>(leaf_ranges.size());
+                leaf_ranges.emplace_back(left, right);
+                return;
+            }
+            const size_t mid = nodes_[node].splitIndex;
+            number_leaves_(node + 1, left, mid, leaf_ranges);
+            number_leaves_(node + nodes_[node].rightChildOffset, mid, right, leaf_ranges);
+        }
+
+        // Leaf ranges of point_indices_, in leaf number order
+        void collect_leaf_ranges_(size_t node, size_t left, size_t right, std::vector<std::pair<size_t,size_t>> &leaf_ranges) const {
+            if (nodes_[node].rightChildOffset == 0) {
+                leaf_ranges.emplace_back(left, right);
+                return;
+            }
+            const size_t mid = nodes_[node].splitIndex;
+            collect_leaf_ranges_(node + 1, left, mid, leaf_ranges);
+            collect_leaf_ranges_(node + nodes_[node].rightChildOffset, mid, right, leaf_ranges);
+        }
+
+        void quantize_leaf_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, size_t leaf, size_t left, size_t right) {
+            Vector<ScalarT,EigenDim> min_pt(data.col(point_indices_[left]));
+            Vector<ScalarT,EigenDim> max_pt(min_pt);
+            for (size_t i = left + 1; i < right; i++) {
+                min_pt = min_pt.cwiseMin(data.col(point_indices_[i]));
+                max_pt = max_pt.cwiseMax(data.col(point_indices_[i]));
+            }
+
+            LeafFrame& frame(leaf_frames_[leaf]);
+            for (size_t d = 0; d < EigenDim; d++) {
+                frame.origin[d] = min_pt[d];
+                frame.step[d] = (max_pt[d] - min_pt[d])/max_code_;
+                const ScalarT scale = (frame.step[d] > (ScalarT)0) ? (ScalarT)1/frame.step[d] : (ScalarT)0;
+                for (size_t i = left; i < right; i++) {
+                    const ScalarT code = std::round((data(d,point_indices_[i]) - frame.origin[d])*scale);
+                    codes_(i,d) = static_cast<uint16_t>(std::min(std::max(code, (ScalarT)0), (ScalarT)max_code_));
+                }
+            }
+        }
+
+        // offsets holds per-dimension squared distances from query_pt to the cell of node (a lower bound),
+        // and min_dist their sum. Returns false if result_set stopped the search.
+        template <class ResultSetT>
+        bool search_subtree_(ResultSetT &result_set, const ScalarT *query_pt, size_t node, size_t left, size_t right,
+                             ScalarT min_dist, ScalarT *offsets) const
+        {
+            const Node& split(nodes_[node]);
+            if (split.rightChildOffset == 0) return search_leaf_(result_set, query_pt, split.splitIndex, left, right);
+
+            const size_t mid = split.splitIndex;
+            const ScalarT diff_left = query_pt[split.splitDimension] - split.leftMax;
+            const ScalarT diff_right = query_pt[split.splitDimension] - split.rightMin;
+            const bool left_first = diff_left + diff_right < (ScalarT)0;
+
+            bool proceed;
+            if (left_first) {
+                proceed = search_subtree_(result_set, query_pt, node + 1, left, mid, min_dist, offsets);
+            } else {
+                proceed = search_subtree_(result_set, query_pt, node + split.rightChildOffset, mid, right, min_dist, offsets);
+            }
+            if (!proceed) return false;
+
+            const ScalarT cut_dist = left_first ? diff_right*diff_right : diff_left*diff_left;
+            const ScalarT prev_offset = offsets[split.splitDimension];
+            const ScalarT far_dist = min_dist - prev_offset + cut_dist;
+            if (far_dist < result_set.worstDist()) {
+                offsets[split.splitDimension] = cut_dist;
+                if (left_first) {
+                    proceed = search_subtree_(result_set, query_pt, node + split.rightChildOffset, mid, right, far_dist, offsets);
+                } else {
+                    proceed = search_subtree_(result_set, query_pt, node + 1, left, mid, far_dist, offsets);
+                }
+                offsets[split.splitDimension] = prev_offset;
+            }
+            return proceed;
+        }
+
+        // Distances to the dequantized points of a leaf
+        template <class ResultSetT>
+        inline bool search_leaf_(ResultSetT &result_set, const ScalarT *query_pt, size_t leaf, size_t left, size_t right) const {
+            const LeafFrame& frame(leaf_frames_[leaf]);
+            const size_t len = right - left;
+            Eigen::Array<ScalarT,Eigen::Dynamic,1,Eigen::ColMajor,MaxLeafSize,1> dists(len);
+            dists.setZero();
+            for (size_t d = 0; d < EigenDim; d++) {
+                dists += (codes_.col(d).segment(left, len).template cast<ScalarT>().array()*frame.step[d] + (frame.origin[d] - query_pt[d])).square();
+            }
+
+            ScalarT worst_dist = result_set.worstDist();
+            for (size_t i = 0; i < len; i++) {
+                if (dists[i] < worst_dist) {
+                    if (!result_set.addPoint(dists[i], point_indices_[left + i])) return false;
+                    worst_dist = result_set.worstDist();
+                }
+            }
+            return true;
+        }
+    };
+
+    template <typename IndexT = uint32_t>
+    using QuantizedKDTree2f = QuantizedKDTree<float,2,IndexT>;
+
+    template <typename IndexT = uint32_t>
+    using QuantizedKDTree2d = QuantizedKDTree<double,2,IndexT>;
+
+    template <typename IndexT = uint32_t>
+    using QuantizedKDTree3f = QuantizedKDTree<float,3,IndexT>;
+
+    template <typename IndexT = uint32_t>
+    using QuantizedKDTree3d = QuantizedKDTree<double,3,IndexT>;
+}
@@ -0,0 +1,861 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <cilantro/core/data_containers.hpp>
+#include <cilantro/core/nearest_neighbors.hpp>
+#include <cilantro/core/morton_order.hpp>
+
+namespace cilantro {
+    template <typename ScalarT, typename IndexT = size_t, typename CountT = size_t>
+    class KNNSearchResultAdaptor {
+    public:
+        typedef ScalarT DistanceType;
+        typedef IndexT IndexType;
+
+        KNNSearchResultAdaptor(Neighborhood<ScalarT,IndexT> &results, CountT k, ScalarT max_radius = std::numeric_limits<ScalarT>::max())
+                : k_(k), count_(0)
+        {
+            results.resize(k_);
+            results_ = results.data();
+            results_[k_-1].value = max_radius;
+        }
+
+        // Writes into an external buffer of (at least) k neighbors
+        KNNSearchResultAdaptor(Neighbor<ScalarT,IndexT> *results, CountT k, ScalarT max_radius = std::numeric_limits<ScalarT>::max())
+                : results_(results), k_(k), count_(0)
+        {
+            results_[k_-1].value = max_radius;
+        }
+
+        inline CountT size() const { return count_; }
+
+        inline bool full() const { return count_ == k_; }
+
+        inline bool addPoint(ScalarT dist, IndexT index) {
+            CountT i;
+            for (i = count_; i > 0; --i) {
+                if (results_[i-1].value > dist) {
+                    if (i < k_) {
+                        results_[i].index = results_[i-1].index;
+                        results_[i].value = results_[i-1].value;
+                    }
+                } else {
+                    break;
+                }
+            }
+            if (i < k_) {
+                results_[i].index = index;
+                results_[i].value = dist;
+            }
+            if (count_ < k_) count_++;
+
+            return true;
+        }
+
+        inline ScalarT worstDist() const { return results_[k_-1].value; }
+
+    private:
+        Neighbor<ScalarT,IndexT> *results_;
+        const CountT k_;
+        CountT count_;
+    };
+
+
+    // kNN result set for large k: keeps the k best candidates in a max-heap (by distance) in an external buffer
+    // of (at least) k neighbors, so accepting a candidate costs O(log k) instead of the O(k) of the insertion
+    // sort in KNNSearchResultAdaptor. Results are in heap order until sort() is called.
+    template <typename ScalarT, typename IndexT = size_t, typename CountT = size_t>
+    class KNNHeapSearchResultAdaptor {
+    public:
+        typedef ScalarT DistanceType;
+        typedef IndexT IndexType;
+
+        KNNHeapSearchResultAdaptor(Neighbor<ScalarT,IndexT> *results, CountT k, ScalarT max_radius = std::numeric_limits<ScalarT>::max())
+                : results_(results), k_(k), count_(0), max_radius_(max_radius)
+        {}
+
+        inline CountT size() const { return count_; }
+
+        inline bool full() const { return count_ == k_; }
+
+        inline bool addPoint(ScalarT dist, IndexT index) {
+            if (dist >= worstDist()) return true;
+            CountT i;
+            if (count_ < k_) {
+                // Sift up from the new leaf
+                for (i = count_++; i > 0 && results_[(i-1)/2].value < dist; i = (i-1)/2) {
+                    results_[i] = results_[(i-1)/2];
+                }
+            } else {
+                // Replace the root and sift down
+                i = 0;
+                for (CountT child = 1; child < k_; child = 2*i + 1) {
+                    if (child + 1 < k_ && results_[child].value < results_[child + 1].value) child++;
+                    if (results_[child].value <= dist) break;
+                    results_[i] = results_[child];
+                    i = child;
+                }
+            }
+            results_[i].index = index;
+            results_[i].value = dist;
+            return true;
+        }
+
+        inline ScalarT worstDist() const { return (count_ < k_) ? max_radius_ : results_[0].value; }
+
+        // Orders the results by increasing distance
+        inline void sort() {
+            std::sort_heap(results_, results_ + count_, typename Neighbor<ScalarT,IndexT>::ValueLessComparator());
+        }
+
+    private:
+        Neighbor<ScalarT,IndexT> *results_;
+        const CountT k_;
+        CountT count_;
+        const ScalarT max_radius_;
+    };
+
+    template <typename ScalarT, typename IndexT = size_t, typename CountT = size_t>
+    class RadiusSearchResultAdaptor {
+    public:
+        typedef ScalarT DistanceType;
+        typedef IndexT IndexType;
+
+        RadiusSearchResultAdaptor(Neighborhood<ScalarT,IndexT> &results, ScalarT radius)
+                : results_(results), radius_(radius)
+        {
+            results_.clear();
+        }
+
+        inline CountT size() const { return results_.size(); }
+
+        inline bool full() const { return true; }
+
+        inline bool addPoint(ScalarT dist, IndexT index) {
+            // dist < worstDist() is guaranteed when addPoint is called.
+            results_.emplace_back(index, dist);
+            return true;
+        }
+
+        inline ScalarT worstDist() const { return radius_; }
+
+    private:
+        Neighborhood<ScalarT,IndexT>& results_;
+        const ScalarT radius_;
+    };
+
+    // Counts the neighbors within radius without storing them (at most max_count), and stops the search once
+    // max_count of them have been found: addPoint returns false, worstDist() drops below any distance so that
+    // remaining subtrees are pruned, and done() tells structures that search several trees to stop
+    template <typename ScalarT, typename IndexT = size_t, typename CountT = size_t>
+    class RadiusCountResultAdaptor {
+    public:
+        typedef ScalarT DistanceType;
+        typedef IndexT IndexType;
+
+        RadiusCountResultAdaptor(ScalarT radius, CountT max_count = std::numeric_limits<CountT>::max())
+                : radius_(radius), max_count_(max_count), count_(0)
+        {}
+
+        inline CountT size() const { return count_; }
+
+        inline bool full() const { return true; }
+
+        inline bool done() const { return count_ >= max_count_; }
+
+        inline bool addPoint(ScalarT, IndexT) {
+            if (count_ < max_count_) count_++;
+            return count_ < max_count_;
+        }
+
+        inline ScalarT worstDist() const { return (count_ < max_count_) ? radius_ : (ScalarT)(-1); }
+
+    private:
+        const ScalarT radius_;
+        const CountT max_count_;
+        CountT count_;
+    };
+
+    // Hands every neighbor within radius to visitor(index, dist) as soon as the search structure finds it,
+    // instead of storing it; neighbors are visited in traversal order.
+    template <typename ScalarT, typename IndexT, class VisitorT, typename CountT = size_t>
+    class VisitorSearchResultAdaptor {
+    public:
+        typedef ScalarT DistanceType;
+        typedef IndexT IndexType;
+
+        VisitorSearchResultAdaptor(VisitorT &visitor, ScalarT radius)
+                : visitor_(visitor), radius_(radius), count_(0)
+        {}
+
+        inline CountT size() const { return count_; }
+
+        inline bool full() const { return true; }
+
+        inline bool addPoint(ScalarT dist, IndexT index) {
+            visitor_(index, dist);
+            count_++;
+            return true;
+        }
+
+        inline ScalarT worstDist() const { return radius_; }
+
+    private:
+        VisitorT& visitor_;
+        const ScalarT radius_;
+        CountT count_;
+    };
+
+    namespace internal {
+        // True if result_set reports that the search can stop (result sets with a done() method)
+        template <class ResultSetT>
+        inline auto resultSetDone(const ResultSetT &result_set, int) -> decltype(result_set.done()) {
+            return result_set.done();
+        }
+
+        template <class ResultSetT>
+        inline bool resultSetDone(const ResultSetT &, long) { return false; }
+    } // namespace internal
+
+    // CRTP base for spatial search structures.
+    // Derived classes implement findNeighbors(result_set, query_pt_data), which feeds every candidate closer
+    // than result_set.worstDist() to result_set.addPoint(dist, index) (nanoflann result set protocol);
+    // all single/batch, kNN/radius/kNN-in-radius and NeighborhoodSpecification based searches are built on it.
+    // The *Visit variants pass each neighbor to a functor instead of returning neighborhoods, so that callers
+    // that only reduce neighborhoods (weighted sums, moments, counts) do not allocate per query.
+    template <class Derived, typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t>
+    class SearchTreeBase {
+    public:
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        inline Derived& derived() { return *static_cast<Derived *>(this); }
+
+        inline const Derived& derived() const { return *static_cast<const Derived *>(this); }
+
+        // If enabled, batch searches process queries in Morton (Z-order) curve order, so that consecutive
+        // queries (and the blocks assigned to each thread) traverse the same tree nodes and touch the same
+        // points; results are still returned in input order. Pays off for large, spatially unordered query sets.
+        inline Derived& setSpatialQueryOrdering(bool enabled) {
+            spatial_query_ordering_ = enabled;
+            return derived();
+        }
+
+        inline bool getSpatialQueryOrdering() const { return spatial_query_ordering_; }
+
+        // kNN and kNN-in-radius searches with k at least this large collect candidates in a heap
+        // (KNNHeapSearchResultAdaptor) instead of an insertion-sorted array
+        inline Derived& setKNNHeapThreshold(size_t k) {
+            knn_heap_threshold_ = k;
+            return derived();
+        }
+
+        inline size_t getKNNHeapThreshold() const { return knn_heap_threshold_; }
+
+        // If disabled, heap-collected kNN results (see setKNNHeapThreshold) are returned in arbitrary order,
+        // saving the final O(k log k) sort; results for smaller k are always sorted
+        inline Derived& setKNNResultSorting(bool enabled) {
+            knn_result_sorting_ = enabled;
+            return derived();
+        }
+
+        inline bool getKNNResultSorting() const { return knn_result_sorting_; }
+
+        // Do not call if tree is empty!
+        inline const Derived& nearestNeighborSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                                    NeighborResult &result) const
+        {
+            KNNSearchResultAdaptor<ScalarT,IndexT,size_t> sra(&result, 1);
+            derived().findNeighbors(sra, query_pt.data());
+            return derived();
+        }
+
+        // Do not call if tree is empty!
+        inline NeighborResult nearestNeighborSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt) const
+        {
+            NeighborResult result;
+            nearestNeighborSearch(query_pt, result);
+            return result;
+        }
+
+        // Do not call if tree is empty!
+        const Derived& nearestNeighborSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                             NeighborhoodResult &results) const
+        {
+            results.resize(query_pts.cols());
+            const std::vector<size_t> order(get_query_order_(query_pts));
+#pragma omp parallel for shared (results, order)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                nearestNeighborSearch(query_pts.col(i), results[i]);
+            }
+            return derived();
+        }
+
+        // Do not call if tree is empty!
+        // Unlike the other batch searches, this one returns a flat vector of Neighbor
+        inline NeighborhoodResult nearestNeighborSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts) const {
+            NeighborhoodResult results;
+            nearestNeighborSearch(query_pts, results);
+            return results;
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& kNNSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                        CountT k,
+                                        NeighborhoodResult &results) const
+        {
+            results.resize(k);
+            results.resize(knn_search_(query_pt.data(), k, std::numeric_limits<ScalarT>::max(), results.data()));
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline NeighborhoodResult kNNSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                            CountT k) const
+        {
+            NeighborhoodResult results;
+            kNNSearch(query_pt, k, results);
+            return results;
+        }
+
+        template <typename CountT = size_t>
+        const Derived& kNNSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                 CountT k,
+                                 NeighborhoodSetResult &results) const
+        {
+            derived().knn_batch_search_(query_pts, k, std::numeric_limits<ScalarT>::max(), results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline NeighborhoodSetResult kNNSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                               CountT k) const
+        {
+            NeighborhoodSetResult results;
+            kNNSearch(query_pts, k, results);
+            return results;
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& kNNSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                        CountT k,
+                                        FlatNeighborhoodSetResult &results) const
+        {
+            derived().knn_batch_search_(query_pts, k, std::numeric_limits<ScalarT>::max(), results);
+            return derived();
+        }
+
+        inline const Derived& radiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                           ScalarT radius,
+                                           NeighborhoodResult &results) const
+        {
+            RadiusSearchResultAdaptor<ScalarT,IndexT,size_t> sra(results, radius);
+            derived().findNeighbors(sra, query_pt.data());
+            std::sort(results.begin(), results.end(), typename NeighborResult::ValueLessComparator());
+            return derived();
+        }
+
+        inline NeighborhoodResult radiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                               ScalarT radius) const
+        {
+            NeighborhoodResult results;
+            radiusSearch(query_pt, radius, results);
+            return results;
+        }
+
+        const Derived& radiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                    ScalarT radius,
+                                    NeighborhoodSetResult &results) const
+        {
+            results.resize(query_pts.cols());
+            const std::vector<size_t> order(get_query_order_(query_pts));
+#pragma omp parallel for shared (results, order)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                radiusSearch(query_pts.col(i), radius, results[i]);
+            }
+            return derived();
+        }
+
+        inline NeighborhoodSetResult radiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                                  ScalarT radius) const
+        {
+            NeighborhoodSetResult results;
+            radiusSearch(query_pts, radius, results);
+            return results;
+        }
+
+        inline const Derived& radiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                           ScalarT radius,
+                                           FlatNeighborhoodSetResult &results) const
+        {
+            // nn is captured by value; every thread works on its own copy of the functor
+            NeighborhoodResult nn;
+            flat_batch_search_(query_pts, results, [this,radius,nn](const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt, NeighborhoodResult &block_nn) mutable {
+                radiusSearch(query_pt, radius, nn);
+                block_nn.insert(block_nn.end(), nn.begin(), nn.end());
+            });
+            return derived();
+        }
+
+        // Number of neighbors of query_pt within radius, capped at max_count (the search stops there)
+        template <typename CountT = size_t>
+        inline CountT radiusCount(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                  ScalarT radius,
+                                  CountT max_count = std::numeric_limits<CountT>::max()) const
+        {
+            if (max_count == 0) return 0;
+            RadiusCountResultAdaptor<ScalarT,IndexT,CountT> sra(radius, max_count);
+            derived().findNeighbors(sra, query_pt.data());
+            return sra.size();
+        }
+
+        template <typename CountT = size_t>
+        const Derived& radiusCount(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                   ScalarT radius,
+                                   std::vector<CountT> &counts,
+                                   CountT max_count = std::numeric_limits<CountT>::max()) const
+        {
+            counts.resize(query_pts.cols());
+            const std::vector<size_t> order(get_query_order_(query_pts));
+#pragma omp parallel for shared (counts, order)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                counts[i] = radiusCount(query_pts.col(i), radius, max_count);
+            }
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline std::vector<CountT> radiusCount(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                               ScalarT radius,
+                                               CountT max_count = std::numeric_limits<CountT>::max()) const
+        {
+            std::vector<CountT> counts;
+            radiusCount(query_pts, radius, counts, max_count);
+            return counts;
+        }
+
+        // Whether query_pt has any neighbor within radius; the search stops at the first one found
+        inline bool radiusAny(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt, ScalarT radius) const {
+            return radiusCount<size_t>(query_pt, radius, 1) > 0;
+        }
+
+        const Derived& radiusAny(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                 ScalarT radius,
+                                 std::vector<char> &results) const
+        {
+            results.resize(query_pts.cols());
+            const std::vector<size_t> order(get_query_order_(query_pts));
+#pragma omp parallel for shared (results, order)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                results[i] = radiusAny(query_pts.col(i), radius);
+            }
+            return derived();
+        }
+
+        inline std::vector<char> radiusAny(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts, ScalarT radius) const {
+            std::vector<char> results;
+            radiusAny(query_pts, radius, results);
+            return results;
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& kNNInRadiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                                CountT k,
+                                                ScalarT radius,
+                                                NeighborhoodResult &results) const
+        {
+            results.resize(k);
+            results.resize(knn_search_(query_pt.data(), k, radius, results.data()));
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline NeighborhoodResult kNNInRadiusSearch(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                                    CountT k,
+                                                    ScalarT radius) const
+        {
+            NeighborhoodResult results;
+            kNNInRadiusSearch(query_pt, k, radius, results);
+            return results;
+        }
+
+        template <typename CountT = size_t>
+        const Derived& kNNInRadiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                         CountT k,
+                                         ScalarT radius,
+                                         NeighborhoodSetResult &results) const
+        {
+            derived().knn_batch_search_(query_pts, k, radius, results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline NeighborhoodSetResult kNNInRadiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                                       CountT k,
+                                                       ScalarT radius) const
+        {
+            NeighborhoodSetResult results;
+            kNNInRadiusSearch(query_pts, k, radius, results);
+            return results;
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& kNNInRadiusSearch(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                                CountT k,
+                                                ScalarT radius,
+                                                FlatNeighborhoodSetResult &results) const
+        {
+            derived().knn_batch_search_(query_pts, k, radius, results);
+            return derived();
+        }
+
+        // Calls visitor(index, dist) for every neighbor of query_pt within radius, in traversal order
+        template <class VisitorT>
+        inline const Derived& radiusVisit(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                          ScalarT radius,
+                                          VisitorT &&visitor) const
+        {
+            VisitorSearchResultAdaptor<ScalarT,IndexT,typename std::remove_reference<VisitorT>::type> sra(visitor, radius);
+            derived().findNeighbors(sra, query_pt.data());
+            return derived();
+        }
+
+        // Calls visitor(query_index, index, dist) for every neighbor of every query point within radius.
+        // Queries are processed in parallel: calls for different queries may be concurrent, calls for the same
+        // query are sequential.
+        template <class VisitorT>
+        const Derived& radiusVisit(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                   ScalarT radius,
+                                   VisitorT &&visitor) const
+        {
+            const std::vector<size_t> order(get_query_order_(query_pts));
+#pragma omp parallel for shared (order)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                radiusVisit(query_pts.col(i), radius, [i,&visitor](IndexT index, ScalarT dist) { visitor(i, index, dist); });
+            }
+            return derived();
+        }
+
+        // Calls visitor(index, dist) for the (at most) k nearest neighbors of query_pt within radius, in order of
+        // increasing distance (see setKNNResultSorting); the neighbors are collected in buffer first, which can
+        // be reused across calls.
+        template <typename CountT, class VisitorT>
+        inline const Derived& kNNInRadiusVisit(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                               CountT k,
+                                               ScalarT radius,
+                                               VisitorT &&visitor,
+                                               NeighborhoodResult &buffer) const
+        {
+            if (buffer.size() < k) buffer.resize(k);
+            const CountT num_neighbors = knn_search_(query_pt.data(), k, radius, buffer.data());
+            for (CountT i = 0; i < num_neighbors; i++) {
+                visitor(buffer[i].index, buffer[i].value);
+            }
+            return derived();
+        }
+
+        template <typename CountT, class VisitorT>
+        inline const Derived& kNNInRadiusVisit(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                               CountT k,
+                                               ScalarT radius,
+                                               VisitorT &&visitor) const
+        {
+            NeighborhoodResult buffer;
+            return kNNInRadiusVisit(query_pt, k, radius, visitor, buffer);
+        }
+
+        // Batch version of the above, calling visitor(query_index, index, dist); see radiusVisit for threading.
+        // Every thread reuses a single buffer.
+        template <typename CountT, class VisitorT>
+        const Derived& kNNInRadiusVisit(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                        CountT k,
+                                        ScalarT radius,
+                                        VisitorT &&visitor) const
+        {
+            const std::vector<size_t> order(get_query_order_(query_pts));
+            NeighborhoodResult buffer;
+#pragma omp parallel for shared (order) private (buffer)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                kNNInRadiusVisit(query_pts.col(i), k, radius, [i,&visitor](IndexT index, ScalarT dist) { visitor(i, index, dist); }, buffer);
+            }
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& search(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                     const KNNNeighborhoodSpecification<CountT> &nh,
+                                     NeighborhoodResult &results) const
+        {
+            kNNSearch(query_pt, nh.maxNumberOfNeighbors, results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                     const KNNNeighborhoodSpecification<CountT> &nh,
+                                     NeighborhoodSetResult &results) const
+        {
+            kNNSearch(query_pts, nh.maxNumberOfNeighbors, results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                     const KNNNeighborhoodSpecification<CountT> &nh,
+                                     FlatNeighborhoodSetResult &results) const
+        {
+            kNNSearch(query_pts, nh.maxNumberOfNeighbors, results);
+            return derived();
+        }
+
+        inline const Derived& search(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                     const RadiusNeighborhoodSpecification<ScalarT> &nh,
+                                     NeighborhoodResult &results) const
+        {
+            radiusSearch(query_pt, nh.radius, results);
+            return derived();
+        }
+
+        inline const Derived& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                     const RadiusNeighborhoodSpecification<ScalarT> &nh,
+                                     NeighborhoodSetResult &results) const
+        {
+            radiusSearch(query_pts, nh.radius, results);
+            return derived();
+        }
+
+        inline const Derived& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                     const RadiusNeighborhoodSpecification<ScalarT> &nh,
+                                     FlatNeighborhoodSetResult &results) const
+        {
+            radiusSearch(query_pts, nh.radius, results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& search(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt,
+                                     const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh,
+                                     NeighborhoodResult &results) const
+        {
+            kNNInRadiusSearch(query_pt, nh.maxNumberOfNeighbors, nh.radius, results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                     const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh,
+                                     NeighborhoodSetResult &results) const
+        {
+            kNNInRadiusSearch(query_pts, nh.maxNumberOfNeighbors, nh.radius, results);
+            return derived();
+        }
+
+        template <typename CountT = size_t>
+        inline const Derived& search(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                     const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh,
+                                     FlatNeighborhoodSetResult &results) const
+        {
+            kNNInRadiusSearch(query_pts, nh.maxNumberOfNeighbors, nh.radius, results);
+            return derived();
+        }
+
+        template <typename PointT, typename NeighborhoodSpecT>
+        inline typename std::enable_if<PointT::ColsAtCompileTime == 1,NeighborhoodResult>::type
+        search(const PointT &query_pt,
+               const NeighborhoodSpecT &nh) const
+        {
+            NeighborhoodResult res;
+            search(query_pt, nh, res);
+            return res;
+        }
+
+        template <typename PointsT, typename NeighborhoodSpecT>
+        inline typename std::enable_if<PointsT::ColsAtCompileTime == Eigen::Dynamic,NeighborhoodSetResult>::type
+        search(const PointsT &query_pts,
+               const NeighborhoodSpecT &nh) const
+        {
+            NeighborhoodSetResult res;
+            search(query_pts, nh, res);
+            return res;
+        }
+
+        // Visitor counterparts of search(); single queries call visitor(index, dist), batches call
+        // visitor(query_index, index, dist)
+        template <typename PointT, typename CountT, class VisitorT>
+        inline const Derived& visit(const PointT &query_pt,
+                                    const KNNNeighborhoodSpecification<CountT> &nh,
+                                    VisitorT &&visitor) const
+        {
+            return kNNInRadiusVisit(query_pt, nh.maxNumberOfNeighbors, std::numeric_limits<ScalarT>::max(), visitor);
+        }
+
+        template <typename PointT, class VisitorT>
+        inline const Derived& visit(const PointT &query_pt,
+                                    const RadiusNeighborhoodSpecification<ScalarT> &nh,
+                                    VisitorT &&visitor) const
+        {
+            return radiusVisit(query_pt, nh.radius, visitor);
+        }
+
+        template <typename PointT, typename CountT, class VisitorT>
+        inline const Derived& visit(const PointT &query_pt,
+                                    const KNNInRadiusNeighborhoodSpecification<ScalarT,CountT> &nh,
+                                    VisitorT &&visitor) const
+        {
+            return kNNInRadiusVisit(query_pt, nh.maxNumberOfNeighbors, nh.radius, visitor);
+        }
+
+    protected:
+        SearchTreeBase()
+                : spatial_query_ordering_(false),
+                  knn_heap_threshold_(160),
+                  knn_result_sorting_(true)
+        {}
+
+        bool spatial_query_ordering_;
+        size_t knn_heap_threshold_;
+        bool knn_result_sorting_;
+
+        // kNN search into results[0..k), with the collector selected by k; returns the number of neighbors found
+        template <typename CountT>
+        inline CountT knn_search_(const ScalarT *query_pt, CountT k, ScalarT max_radius, NeighborResult *results) const {
+            if (k == 0) return 0;
+            if (static_cast<size_t>(k) < knn_heap_threshold_) {
+                KNNSearchResultAdaptor<ScalarT,IndexT,CountT> sra(results, k, max_radius);
+                derived().findNeighbors(sra, query_pt);
+                return sra.size();
+            }
+            KNNHeapSearchResultAdaptor<ScalarT,IndexT,CountT> sra(results, k, max_radius);
+            derived().findNeighbors(sra, query_pt);
+            if (knn_result_sorting_) sra.sort();
+            return sra.size();
+        }
+
+        // Order in which batch searches visit query_pts; empty for input order
+        inline std::vector<size_t> get_query_order_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts) const {
+            if (!spatial_query_ordering_ || query_pts.cols() < 2) return std::vector<size_t>();
+            return computeMortonOrder<ScalarT,EigenDim>(query_pts);
+        }
+
+        // Batch kNN search, keeping only neighbors closer than max_radius; the public batch kNN and
+        // kNN-in-radius searches call this through derived(), so search structures with a faster batch
+        // strategy can provide their own versions of both overloads.
+        template <typename CountT>
+        void knn_batch_search_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                               CountT k,
+                               ScalarT max_radius,
+                               NeighborhoodSetResult &results) const
+        {
+            results.resize(query_pts.cols());
+            const std::vector<size_t> order(get_query_order_(query_pts));
+#pragma omp parallel for shared (results, order)
+            for (size_t j = 0; j < query_pts.cols(); j++) {
+                const size_t i = order.empty() ? j : order[j];
+                kNNInRadiusSearch(query_pts.col(i), k, max_radius, results[i]);
+            }
+        }
+
+        template <typename CountT>
+        void knn_batch_search_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                               CountT k,
+                               ScalarT max_radius,
+                               FlatNeighborhoodSetResult &results) const
+        {
+            flat_batch_search_(query_pts, results, [this,k,max_radius](const Eigen::Ref<const Vector<ScalarT,EigenDim>> &query_pt, NeighborhoodResult &block_nn) {
+                const size_t start = block_nn.size();
+                block_nn.resize(start + k);
+                block_nn.resize(start + knn_search_(query_pt.data(), k, max_radius, block_nn.data() + start));
+            }, k);
+        }
+
+        // Queries are processed in contiguous blocks (of the spatial order, if enabled); each block appends to
+        // its own buffer, so the number of heap allocations scales with the number of blocks instead of the
+        // number of queries.
+        // Block buffers are then concatenated in parallel, after a prefix sum over block sizes; with spatial
+        // ordering, each query's neighbors are then scattered to their position in input order.
+        // single_search(query_pt, block_nn) must append the neighbors of query_pt to block_nn.
+        // If known, max_neighbors_per_query is used to preallocate block buffers.
+        template <class SingleSearchT>
+        void flat_batch_search_(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                FlatNeighborhoodSetResult &results,
+                                SingleSearchT single_search,
+                                size_t max_neighbors_per_query = 0) const
+        {
+            const size_t num_queries = query_pts.cols();
+            const size_t block_size = 1024;
+            const size_t num_blocks = (num_queries + block_size - 1)/block_size;
+            const std::vector<size_t> order(get_query_order_(query_pts));
+
+            // Offsets and neighbors in processing order
+            FlatNeighborhoodSetResult processed;
+            FlatNeighborhoodSetResult& out(order.empty() ? results : processed);
+
+            std::vector<NeighborhoodResult> block_neighbors(num_blocks);
+            std::vector<size_t>& offsets(out.offsets);
+            offsets.resize(num_queries + 1);
+            offsets[0] = 0;
+
+#pragma omp parallel for shared (block_neighbors, offsets, order) firstprivate (single_search) schedule (dynamic)
+            for (size_t b = 0; b < num_blocks; b++) {
+                const size_t block_end = std::min((b + 1)*block_size, num_queries);
+                block_neighbors[b].reserve((block_end - b*block_size)*max_neighbors_per_query);
+                for (size_t j = b*block_size; j < block_end; j++) {
+                    const size_t prev_size = block_neighbors[b].size();
+                    single_search(query_pts.col(order.empty() ? j : order[j]), block_neighbors[b]);
+                    offsets[j + 1] = block_neighbors[b].size() - prev_size;
+                }
+            }
+
+            std::vector<size_t> block_start(num_blocks + 1);
+            block_start[0] = 0;
+            for (size_t b = 0; b < num_blocks; b++) {
+                block_start[b + 1] = block_start[b] + block_neighbors[b].size();
+            }
+
+            out.neighbors.resize(block_start[num_blocks]);
+#pragma omp parallel for shared (block_neighbors, offsets, out) schedule (dynamic)
+            for (size_t b = 0; b < num_blocks; b++) {
+                const size_t block_end = std::min((b + 1)*block_size, num_queries);
+                size_t offset = block_start[b];
+                for (size_t j = b*block_size; j < block_end; j++) {
+                    offset += offsets[j + 1];
+                    offsets[j + 1] = offset;
+                }
+                std::copy(block_neighbors[b].begin(), block_neighbors[b].end(), out.neighbors.begin() + block_start[b]);
+                NeighborhoodResult().swap(block_neighbors[b]);
+            }
+
+            if (order.empty()) return;
+
+            results.offsets.resize(num_queries + 1);
+            results.offsets[0] = 0;
+            for (size_t j = 0; j < num_queries; j++) {
+                results.offsets[order[j] + 1] = offsets[j + 1] - offsets[j];
+            }
+            for (size_t i = 0; i < num_queries; i++) {
+                results.offsets[i + 1] += results.offsets[i];
+            }
+
+            results.neighbors.resize(out.neighbors.size());
+#pragma omp parallel for shared (results, out, order)
+            for (size_t j = 0; j < num_queries; j++) {
+                std::copy(out.neighbors.begin() + offsets[j], out.neighbors.begin() + offsets[j + 1], results.neighbors.begin() + results.offsets[order[j]]);
+            }
+        }
+    };
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cilantro/core/data_containers.hpp>
+#include <cilantro/core/fixed_dimension_dispatch.hpp>
 
 namespace cilantro {
     namespace internal {
@@ -24,6 +25,57 @@ namespace cilantro {
                 std::vector<TransformT,Eigen::aligned_allocator<TransformT>>,
                 std::vector<TransformT>>::type;
 #endif
+
+        // Applies an Eigen::Dynamic LinearTransform of dimension 2, 3, 4 or 6 through fixed-size maps of the
+        // transform and the points (see dispatchFixedDimension); source and destination may coincide
+        template <typename ScalarT>
+        struct FixedDimensionPointTransformer {
+            const ScalarT * tform;
+            const ConstDataMatrixMap<ScalarT,Eigen::Dynamic> &src;
+            DataMatrixMap<ScalarT,Eigen::Dynamic> &dst;
+
+            FixedDimensionPointTransformer(const ScalarT * tform, const ConstDataMatrixMap<ScalarT,Eigen::Dynamic> &src, DataMatrixMap<ScalarT,Eigen::Dynamic> &dst)
+                    : tform(tform), src(src), dst(dst)
+            {}
+
+            template <ptrdiff_t D>
+            void run() const {
+                const Eigen::Matrix<ScalarT,D,D> fixed_tform = Eigen::Map<const Eigen::Matrix<ScalarT,D,D>>(tform);
+                const ConstDataMatrixMap<ScalarT,D> fixed_src(src.data(), D, src.cols());
+                DataMatrixMap<ScalarT,D> fixed_dst(dst.data(), D, dst.cols());
+#pragma omp parallel for
+                for (size_t i = 0; i < fixed_src.cols(); i++) {
+                    fixed_dst.col(i) = fixed_tform*fixed_src.col(i);
+                }
+            }
+        };
+
+        template <class TransformT>
+        inline bool transform_points_fixed_dimension_(const TransformT &tform,
+                                                      const ConstDataMatrixMap<typename TransformT::Scalar,TransformT::Dim> &points,
+                                                      DataMatrixMap<typename TransformT::Scalar,TransformT::Dim> &result,
+                                                      std::true_type)
+        {
+            return dispatchFixedDimension<Eigen::Dynamic>(points.rows(), FixedDimensionPointTransformer<typename TransformT::Scalar>(tform.data(), points, result));
+        }
+
+        template <class TransformT>
+        inline bool transform_points_fixed_dimension_(const TransformT &,
+                                                      const ConstDataMatrixMap<typename TransformT::Scalar,TransformT::Dim> &,
+                                                      DataMatrixMap<typename TransformT::Scalar,TransformT::Dim> &,
+                                                      std::false_type)
+        {
+            return false;
+        }
+
+        // Only Eigen::Dynamic LinearTransform instances qualify (Eigen::Transform dimensions are always fixed)
+        template <class TransformT>
+        inline bool transformPointsFixedDimension(const TransformT &tform,
+                                                  const ConstDataMatrixMap<typename TransformT::Scalar,TransformT::Dim> &points,
+                                                  DataMatrixMap<typename TransformT::Scalar,TransformT::Dim> &result)
+        {
+            return transform_points_fixed_dimension_(tform, points, result, std::integral_constant<bool,TransformT::Dim == Eigen::Dynamic>());
+        }
     } // namespace internal
 
     // Simply a Dim x Dim matrix with extra compile time info
@@ -184,6 +236,8 @@ namespace cilantro {
     void transformPoints(const TransformT &tform,
                          DataMatrixMap<typename TransformT::Scalar,TransformT::Dim> points)
     {
+        if (internal::transformPointsFixedDimension(tform, points, points)) return;
+
 #pragma omp parallel for
         for (size_t i = 0; i < points.cols(); i++) {
             points.col(i) = tform*points.col(i);
@@ -210,6 +264,8 @@ namespace cilantro {
             return;
         }
 
+        if (internal::transformPointsFixedDimension(tform, points, result)) return;
+
 #pragma omp parallel for
         for (size_t i = 0; i < points.cols(); i++) {
             result.col(i).noalias() = tform*points.col(i);
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cilantro/core/grid_accumulator.hpp>
+#include <cilantro/core/morton_order.hpp>
+#include <cilantro/core/parallel_sort.hpp>
+#include <cilantro/core/search_tree_base.hpp>
+
+namespace cilantro {
+    // Uniform grid of cubic cells under the squared L2 metric, with the same search interface as KDTree.
+    // Occupied cells are stored in a hash table, so looking up a cell takes expected constant time; with the
+    // cell size set to the (non-squared) search radius, a radius search only visits the 3^D cells around the
+    // query. kNN searches visit rings of cells of increasing size, until no unvisited cell can contain a closer
+    // point. Meant for 2D/3D data and fixed-radius queries (e.g. NormalEstimation by radius): build a grid and
+    // pass it to the class that takes a search tree.
+    // The grid is built in parallel: points are sorted by the Morton code of their cell (ties by cell
+    // coordinates), so every cell is a contiguous range of the sorted points, which are copied in that order.
+    template <typename ScalarT, ptrdiff_t EigenDim, typename IndexT = size_t>
+    class VoxelHashGrid : public SearchTreeBase<VoxelHashGrid<ScalarT,EigenDim,IndexT>,ScalarT,EigenDim,IndexT> {
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        typedef ScalarT Scalar;
+        typedef IndexT Index;
+
+        typedef Neighbor<ScalarT,IndexT> NeighborResult;
+        typedef Neighborhood<ScalarT,IndexT> NeighborhoodResult;
+        typedef NeighborSet<ScalarT,IndexT> NeighborSetResult;
+        typedef NeighborhoodSet<ScalarT,IndexT> NeighborhoodSetResult;
+        typedef FlatNeighborhoodSet<ScalarT,IndexT> FlatNeighborhoodSetResult;
+
+        enum { Dimension = EigenDim };
+
+        typedef Eigen::Matrix<ptrdiff_t,EigenDim,1> GridPoint;
+
+        VoxelHashGrid(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &data, ScalarT cell_size)
+                : data_map_(data),
+                  cell_size_(cell_size),
+                  cell_size_inv_((ScalarT)1/cell_size)
+        {
+            build_index_();
+        }
+
+        ~VoxelHashGrid() {}
+
+        inline const ConstVectorSetMatrixMap<ScalarT,EigenDim>& getPointsMatrixMap() const { return data_map_; }
+
+        inline bool isEmpty() const { return data_map_.cols() == 0; }
+
+        inline ScalarT getCellSize() const { return cell_size_; }
+
+        inline size_t getNumberOfOccupiedCells() const { return num_cells_; }
+
+        inline GridPoint getPointGridCoordinates(const Eigen::Ref<const Vector<ScalarT,EigenDim>> &point) const {
+            GridPoint grid_coords(data_map_.rows());
+            for (size_t i = 0; i < data_map_.rows(); i++) {
+                grid_coords[i] = static_cast<ptrdiff_t>(std::floor(point[i]*cell_size_inv_));
+            }
+            return grid_coords;
+        }
+
+        // Feeds the candidate neighbors of query_pt to result_set (see SearchTreeBase)
+        template <class ResultSetT>
+        void findNeighbors(ResultSetT &result_set, const ScalarT *query_pt) const {
+            if (num_cells_ == 0) return;
+
+            const size_t dim = data_map_.rows();
+            const Eigen::Map<const Vector<ScalarT,EigenDim>> query(query_pt, dim);
+            const GridPoint center(getPointGridCoordinates(query));
+            GridPoint offset(dim), cell(dim);
+
+            // Largest ring that still reaches an occupied cell
+            ptrdiff_t max_ring = 0;
+            for (size_t i = 0; i < dim; i++) {
+                max_ring = std::max(max_ring, std::max(center[i] - grid_min_[i], grid_max_[i] - center[i]));
+            }
+
+            for (ptrdiff_t ring = 0; ring <= max_ring; ring++) {
+                // Far from the data, the cube of visited cells outgrows the grid: scan the remaining occupied cells instead
+                if (ring > 0 && std::pow(2.0*ring + 1.0, (double)dim) > (double)num_cells_) {
+                    for (size_t c = 0; c < table_.size(); c++) {
+                        if (table_[c].begin == table_[c].end || (table_[c].coords - center).cwiseAbs().maxCoeff() < ring) continue;
+                        if (get_cell_distance_(query, table_[c].coords) < result_set.worstDist() && !scan_cell_(result_set, query, table_[c])) return;
+                    }
+                    return;
+                }
+
+                // Visit all offsets in [-ring, ring]^D with at least one coordinate on the ring's boundary
+                offset.setConstant(dim, 1, -ring);
+                bool done = false;
+                while (!done) {
+                    bool on_ring = false;
+                    for (size_t i = 0; i < dim; i++) {
+                        if (offset[i] == ring || offset[i] == -ring) {
+                            on_ring = true;
+                            break;
+                        }
+                    }
+                    if (on_ring) {
+                        cell = center + offset;
+                        if (get_cell_distance_(query, cell) < result_set.worstDist()) {
+                            const Cell *occupied = find_cell_(cell);
+                            if (occupied != NULL && !scan_cell_(result_set, query, *occupied)) return;
+                        }
+                    }
+                    done = true;
+                    for (size_t i = 0; i < dim; i++) {
+                        if (offset[i] < ring) {
+                            offset[i]++;
+                            done = false;
+                            break;
+                        }
+                        offset[i] = -ring;
+                    }
+                }
+
+                // Cells outside the current ring are at least ring*cell_size_ away from the query
+                const ScalarT ring_dist = ring*cell_size_;
+                if (ring_dist*ring_dist >= result_set.worstDist()) return;
+            }
+        }
+
+    private:
+        // Occupied cell (table slot); points [begin, end) of points_ lie in the cell, and begin == end marks
+        // an empty slot
+        struct Cell {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+            GridPoint coords;
+            size_t begin;
+            size_t end;
+        };
+
+        ConstVectorSetMatrixMap<ScalarT,EigenDim> data_map_;
+        ScalarT cell_size_;
+        ScalarT cell_size_inv_;
+
+        // Points in cell order, and their original indices
+        VectorSet<ScalarT,EigenDim> points_;
+        std::vector<IndexT> point_indices_;
+
+        // Open addressing hash table (linear probing) of occupied cells
+        std::vector<Cell,Eigen::aligned_allocator<Cell>> table_;
+        uint64_t table_mask_;
+        size_t num_cells_;
+        GridPoint grid_min_;
+        GridPoint grid_max_;
+
+        static inline uint64_t hash_cell_(const GridPoint &cell) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t i = 0; i < cell.rows(); i++) {
+                hash ^= static_cast<uint64_t>(cell[i]) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+                hash *= 0x100000001b3ull;
+            }
+            return hash ^ (hash >> 29);
+        }
+
+        // Squared distance from query to the closest point of the cell
+        inline ScalarT get_cell_distance_(const Eigen::Map<const Vector<ScalarT,EigenDim>> &query, const GridPoint &cell) const {
+            ScalarT dist = (ScalarT)0;
+            for (size_t i = 0; i < cell.rows(); i++) {
+                const ScalarT low = cell[i]*cell_size_;
+                ScalarT diff = (ScalarT)0;
+                if (query[i] < low) {
+                    diff = low - query[i];
+                } else if (query[i] > low + cell_size_) {
+                    diff = query[i] - low - cell_size_;
+                }
+                dist += diff*diff;
+            }
+            return dist;
+        }
+
+        // NULL if the cell is empty
+        inline const Cell* find_cell_(const GridPoint &cell) const {
+            for (uint64_t slot = hash_cell_(cell) & table_mask_; table_[slot].begin != table_[slot].end; slot = (slot + 1) & table_mask_) {
+                if (table_[slot].coords == cell) return &table_[slot];
+            }
+            return NULL;
+        }
+
+        template <class ResultSetT>
+        inline bool scan_cell_(ResultSetT &result_set, const Eigen::Map<const Vector<ScalarT,EigenDim>> &query, const Cell &cell) const {
+            for (size_t i = cell.begin; i < cell.end; i++) {
+                const ScalarT dist = (points_.col(i) - query).squaredNorm();
+                if (dist < result_set.worstDist() && !result_set.addPoint(dist, point_indices_[i])) return false;
+            }
+            return true;
+        }
+
+        void build_index_() {
+            const size_t num_points = data_map_.cols();
+            const size_t dim = data_map_.rows();
+            num_cells_ = 0;
+            if (num_points == 0) return;
+
+            Eigen::Matrix<ptrdiff_t,EigenDim,Eigen::Dynamic> point_coords(dim, num_points);
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                point_coords.col(i) = getPointGridCoordinates(data_map_.col(i));
+            }
+            grid_min_ = point_coords.rowwise().minCoeff();
+            grid_max_ = point_coords.rowwise().maxCoeff();
+
+            // Sort by the Morton code of the cell, so that nearby cells are close in memory; codes of distinct
+            // cells only coincide if the grid is too large for the code's bits
+            const size_t bits_per_dim = getMortonCodeBitsPerDimension(dim);
+            std::vector<std::pair<uint64_t,IndexT>> sorted(num_points);
+#pragma omp parallel
+            {
+                std::vector<uint64_t> grid_coords(dim);
+#pragma omp for
+                for (size_t i = 0; i < num_points; i++) {
+                    for (size_t d = 0; d < dim; d++) {
+                        grid_coords[d] = static_cast<uint64_t>(point_coords(d,i) - grid_min_[d]);
+                    }
+                    sorted[i].first = computeMortonCode(grid_coords.data(), dim, bits_per_dim);
+                    sorted[i].second = static_cast<IndexT>(i);
+                }
+            }
+            parallelSort(sorted);
+
+            // Order runs of equal code by cell coordinates, so that every cell is contiguous
+            const EigenVectorComparator<ptrdiff_t,EigenDim> coords_less;
+            for (size_t begin = 0, end; begin < num_points; begin = end) {
+                end = begin + 1;
+                bool single_cell = true;
+                while (end < num_points && sorted[end].first == sorted[begin].first) {
+                    if (point_coords.col(sorted[end].second) != point_coords.col(sorted[begin].second)) single_cell = false;
+                    end++;
+                }
+                if (single_cell) continue;
+                std::stable_sort(sorted.begin() + begin, sorted.begin() + end, [&point_coords,&coords_less](const std::pair<uint64_t,IndexT> &p1, const std::pair<uint64_t,IndexT> &p2) {
+                    return coords_less(point_coords.col(p1.second), point_coords.col(p2.second));
+                });
+            }
+
+            point_indices_.resize(num_points);
+            points_.resize(dim, num_points);
+#pragma omp parallel for
+            for (size_t i = 0; i < num_points; i++) {
+                point_indices_[i] = sorted[i].second;
+                points_.col(i) = data_map_.col(sorted[i].second);
+            }
+
+            std::vector<size_t> cell_starts(1, 0);
+            for (size_t i = 1; i < num_points; i++) {
+                if (point_coords.col(sorted[i].second) != point_coords.col(sorted[i-1].second)) {
+                    cell_starts.emplace_back(i);
+                }
+            }
+            cell_starts.emplace_back(num_points);
+            num_cells_ = cell_starts.size() - 1;
+
+            size_t table_size = 2;
+            while (table_size < 2*num_cells_) table_size *= 2;
+            Cell empty_cell;
+            empty_cell.coords.setZero(dim, 1);
+            empty_cell.begin = empty_cell.end = 0;
+            table_.assign(table_size, empty_cell);
+            table_mask_ = table_size - 1;
+            for (size_t c = 0; c < num_cells_; c++) {
+                const GridPoint coords(point_coords.col(sorted[cell_starts[c]].second));
+                uint64_t slot = hash_cell_(coords) & table_mask_;
+                while (table_[slot].begin != table_[slot].end) slot = (slot + 1) & table_mask_;
+                table_[slot].coords = coords;
+                table_[slot].begin = cell_starts[c];
+                table_[slot].end = cell_starts[c + 1];
+            }
+        }
+    };
+
+    template <typename IndexT = size_t>
+    using VoxelHashGrid2f = VoxelHashGrid<float,2,IndexT>;
+
+    template <typename IndexT = size_t>
+    using VoxelHashGrid2d = VoxelHashGrid<double,2,IndexT>;
+
+    template <typename IndexT = size_t>
+    using VoxelHashGrid3f = VoxelHashGrid<float,3,IndexT>;
+
+    template <typename IndexT = size_t>
+    using VoxelHashGrid3d = VoxelHashGrid<double,3,IndexT>;
+
+    template <typename IndexT = size_t>
+    using VoxelHashGridXf = VoxelHashGrid<float,Eigen::Dynamic,IndexT>;
+
+    template <typename IndexT = size_t>
+    using VoxelHashGridXd = VoxelHashGrid<double,Eigen::Dynamic,IndexT>;
+}
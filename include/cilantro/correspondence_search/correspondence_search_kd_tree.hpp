@@ -12,7 +12,7 @@ namespace cilantro {
 //    template <typename T>
 //    struct IsIsometry<T, decltype((void) T::Mode, 0)> : std::conditional<T::Mode == Eigen::Isometry, std::true_type, std::false_type>::type {};
 
-    template <class SearchFeatureAdaptorT, template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, class EvaluationFeatureAdaptorT = SearchFeatureAdaptorT, class EvaluatorT = DistanceEvaluator<typename SearchFeatureAdaptorT::Scalar,typename EvaluationFeatureAdaptorT::Scalar>, typename IndexT = size_t>
+    template <class SearchFeatureAdaptorT, template <class> class DistAdaptor = KDTreeDistanceAdaptors::L2, class EvaluationFeatureAdaptorT = SearchFeatureAdaptorT, class EvaluatorT = DistanceEvaluator<typename SearchFeatureAdaptorT::Scalar,typename EvaluationFeatureAdaptorT::Scalar>, typename IndexT = size_t, class SearchTreeT = KDTree<typename SearchFeatureAdaptorT::Scalar,SearchFeatureAdaptorT::FeatureDimension,DistAdaptor,IndexT>>
     class CorrespondenceSearchKDTree {
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -27,7 +27,11 @@ namespace cilantro {
 
         typedef typename SearchFeatureAdaptorT::Scalar SearchFeatureScalar;
 
-        typedef KDTree<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension,DistAdaptor,CorrespondenceIndex> SearchTree;
+        typedef ConstVectorSetIndexView<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension,IndexT> SearchFeatureView;
+
+        // Any tree with the KDTree search interface (e.g. ImplicitKDTree for 2D/3D L2 search, BruteForceSearch, or
+        // AdaptiveSearchTree, which switches to brute force search for high-dimensional L2 features)
+        typedef SearchTreeT SearchTree;
 
         template <class EvalFeatAdaptorT = EvaluationFeatureAdaptorT, class = typename std::enable_if<std::is_same<EvalFeatAdaptorT,SearchFeatureAdaptorT>::value>::type>
         CorrespondenceSearchKDTree(SearchFeatureAdaptorT &dst_features,
@@ -37,7 +41,9 @@ namespace cilantro {
                   src_evaluation_features_adaptor_(src_features), evaluator_(evaluator),
                   search_dir_(CorrespondenceSearchDirection::SECOND_TO_FIRST),
                   max_distance_((CorrespondenceScalar)(0.01*0.01)),
-                  inlier_fraction_(1.0), require_reciprocality_(false), one_to_one_(false)
+                  inlier_fraction_(1.0), require_reciprocality_(false), one_to_one_(false),
+                  search_eps_(0), max_leaf_visits_(0),
+                  use_src_subset_(false), use_dst_subset_(false)
         {}
 
         CorrespondenceSearchKDTree(SearchFeatureAdaptorT &dst_search_features,
@@ -48,25 +54,27 @@ namespace cilantro {
                   src_evaluation_features_adaptor_(src_eval_features), evaluator_(evaluator),
                   search_dir_(CorrespondenceSearchDirection::SECOND_TO_FIRST),
                   max_distance_((CorrespondenceScalar)(0.01*0.01)),
-                  inlier_fraction_(1.0), require_reciprocality_(false), one_to_one_(false)
+                  inlier_fraction_(1.0), require_reciprocality_(false), one_to_one_(false),
+                  search_eps_(0), max_leaf_visits_(0),
+                  use_src_subset_(false), use_dst_subset_(false)
         {}
 
         CorrespondenceSearchKDTree& findCorrespondences() {
             switch (search_dir_) {
                 case CorrespondenceSearchDirection::FIRST_TO_SECOND: {
-                    if (!src_tree_ptr_) src_tree_ptr_.reset(new SearchTree(src_search_features_adaptor_.getFeaturesMatrixMap()));
-                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_search_features_adaptor_.getFeaturesMatrixMap(), *src_tree_ptr_, false, correspondences_, max_distance_, evaluator_);
+                    if (!src_tree_ptr_) src_tree_ptr_ = build_tree_(src_search_features_adaptor_.getFeaturesMatrixMap(), use_src_subset_, src_subset_);
+                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_view_(dst_search_features_adaptor_.getFeaturesMatrixMap()), configure_search_(*src_tree_ptr_), false, correspondences_, max_distance_, evaluator_);
                     break;
                 }
                 case CorrespondenceSearchDirection::SECOND_TO_FIRST: {
-                    if (!dst_tree_ptr_) dst_tree_ptr_.reset(new SearchTree(dst_search_features_adaptor_.getFeaturesMatrixMap()));
-                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(src_search_features_adaptor_.getFeaturesMatrixMap(), *dst_tree_ptr_, true, correspondences_, max_distance_, evaluator_);
+                    if (!dst_tree_ptr_) dst_tree_ptr_ = build_tree_(dst_search_features_adaptor_.getFeaturesMatrixMap(), use_dst_subset_, dst_subset_);
+                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(src_view_(src_search_features_adaptor_.getFeaturesMatrixMap()), configure_search_(*dst_tree_ptr_), true, correspondences_, max_distance_, evaluator_);
                     break;
                 }
                 case CorrespondenceSearchDirection::BOTH: {
-                    if (!dst_tree_ptr_) dst_tree_ptr_.reset(new SearchTree(dst_search_features_adaptor_.getFeaturesMatrixMap()));
-                    if (!src_tree_ptr_) src_tree_ptr_.reset(new SearchTree(src_search_features_adaptor_.getFeaturesMatrixMap()));
-                    findNNCorrespondencesBidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_search_features_adaptor_.getFeaturesMatrixMap(), src_search_features_adaptor_.getFeaturesMatrixMap(), *dst_tree_ptr_, *src_tree_ptr_, correspondences_, max_distance_, require_reciprocality_, evaluator_);
+                    if (!dst_tree_ptr_) dst_tree_ptr_ = build_tree_(dst_search_features_adaptor_.getFeaturesMatrixMap(), use_dst_subset_, dst_subset_);
+                    if (!src_tree_ptr_) src_tree_ptr_ = build_tree_(src_search_features_adaptor_.getFeaturesMatrixMap(), use_src_subset_, src_subset_);
+                    findNNCorrespondencesBidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_view_(dst_search_features_adaptor_.getFeaturesMatrixMap()), src_view_(src_search_features_adaptor_.getFeaturesMatrixMap()), configure_search_(*dst_tree_ptr_), configure_search_(*src_tree_ptr_), correspondences_, max_distance_, require_reciprocality_, evaluator_);
                     break;
                 }
             }
@@ -132,19 +140,19 @@ namespace cilantro {
 
             switch (search_dir_) {
                 case CorrespondenceSearchDirection::FIRST_TO_SECOND: {
-                    src_trans_tree_ptr_.reset(new SearchTree(src_search_features_adaptor_.transformFeatures(tform).getTransformedFeaturesMatrixMap()));
-                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_search_features_adaptor_.getFeaturesMatrixMap(), *src_trans_tree_ptr_, false, correspondences_, max_distance_, evaluator_);
+                    src_trans_tree_ptr_ = build_tree_(src_search_features_adaptor_.transformFeatures(tform).getTransformedFeaturesMatrixMap(), use_src_subset_, src_subset_);
+                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_view_(dst_search_features_adaptor_.getFeaturesMatrixMap()), configure_search_(*src_trans_tree_ptr_), false, correspondences_, max_distance_, evaluator_);
                     break;
                 }
                 case CorrespondenceSearchDirection::SECOND_TO_FIRST: {
-                    if (!dst_tree_ptr_) dst_tree_ptr_.reset(new SearchTree(dst_search_features_adaptor_.getFeaturesMatrixMap()));
-                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(src_search_features_adaptor_.transformFeatures(tform).getTransformedFeaturesMatrixMap(), *dst_tree_ptr_, true, correspondences_, max_distance_, evaluator_);
+                    if (!dst_tree_ptr_) dst_tree_ptr_ = build_tree_(dst_search_features_adaptor_.getFeaturesMatrixMap(), use_dst_subset_, dst_subset_);
+                    findNNCorrespondencesUnidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(src_view_(src_search_features_adaptor_.transformFeatures(tform).getTransformedFeaturesMatrixMap()), configure_search_(*dst_tree_ptr_), true, correspondences_, max_distance_, evaluator_);
                     break;
                 }
                 case CorrespondenceSearchDirection::BOTH: {
-                    if (!dst_tree_ptr_) dst_tree_ptr_.reset(new SearchTree(dst_search_features_adaptor_.getFeaturesMatrixMap()));
-                    src_trans_tree_ptr_.reset(new SearchTree(src_search_features_adaptor_.transformFeatures(tform).getTransformedFeaturesMatrixMap()));
-                    findNNCorrespondencesBidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_search_features_adaptor_.getFeaturesMatrixMap(), src_search_features_adaptor_.getTransformedFeaturesMatrixMap(), *dst_tree_ptr_, *src_trans_tree_ptr_, correspondences_, max_distance_, require_reciprocality_, evaluator_);
+                    if (!dst_tree_ptr_) dst_tree_ptr_ = build_tree_(dst_search_features_adaptor_.getFeaturesMatrixMap(), use_dst_subset_, dst_subset_);
+                    src_trans_tree_ptr_ = build_tree_(src_search_features_adaptor_.transformFeatures(tform).getTransformedFeaturesMatrixMap(), use_src_subset_, src_subset_);
+                    findNNCorrespondencesBidirectional<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension>(dst_view_(dst_search_features_adaptor_.getFeaturesMatrixMap()), src_view_(src_search_features_adaptor_.getTransformedFeaturesMatrixMap()), configure_search_(*dst_tree_ptr_), configure_search_(*src_trans_tree_ptr_), correspondences_, max_distance_, require_reciprocality_, evaluator_);
                     break;
                 }
             }
@@ -195,6 +203,52 @@ namespace cilantro {
             return *this;
         }
 
+        // Approximate nearest neighbor search (see KDTree::setSearchEpsilon and KDTree::setMaxLeafVisits);
+        // 0 means exact search
+        inline float getSearchEpsilon() const { return search_eps_; }
+
+        inline CorrespondenceSearchKDTree& setSearchEpsilon(float eps) {
+            search_eps_ = eps;
+            return *this;
+        }
+
+        inline size_t getMaxLeafVisits() const { return max_leaf_visits_; }
+
+        inline CorrespondenceSearchKDTree& setMaxLeafVisits(size_t max_leaf_visits) {
+            max_leaf_visits_ = max_leaf_visits;
+            return *this;
+        }
+
+        // Restrict the search to subsets of the source (second) or destination (first) features, e.g. the inliers
+        // of a RANSAC model; correspondences still use indices into the full feature sets. Indices are copied.
+        // Requires a SearchTree that can be built over a ConstVectorSetIndexView (e.g. KDTree, AdaptiveSearchTree).
+        template <class TreeT = SearchTree>
+        inline CorrespondenceSearchKDTree& setSourceSubset(const std::vector<IndexT> &indices) {
+            static_assert(std::is_constructible<TreeT,const SearchFeatureView&>::value, "SearchTree cannot index a subset view");
+            src_subset_ = indices;
+            use_src_subset_ = true;
+            src_tree_ptr_.reset();
+            return *this;
+        }
+
+        template <class TreeT = SearchTree>
+        inline CorrespondenceSearchKDTree& setDestinationSubset(const std::vector<IndexT> &indices) {
+            static_assert(std::is_constructible<TreeT,const SearchFeatureView&>::value, "SearchTree cannot index a subset view");
+            dst_subset_ = indices;
+            use_dst_subset_ = true;
+            dst_tree_ptr_.reset();
+            return *this;
+        }
+
+        inline CorrespondenceSearchKDTree& clearSubsets() {
+            if (use_src_subset_) src_tree_ptr_.reset();
+            if (use_dst_subset_) dst_tree_ptr_.reset();
+            use_src_subset_ = use_dst_subset_ = false;
+            src_subset_.clear();
+            dst_subset_.clear();
+            return *this;
+        }
+
        private:
         SearchFeatureAdaptorT& dst_search_features_adaptor_;
         SearchFeatureAdaptorT& src_search_features_adaptor_;
@@ -211,7 +265,48 @@ namespace cilantro {
         double inlier_fraction_;
         bool require_reciprocality_;
         bool one_to_one_;
+        float search_eps_;
+        size_t max_leaf_visits_;
+
+        bool use_src_subset_;
+        bool use_dst_subset_;
+        std::vector<IndexT> src_subset_;
+        std::vector<IndexT> dst_subset_;
 
         SearchResult correspondences_;
+
+        inline SearchFeatureView src_view_(const ConstVectorSetMatrixMap<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension> &features) const {
+            return (use_src_subset_) ? SearchFeatureView(features, src_subset_) : SearchFeatureView(features);
+        }
+
+        inline SearchFeatureView dst_view_(const ConstVectorSetMatrixMap<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension> &features) const {
+            return (use_dst_subset_) ? SearchFeatureView(features, dst_subset_) : SearchFeatureView(features);
+        }
+
+        inline std::shared_ptr<SearchTree> build_tree_(const ConstVectorSetMatrixMap<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension> &features, bool use_subset, const std::vector<IndexT> &subset) const {
+            return build_tree_(features, use_subset, subset, std::is_constructible<SearchTree,const SearchFeatureView&>());
+        }
+
+        inline std::shared_ptr<SearchTree> build_tree_(const ConstVectorSetMatrixMap<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension> &features, bool use_subset, const std::vector<IndexT> &subset, std::true_type) const {
+            if (use_subset) return std::shared_ptr<SearchTree>(new SearchTree(SearchFeatureView(features, subset)));
+            return std::shared_ptr<SearchTree>(new SearchTree(features));
+        }
+
+        // Subsets cannot be set for such trees (see setSourceSubset)
+        inline std::shared_ptr<SearchTree> build_tree_(const ConstVectorSetMatrixMap<SearchFeatureScalar,SearchFeatureAdaptorT::FeatureDimension> &features, bool, const std::vector<IndexT> &, std::false_type) const {
+            return std::shared_ptr<SearchTree>(new SearchTree(features));
+        }
+
+        // Applies the approximate search parameters to trees that support them
+        template <class TreeT>
+        inline TreeT& configure_search_(TreeT &tree) const { return configure_search_(tree, 0); }
+
+        template <class TreeT>
+        inline auto configure_search_(TreeT &tree, int) const -> decltype(tree.setSearchEpsilon(0.0f).setMaxLeafVisits(0)) {
+            return tree.setSearchEpsilon(search_eps_).setMaxLeafVisits(max_leaf_visits_);
+        }
+
+        template <class TreeT>
+        inline TreeT& configure_search_(TreeT &tree, long) const { return tree; }
     };
 }
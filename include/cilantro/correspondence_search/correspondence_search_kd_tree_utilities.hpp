@@ -3,6 +3,38 @@
 #include <cilantro/core/common_pair_evaluators.hpp>
 
 namespace cilantro {
+    namespace internal {
+        // Nearest neighbor (within max_distance) of each query, through the tree's batch search if it supports
+        // FlatNeighborhoodSet results, so that trees with a dedicated batch strategy (e.g. BruteForceSearch) can
+        // use it
+        template <class TreeT, typename ScalarT, ptrdiff_t EigenDim, typename DistanceT>
+        inline auto findNearestNeighborsInRadius(const TreeT &tree,
+                                                 const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                                 DistanceT max_distance,
+                                                 int)
+                -> typename TreeT::FlatNeighborhoodSetResult
+        {
+            typename TreeT::FlatNeighborhoodSetResult nn_set;
+            tree.kNNInRadiusSearch(query_pts, 1, max_distance, nn_set);
+            return nn_set;
+        }
+
+        // Otherwise, one search per query
+        template <class TreeT, typename ScalarT, ptrdiff_t EigenDim, typename DistanceT>
+        std::vector<typename TreeT::NeighborhoodResult> findNearestNeighborsInRadius(const TreeT &tree,
+                                                                                     const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
+                                                                                     DistanceT max_distance,
+                                                                                     long)
+        {
+            std::vector<typename TreeT::NeighborhoodResult> nn_set(query_pts.cols());
+#pragma omp parallel for shared (nn_set) schedule (dynamic, 256)
+            for (size_t i = 0; i < nn_set.size(); i++) {
+                tree.kNNInRadiusSearch(query_pts.col(i), 1, max_distance, nn_set[i]);
+            }
+            return nn_set;
+        }
+    } // namespace internal
+
     template <typename ScalarT, ptrdiff_t EigenDim, typename TreeT, typename CorrSetT, class EvaluatorT = DistanceEvaluator<ScalarT,ScalarT>>
     void findNNCorrespondencesUnidirectional(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &query_pts,
                                              const TreeT &ref_tree,
@@ -19,21 +51,22 @@ namespace cilantro {
             return;
         }
 
+        const auto nn_set(internal::findNearestNeighborsInRadius(ref_tree, query_pts, max_distance, 0));
+
         CorrSetT corr_tmp(query_pts.cols());
         std::vector<bool> keep(query_pts.cols());
-        typename TreeT::NeighborhoodResult nn;
         typename EvaluatorT::OutputScalar dist;
         if (ref_is_first) {
-#pragma omp parallel for shared(corr_tmp) private(nn, dist) schedule(dynamic, 256)
+#pragma omp parallel for shared(corr_tmp, nn_set) private(dist) schedule(dynamic, 256)
             for (size_t i = 0; i < query_pts.cols(); i++) {
-                ref_tree.kNNInRadiusSearch(query_pts.col(i), 1, max_distance, nn);
+                const auto nn(nn_set[i]);
                 keep[i] = !nn.empty() && (dist = evaluator(nn[0].index, i, nn[0].value)) < max_distance;
                 if (keep[i]) corr_tmp[i] = {static_cast<CorrIndexT>(nn[0].index), static_cast<CorrIndexT>(i), static_cast<CorrScalarT>(dist)};
             }
         } else {
-#pragma omp parallel for shared(corr_tmp) private(nn, dist) schedule(dynamic, 256)
+#pragma omp parallel for shared(corr_tmp, nn_set) private(dist) schedule(dynamic, 256)
             for (size_t i = 0; i < query_pts.cols(); i++) {
-                ref_tree.kNNInRadiusSearch(query_pts.col(i), 1, max_distance, nn);
+                const auto nn(nn_set[i]);
                 keep[i] = !nn.empty() && (dist = evaluator(i, nn[0].index, nn[0].value)) < max_distance;
                 if (keep[i]) corr_tmp[i] = {static_cast<CorrIndexT>(i), static_cast<CorrIndexT>(nn[0].index), static_cast<CorrScalarT>(dist)};
             }
@@ -59,6 +92,86 @@ namespace cilantro {
         return corr_set;
     }
 
+    // Queries are the points selected by a view; correspondences use their base matrix indices
+    template <typename ScalarT, ptrdiff_t EigenDim, typename TreeT, typename CorrSetT, class EvaluatorT = DistanceEvaluator<ScalarT,ScalarT>, typename QueryIndexT = size_t>
+    void findNNCorrespondencesUnidirectional(const ConstVectorSetIndexView<ScalarT,EigenDim,QueryIndexT> &query_pts,
+                                             const TreeT &ref_tree,
+                                             bool ref_is_first,
+                                             CorrSetT &correspondences,
+                                             typename EvaluatorT::OutputScalar max_distance,
+                                             const EvaluatorT &evaluator = EvaluatorT())
+    {
+        using CorrIndexT = typename CorrSetT::value_type::Index;
+        using CorrScalarT = typename CorrSetT::value_type::Scalar;
+
+        if (!query_pts.isSubset()) {
+            findNNCorrespondencesUnidirectional<ScalarT,EigenDim>(query_pts.getBaseMatrixMap(), ref_tree, ref_is_first, correspondences, max_distance, evaluator);
+            return;
+        }
+
+        if (ref_tree.getPointsMatrixMap().cols() == 0) {
+            correspondences.clear();
+            return;
+        }
+
+        CorrSetT corr_tmp(query_pts.cols());
+        std::vector<char> keep(query_pts.cols());
+        typename TreeT::NeighborhoodResult nn;
+        typename EvaluatorT::OutputScalar dist;
+#pragma omp parallel for shared(corr_tmp) private(nn, dist) schedule(dynamic, 256)
+        for (size_t i = 0; i < query_pts.cols(); i++) {
+            ref_tree.kNNInRadiusSearch(query_pts.col(i), 1, max_distance, nn);
+            const size_t q = query_pts.index(i);
+            if (ref_is_first) {
+                keep[i] = !nn.empty() && (dist = evaluator(nn[0].index, q, nn[0].value)) < max_distance;
+                if (keep[i]) corr_tmp[i] = {static_cast<CorrIndexT>(nn[0].index), static_cast<CorrIndexT>(q), static_cast<CorrScalarT>(dist)};
+            } else {
+                keep[i] = !nn.empty() && (dist = evaluator(q, nn[0].index, nn[0].value)) < max_distance;
+                if (keep[i]) corr_tmp[i] = {static_cast<CorrIndexT>(q), static_cast<CorrIndexT>(nn[0].index), static_cast<CorrScalarT>(dist)};
+            }
+        }
+
+        correspondences.resize(corr_tmp.size());
+        size_t count = 0;
+        for (size_t i = 0; i < corr_tmp.size(); i++) {
+            if (keep[i]) correspondences[count++] = corr_tmp[i];
+        }
+        correspondences.resize(count);
+    }
+
+    namespace internal {
+        // Union (or, if require_reciprocal, intersection) of the correspondences found in each direction
+        template <typename CorrSetT>
+        void mergeBidirectionalCorrespondences(CorrSetT &corr_first_to_second,
+                                               CorrSetT &corr_second_to_first,
+                                               CorrSetT &correspondences,
+                                               bool require_reciprocal)
+        {
+            typename CorrSetT::value_type::IndicesLexicographicalComparator comparator;
+
+#pragma omp parallel sections
+            {
+#pragma omp section
+                std::sort(corr_first_to_second.begin(), corr_first_to_second.end(), comparator);
+#pragma omp section
+                std::sort(corr_second_to_first.begin(), corr_second_to_first.end(), comparator);
+            }
+
+            correspondences.clear();
+            correspondences.reserve(corr_first_to_second.size() + corr_second_to_first.size());
+
+            if (require_reciprocal) {
+                std::set_intersection(corr_first_to_second.begin(), corr_first_to_second.end(),
+                                      corr_second_to_first.begin(), corr_second_to_first.end(),
+                                      std::back_inserter(correspondences), comparator);
+            } else {
+                std::set_union(corr_first_to_second.begin(), corr_first_to_second.end(),
+                               corr_second_to_first.begin(), corr_second_to_first.end(),
+                               std::back_inserter(correspondences), comparator);
+            }
+        }
+    } // namespace internal
+
     template <typename ScalarT, ptrdiff_t EigenDim, typename FirstTreeT, typename SecondTreeT, typename CorrSetT, class EvaluatorT = DistanceEvaluator<ScalarT,ScalarT>>
     void findNNCorrespondencesBidirectional(const ConstVectorSetMatrixMap<ScalarT,EigenDim> &first_points,
                                             const ConstVectorSetMatrixMap<ScalarT,EigenDim> &second_points,
@@ -72,29 +185,23 @@ namespace cilantro {
         CorrSetT corr_first_to_second, corr_second_to_first;
         findNNCorrespondencesUnidirectional<ScalarT,EigenDim>(first_points, second_tree, false, corr_first_to_second, max_distance, evaluator);
         findNNCorrespondencesUnidirectional<ScalarT,EigenDim>(second_points, first_tree, true, corr_second_to_first, max_distance, evaluator);
+        internal::mergeBidirectionalCorrespondences(corr_first_to_second, corr_second_to_first, correspondences, require_reciprocal);
+    }
 
-        typename CorrSetT::value_type::IndicesLexicographicalComparator comparator;
-
-#pragma omp parallel sections
-        {
-#pragma omp section
-            std::sort(corr_first_to_second.begin(), corr_first_to_second.end(), comparator);
-#pragma omp section
-            std::sort(corr_second_to_first.begin(), corr_second_to_first.end(), comparator);
-        }
-
-        correspondences.clear();
-        correspondences.reserve(corr_first_to_second.size() + corr_second_to_first.size());
-
-        if (require_reciprocal) {
-            std::set_intersection(corr_first_to_second.begin(), corr_first_to_second.end(),
-                                  corr_second_to_first.begin(), corr_second_to_first.end(),
-                                  std::back_inserter(correspondences), comparator);
-        } else {
-            std::set_union(corr_first_to_second.begin(), corr_first_to_second.end(),
-                           corr_second_to_first.begin(), corr_second_to_first.end(),
-                           std::back_inserter(correspondences), comparator);
-        }
+    template <typename ScalarT, ptrdiff_t EigenDim, typename FirstTreeT, typename SecondTreeT, typename CorrSetT, class EvaluatorT = DistanceEvaluator<ScalarT,ScalarT>, typename FirstIndexT = size_t, typename SecondIndexT = size_t>
+    void findNNCorrespondencesBidirectional(const ConstVectorSetIndexView<ScalarT,EigenDim,FirstIndexT> &first_points,
+                                            const ConstVectorSetIndexView<ScalarT,EigenDim,SecondIndexT> &second_points,
+                                            const FirstTreeT &first_tree,
+                                            const SecondTreeT &second_tree,
+                                            CorrSetT &correspondences,
+                                            typename EvaluatorT::OutputScalar max_distance,
+                                            bool require_reciprocal = false,
+                                            const EvaluatorT &evaluator = EvaluatorT())
+    {
+        CorrSetT corr_first_to_second, corr_second_to_first;
+        findNNCorrespondencesUnidirectional<ScalarT,EigenDim>(first_points, second_tree, false, corr_first_to_second, max_distance, evaluator);
+        findNNCorrespondencesUnidirectional<ScalarT,EigenDim>(second_points, first_tree, true, corr_second_to_first, max_distance, evaluator);
+        internal::mergeBidirectionalCorrespondences(corr_first_to_second, corr_second_to_first, correspondences, require_reciprocal);
     }
 
     template <typename ScalarT, ptrdiff_t EigenDim, typename FirstTreeT, typename SecondTreeT, typename CorrSetT, class EvaluatorT = DistanceEvaluator<ScalarT,ScalarT>>
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <Eigen/Sparse>
 #include <cilantro/core/common_pair_evaluators.hpp>
+#include <cilantro/core/nearest_neighbors.hpp>
 
 namespace cilantro {
     template <typename T, typename DegT = size_t>
@@ -47,6 +49,39 @@ namespace cilantro {
         return (remove_self) ? sum - adj_list.size() : sum;
     }
 
+    template <typename ScalarT, typename IndexT, typename DegT = size_t>
+    std::vector<DegT> getNNGraphNodeDegrees(const FlatNeighborhoodSet<ScalarT,IndexT> &adj_list,
+                                            bool remove_self = true)
+    {
+        std::vector<DegT> deg(adj_list.size());
+        const size_t self = (remove_self) ? 1 : 0;
+#pragma omp parallel for
+        for (size_t i = 0; i < deg.size(); i++) {
+            deg[i] = adj_list.offsets[i + 1] - adj_list.offsets[i] - self;
+        }
+        return deg;
+    }
+
+    template <typename ScalarT, typename IndexT>
+    size_t getNNGraphMaxNodeDegree(const FlatNeighborhoodSet<ScalarT,IndexT> &adj_list,
+                                   bool remove_self = true)
+    {
+        size_t max = 0;
+#pragma omp parallel for reduction (max: max)
+        for (size_t i = 0; i < adj_list.size(); i++) {
+            const size_t deg = adj_list.offsets[i + 1] - adj_list.offsets[i];
+            if (max < deg) max = deg;
+        }
+        return (remove_self) ? max - 1 : max;
+    }
+
+    template <typename ScalarT, typename IndexT>
+    inline size_t getNNGraphSumOfNodeDegrees(const FlatNeighborhoodSet<ScalarT,IndexT> &adj_list,
+                                             bool remove_self = true)
+    {
+        return (remove_self) ? adj_list.getNumberOfNeighbors() - adj_list.size() : adj_list.getNumberOfNeighbors();
+    }
+
     template <typename NeighborhoodSetT, class PairEvaluatorT, typename ValueT = typename PairEvaluatorT::OutputScalar>
     std::vector<std::vector<ValueT>> getNNGraphFunctionValueList(const NeighborhoodSetT &adj_list,
                                                                  const PairEvaluatorT &evaluator = PairEvaluatorT())
@@ -116,6 +151,66 @@ namespace cilantro {
         return mat;
     }
 
+    // The CSR layout of a FlatNeighborhoodSet already is the column-major (CSC) layout of the graph matrix
+    // (column i holds the neighborhood of i), so columns are filled in place, without triplets
+    template <typename ScalarT, typename IndexT, class PairEvaluatorT, typename ValueT = typename PairEvaluatorT::OutputScalar>
+    Eigen::SparseMatrix<ValueT> getNNGraphFunctionValueSparseMatrix(const FlatNeighborhoodSet<ScalarT,IndexT> &adj_list,
+                                                                    const PairEvaluatorT &evaluator = PairEvaluatorT(),
+                                                                    bool force_symmetry = false)
+    {
+        typedef typename Eigen::SparseMatrix<ValueT>::StorageIndex StorageIndex;
+
+        // Sort each column by row and merge duplicate rows (summed, as setFromTriplets does)
+        std::vector<std::pair<StorageIndex,ValueT>> entries(adj_list.getNumberOfNeighbors());
+        std::vector<size_t> column_nnz(adj_list.size());
+#pragma omp parallel for schedule (dynamic, 256)
+        for (size_t i = 0; i < adj_list.size(); i++) {
+            const size_t begin = adj_list.offsets[i], end = adj_list.offsets[i + 1];
+            for (size_t j = begin; j < end; j++) {
+                const auto &nb = adj_list.neighbors[j];
+                entries[j].first = static_cast<StorageIndex>(nb.index);
+                entries[j].second = evaluator(i, nb.index, nb.value);
+            }
+            std::sort(entries.begin() + begin, entries.begin() + end,
+                      [](const std::pair<StorageIndex,ValueT> &a, const std::pair<StorageIndex,ValueT> &b) { return a.first < b.first; });
+            size_t last = begin;
+            for (size_t j = begin + 1; j < end; j++) {
+                if (entries[j].first == entries[last].first) {
+                    entries[last].second += entries[j].second;
+                } else {
+                    entries[++last] = entries[j];
+                }
+            }
+            column_nnz[i] = (end > begin) ? last - begin + 1 : 0;
+        }
+
+        Eigen::SparseMatrix<ValueT> mat(adj_list.size(), adj_list.size());
+        StorageIndex * const outer = mat.outerIndexPtr();
+        outer[0] = 0;
+        for (size_t i = 0; i < adj_list.size(); i++) {
+            outer[i + 1] = outer[i] + static_cast<StorageIndex>(column_nnz[i]);
+        }
+        mat.resizeNonZeros(outer[adj_list.size()]);
+        StorageIndex * const inner = mat.innerIndexPtr();
+        ValueT * const values = mat.valuePtr();
+#pragma omp parallel for
+        for (size_t i = 0; i < adj_list.size(); i++) {
+            const size_t src = adj_list.offsets[i];
+            for (size_t j = 0; j < column_nnz[i]; j++) {
+                inner[outer[i] + j] = entries[src + j].first;
+                values[outer[i] + j] = entries[src + j].second;
+            }
+        }
+
+        // Symmetric triplet insertion sums both directions, i.e. yields A + A^T
+        if (force_symmetry) {
+            const Eigen::SparseMatrix<ValueT> transposed(mat.transpose());
+            mat = mat + transposed;
+        }
+
+        return mat;
+    }
+
     template <typename NeighborhoodSetT, typename ValueT = bool>
     inline Eigen::Matrix<ValueT,Eigen::Dynamic,Eigen::Dynamic> getNNGraphDenseAdjacencyMatrix(const NeighborhoodSetT &adj_list,
                                                                                               bool force_symmetry = false)